@@ -18,26 +18,47 @@ References
 [SNKO05] Yu Sasaki and Yusuke Naito and Noboru Kunihiro and Kazuo Ohta: Improved Collision Attack on MD5, Cryptology ePrint Archive: Report 2005/400, 7 Nov 2005, http://eprint.iacr.org/2005/400.pdf
 [LiLa05] Liang J. and Lai X.: Improved Collision Attack on Hash Function MD5, Cryptology ePrint Archive: Report 425/2005, 23 Nov 2005, http://eprint.iacr.org/2005/425.pdf.
 
-  
-Compile linking the math library.
+
 
 */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <ctype.h>
-#include <math.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#endif
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 
 ///////////////////////////////////////////////////////////////
 ///                    GLOBAL VARIABLES                      //
 ///////////////////////////////////////////////////////////////
 
-//Set Tunnels to use (0/1)
+//Set Tunnels to use by default (0/1). They can also be chosen at runtime with --tunnels
 #define USE_B1_Q4 1
 #define USE_B1_Q9 1
 #define USE_B1_Q10 1
@@ -45,12 +66,36 @@ Compile linking the math library.
 #define USE_B1_Q14 1
 #define USE_B1_Q20 1
 #define USE_B2_Q9 1
+#define USE_B2_Q12Q11 1
+
+//Tunnel flags. Every combination of tunnels has its own Block1()/Block2() kernel, specialized at compile time,
+//so the loops of disabled tunnels are removed and the enabled ones have constant trip counts.
+#define TUNNEL_B1_Q4      0x01
+#define TUNNEL_B1_Q9      0x02
+#define TUNNEL_B1_Q10     0x04
+#define TUNNEL_B1_Q13     0x08
+#define TUNNEL_B1_Q14     0x10
+#define TUNNEL_B1_Q20     0x20
+#define TUNNEL_B2_Q9      0x40
+#define TUNNEL_B2_Q12Q11  0x80
+#define TUNNELS_B1        0x3f
+#define TUNNELS_B2        0xc0
+#define TUNNELS_NUMBER    8
 
 //Set what to store or print (0/1)
 #define WRITE_BLOCKS_SUMMARY 1
 #define WRITE_BLOCKS_TO_DISK 1
 #define PRINT_FINAL_HASH 1
 #define PRINT_FINAL_HASH_IN_SUMMARY 1
+#define PRINT_B2_STATS 1
+
+//Put USDT probes for bpftrace or perf in the binary (0/1). They need sys/sdt.h (systemtap-sdt-dev) and cost a nop
+//each when nobody is tracing them.
+#define USE_PROBES 1
+
+//Count attempts and rejections of every condition check and print a report of them (0/1). 
+//When 0, the counters are compiled out.
+#define COUNT_CONDITIONS 0
 
 //mask_bit[i] is the number that has 1 in bit position i, 0 otherwise. Only used by bit function.
 const uint32_t mask_bit[33] = { 0x0, 
@@ -59,8 +104,91 @@ const uint32_t mask_bit[33] = { 0x0,
                                 0x00010000,0x00020000,0x00040000,0x00080000,0x00100000,0x00200000,0x00400000,0x00800000,
                                 0x01000000,0x02000000,0x04000000,0x08000000,0x10000000,0x20000000,0x40000000,0x80000000 };
 
-//Message blocks
-uint8_t v1[128],v2[128];
+//Message blocks. Every thread has its own copy: the search threads get the ones of the thread that starts the search, 
+//and give back those of the collision found (see parallel_search()).
+__thread uint8_t v1[128],v2[128];
+
+//Tunnels in use, as a combination of TUNNEL_* flags
+uint32_t tunnels = USE_B1_Q4 * TUNNEL_B1_Q4   + USE_B1_Q9 * TUNNEL_B1_Q9   + USE_B1_Q10 * TUNNEL_B1_Q10 + 
+                   USE_B1_Q13 * TUNNEL_B1_Q13 + USE_B1_Q14 * TUNNEL_B1_Q14 + USE_B1_Q20 * TUNNEL_B1_Q20 + 
+                   USE_B2_Q9 * TUNNEL_B2_Q9   + USE_B2_Q12Q11 * TUNNEL_B2_Q12Q11;
+
+//Tunnel names, in the order of the TUNNEL_* flags
+const char * tunnel_names[TUNNELS_NUMBER] = { "B1Q4", "B1Q9", "B1Q10", "B1Q13", "B1Q14", "B1Q20", "B2Q9", "B2Q12Q11" };
+
+//Search levels of Block 1 and Block 2. For every level we count how many candidates entered it (stage_itr) and
+//how many of them satisfied its conditions (stage_pass). The Q9 levels include the tail of the block (Q[25..64]),
+//their passes are the candidates that reach the differential check.
+enum { ST_B1_OUTER, ST_B1_Q10, ST_B1_Q20, ST_B1_Q13, ST_B1_Q14, ST_B1_Q4, ST_B1_Q9, ST_B1_DIFF,
+       ST_B2_Q16, ST_B2_Q1Q2, ST_B2_Q12Q11, ST_B2_Q4, ST_B2_Q9, ST_B2_DIFF, STAGES_NUMBER };
+
+const char * stage_names[STAGES_NUMBER] = { "B1 outer draw", "B1 tunnel Q10", "B1 tunnel Q20", "B1 tunnel Q13", 
+                                            "B1 tunnel Q14", "B1 tunnel Q4", "B1 tunnel Q9", "B1 differential",
+                                            "B2 MMMM Q16", "B2 MMMM Q1/Q2", "B2 MMMM Q12/Q11", "B2 MMMM Q4", 
+                                            "B2 tunnel Q9", "B2 differential" };
+
+//Conditions checked by the levels: COND_Q(n) are the bit conditions on Q[n], COND_SIGMA(n) the extra conditions 
+//on Σn, COND_IHV the conditions on the intermediate hash value of Block 1 and COND_DIFF the differential check.
+//They are numbered in the order they are checked, except COND_BYTES, the byte constraints of --bytes, that are 
+//checked at every level on the message words it fixes.
+#define COND_Q(n)          (2 * (n))
+#define COND_SIGMA(n)      (2 * (n) - 1)
+#define COND_IHV           129
+#define COND_DIFF          130
+#define COND_BYTES         131
+#define COND_NUMBER        132
+
+//Hardware events counted by --perf-stages: cycles, instructions, branch misses, L1 data cache read misses
+#define PERF_EVENTS        4
+
+//Search statistics: every thread counts in its own stats, that are merged with merge_stats() before reporting.
+//For each level and condition, cond_attempt counts how many candidates were checked and cond_reject how many failed.
+//perf_count are the hardware events counted in every level with --perf-stages (the last row is outside the searches).
+//tail_q48 counts the candidates of each block that satisfy the conditions until Q[48].
+typedef struct {
+  uint64_t stage_itr[STAGES_NUMBER], stage_pass[STAGES_NUMBER];
+  uint64_t tail_q48[2];
+  uint64_t perf_count[STAGES_NUMBER + 1][PERF_EVENTS];
+#if COUNT_CONDITIONS
+  uint64_t cond_attempt[STAGES_NUMBER][COND_NUMBER], cond_reject[STAGES_NUMBER][COND_NUMBER];
+#endif
+} search_stats;
+
+__thread search_stats stats;
+
+//PROBE(name, ...) is the USDT probe md5_tunneling:name with the given arguments
+#if USE_PROBES && defined(_SYS_SDT_H)
+#define PROBE(...)           STAP_PROBEV(md5_tunneling, __VA_ARGS__)
+#else
+#define PROBE(...)           ((void) 0)
+#endif
+
+//Level the calling thread is running, for --perf-stages (-1 when the counters are off)
+__thread int perf_stage = -1;
+
+void perf_switch(int s);
+
+//Every level that starts an iteration becomes the running level for --perf-stages
+#define PERF_STAGE(s)        (__builtin_expect(perf_stage >= 0, 0) && (perf_stage != (s)) ? perf_switch(s) : (void) 0)
+
+//Level counters are only written by their thread, with relaxed stores so that the progress monitor can read them
+#define RELAXED_ADD(c, n)    __atomic_store_n(&(c), (c) + (n), __ATOMIC_RELAXED)
+#define RELAXED_READ(c)      __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
+#define STAGE_ITR(s)         (RELAXED_ADD(stats.stage_itr[s], 1), PERF_STAGE(s))
+#define STAGE_PASS(s)        (RELAXED_ADD(stats.stage_pass[s], 1))
+#define STAGE_ITR_N(s, n)    (RELAXED_ADD(stats.stage_itr[s], n), PERF_STAGE(s))
+#define STAGE_PASS_N(s, n)   (RELAXED_ADD(stats.stage_pass[s], n))
+
+//CHECK(s, c, rejected) counts the check of condition c at level s and returns rejected. CHECK_ALSO counts only the 
+//rejection, for the checks after the first of the same condition.
+#if COUNT_CONDITIONS
+#define CHECK(s, c, rejected)       (stats.cond_attempt[s][c]++, (rejected) ? (stats.cond_reject[s][c]++, 1) : 0)
+#define CHECK_ALSO(s, c, rejected)  ((rejected) ? (stats.cond_reject[s][c]++, 1) : 0)
+#else
+#define CHECK(s, c, rejected)       (rejected)
+#define CHECK_ALSO(s, c, rejected)  (rejected)
+#endif
 
 ///////////////////////////////////////////////////////////////
 ///                 MD5 HASH FUNCTIONS                       //
@@ -98,81 +226,109 @@ uint8_t v1[128],v2[128];
  (a) += (b); \
  }
 
-//Variables to perform hash
-uint32_t a,b,c,d,Hx[16];
-uint32_t IV1,IV2,IV3,IV4;
-//Intermediate hash values of the blocks
-uint32_t A0,B0,C0,D0, A1,B1,C1,D1;
+//Constants of the 64 steps, and rotations of the steps of each round (for the loops that don't use HMD5Tr)
+const uint32_t md5_T[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+const int md5_S[4][4] = { {7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21} };
+
+//Variables to perform hash, one copy per search thread
+__thread uint32_t a,b,c,d,Hx[16];
+__thread uint32_t IV1,IV2,IV3,IV4;
+//Intermediate hash values of the blocks, per thread as the message blocks
+__thread uint32_t A0,B0,C0,D0, A1,B1,C1,D1;
+
+//Search context: the IV (block 1) or the chaining value (block 2) and the terms of the first steps that depend only 
+//on them. It is prepared once per search, so these terms are not recomputed in the loops.
+typedef struct {
+  uint32_t QM0, QM1, QM2, QM3;
+  uint32_t step1;   //F(QM0,QM1,QM2) + QM3 + 0xd76aa478, step 1 without x[0]
+  uint32_t step2;   //QM2 + 0xe8c7b756, step 2 without F(Q[1],QM0,QM1) and x[1]
+  uint32_t step3;   //QM1 + 0x242070db, step 3 without F(Q[2],Q[1],QM0) and x[2]
+  uint32_t step4;   //QM0 + 0xc1bdceee, step 4 without F(Q[3],Q[2],Q[1]) and x[3]
+} search_context;
+
+//The 64 steps of MD5 on the state a,b,c,d with the message words x[0..15]
+#define MD5_STEPS(a, b, c, d, x) {                       \
+  FFx(a, b, c, d, x[ 0],  7, 0xd76aa478); /* 1  - a1 */  \
+  FFx(d, a, b, c, x[ 1], 12, 0xe8c7b756); /* 2  - d1 */  \
+  FFx(c, d, a, b, x[ 2], 17, 0x242070db); /* 3  - c1 */  \
+  FFx(b, c, d, a, x[ 3], 22, 0xc1bdceee); /* 4  - b1 */  \
+  FFx(a, b, c, d, x[ 4],  7, 0xf57c0faf); /* 5  - a2 */  \
+  FFx(d, a, b, c, x[ 5], 12, 0x4787c62a); /* 6  - d2 */  \
+  FFx(c, d, a, b, x[ 6], 17, 0xa8304613); /* 7  - c2 */  \
+  FFx(b, c, d, a, x[ 7], 22, 0xfd469501); /* 8  - b2 */  \
+  FFx(a, b, c, d, x[ 8],  7, 0x698098d8); /* 9  - a3 */  \
+  FFx(d, a, b, c, x[ 9], 12, 0x8b44f7af); /* 10 - d3 */  \
+  FFx(c, d, a, b, x[10], 17, 0xffff5bb1); /* 11 - c3 */  \
+  FFx(b, c, d, a, x[11], 22, 0x895cd7be); /* 12 - b3 */  \
+  FFx(a, b, c, d, x[12],  7, 0x6b901122); /* 13 - a4 */  \
+  FFx(d, a, b, c, x[13], 12, 0xfd987193); /* 14 - d4 */  \
+  FFx(c, d, a, b, x[14], 17, 0xa679438e); /* 15 - c4 */  \
+  FFx(b, c, d, a, x[15], 22, 0x49b40821); /* 16 - b4 */  \
+                                                         \
+  GGx(a, b, c, d, x[ 1],  5, 0xf61e2562); /* 17 - a5 */  \
+  GGx(d, a, b, c, x[ 6],  9, 0xc040b340); /* 18 - d5 */  \
+  GGx(c, d, a, b, x[11], 14, 0x265e5a51); /* 19 - c5 */  \
+  GGx(b, c, d, a, x[ 0], 20, 0xe9b6c7aa); /* 20 - b5 */  \
+  GGx(a, b, c, d, x[ 5],  5, 0xd62f105d); /* 21 - a6 */  \
+  GGx(d, a, b, c, x[10],  9,  0x2441453); /* 22 - d6 */  \
+  GGx(c, d, a, b, x[15], 14, 0xd8a1e681); /* 23 - c6 */  \
+  GGx(b, c, d, a, x[ 4], 20, 0xe7d3fbc8); /* 24 - b6 */  \
+  GGx(a, b, c, d, x[ 9],  5, 0x21e1cde6); /* 25 - a7 */  \
+  GGx(d, a, b, c, x[14],  9, 0xc33707d6); /* 26 - d7 */  \
+  GGx(c, d, a, b, x[ 3], 14, 0xf4d50d87); /* 27 - c7 */  \
+  GGx(b, c, d, a, x[ 8], 20, 0x455a14ed); /* 28 - b7 */  \
+  GGx(a, b, c, d, x[13],  5, 0xa9e3e905); /* 29 - a8 */  \
+  GGx(d, a, b, c, x[ 2],  9, 0xfcefa3f8); /* 30 - d8 */  \
+  GGx(c, d, a, b, x[ 7], 14, 0x676f02d9); /* 31 - c8 */  \
+  GGx(b, c, d, a, x[12], 20, 0x8d2a4c8a); /* 32 - b8 */  \
+                                                         \
+  HHx(a, b, c, d, x[ 5],  4, 0xfffa3942); /* 33 - a9 */  \
+  HHx(d, a, b, c, x[ 8], 11, 0x8771f681); /* 34 - d9 */  \
+  HHx(c, d, a, b, x[11], 16, 0x6d9d6122); /* 35 - c9 */  \
+  HHx(b, c, d, a, x[14], 23, 0xfde5380c); /* 36 - b9 */  \
+  HHx(a, b, c, d, x[ 1],  4, 0xa4beea44); /* 37 - a10 */ \
+  HHx(d, a, b, c, x[ 4], 11, 0x4bdecfa9); /* 38 - d10 */ \
+  HHx(c, d, a, b, x[ 7], 16, 0xf6bb4b60); /* 39 - c10 */ \
+  HHx(b, c, d, a, x[10], 23, 0xbebfbc70); /* 40 - b10 */ \
+  HHx(a, b, c, d, x[13],  4, 0x289b7ec6); /* 41 - a11 */ \
+  HHx(d, a, b, c, x[ 0], 11, 0xeaa127fa); /* 42 - d11 */ \
+  HHx(c, d, a, b, x[ 3], 16, 0xd4ef3085); /* 43 - c11 */ \
+  HHx(b, c, d, a, x[ 6], 23,  0x4881d05); /* 44 - b11 */ \
+  HHx(a, b, c, d, x[ 9],  4, 0xd9d4d039); /* 45 - a12 */ \
+  HHx(d, a, b, c, x[12], 11, 0xe6db99e5); /* 46 - d12 */ \
+  HHx(c, d, a, b, x[15], 16, 0x1fa27cf8); /* 47 - c12 */ \
+  HHx(b, c, d, a, x[ 2], 23, 0xc4ac5665); /* 48 - b12 */ \
+                                                         \
+  IIx(a, b, c, d, x[ 0],  6, 0xf4292244); /* 49 - a13 */ \
+  IIx(d, a, b, c, x[ 7], 10, 0x432aff97); /* 50 - d13 */ \
+  IIx(c, d, a, b, x[14], 15, 0xab9423a7); /* 51 - c13 */ \
+  IIx(b, c, d, a, x[ 5], 21, 0xfc93a039); /* 52 - b13 */ \
+  IIx(a, b, c, d, x[12],  6, 0x655b59c3); /* 53 - a14 */ \
+  IIx(d, a, b, c, x[ 3], 10, 0x8f0ccc92); /* 54 - d14 */ \
+  IIx(c, d, a, b, x[10], 15, 0xffeff47d); /* 55 - c14 */ \
+  IIx(b, c, d, a, x[ 1], 21, 0x85845dd1); /* 56 - b14 */ \
+  IIx(a, b, c, d, x[ 8],  6, 0x6fa87e4f); /* 57 - a15 */ \
+  IIx(d, a, b, c, x[15], 10, 0xfe2ce6e0); /* 58 - d15 */ \
+  IIx(c, d, a, b, x[ 6], 15, 0xa3014314); /* 59 - c15 */ \
+  IIx(b, c, d, a, x[13], 21, 0x4e0811a1); /* 60 - b15 */ \
+  IIx(a, b, c, d, x[ 4],  6, 0xf7537e82); /* 61 - a16 */ \
+  IIx(d, a, b, c, x[11], 10, 0xbd3af235); /* 62 - d16 */ \
+  IIx(c, d, a, b, x[ 2], 15, 0x2ad7d2bb); /* 63 - c16 */ \
+  IIx(b, c, d, a, x[ 9], 21, 0xeb86d391); /* 64 - b16 */ \
+}
 
+//The 64 steps on the thread-local a,b,c,d and Hx of the search
 static void HMD5Tr() {
 
-  FFx(a, b, c, d, Hx[ 0],  7, 0xd76aa478); /* 1  - a1 */
-  FFx(d, a, b, c, Hx[ 1], 12, 0xe8c7b756); /* 2  - d1 */
-  FFx(c, d, a, b, Hx[ 2], 17, 0x242070db); /* 3  - c1 */
-  FFx(b, c, d, a, Hx[ 3], 22, 0xc1bdceee); /* 4  - b1 */
-  FFx(a, b, c, d, Hx[ 4],  7, 0xf57c0faf); /* 5  - a2 */
-  FFx(d, a, b, c, Hx[ 5], 12, 0x4787c62a); /* 6  - d2 */
-  FFx(c, d, a, b, Hx[ 6], 17, 0xa8304613); /* 7  - c2 */
-  FFx(b, c, d, a, Hx[ 7], 22, 0xfd469501); /* 8  - b2 */
-  FFx(a, b, c, d, Hx[ 8],  7, 0x698098d8); /* 9  - a3 */
-  FFx(d, a, b, c, Hx[ 9], 12, 0x8b44f7af); /* 10 - d3 */
-  FFx(c, d, a, b, Hx[10], 17, 0xffff5bb1); /* 11 - c3 */
-  FFx(b, c, d, a, Hx[11], 22, 0x895cd7be); /* 12 - b3 */
-  FFx(a, b, c, d, Hx[12],  7, 0x6b901122); /* 13 - a4 */
-  FFx(d, a, b, c, Hx[13], 12, 0xfd987193); /* 14 - d4 */
-  FFx(c, d, a, b, Hx[14], 17, 0xa679438e); /* 15 - c4 */
-  FFx(b, c, d, a, Hx[15], 22, 0x49b40821); /* 16 - b4 */
-
-  GGx(a, b, c, d, Hx[ 1],  5, 0xf61e2562); /* 17 - a5 */
-  GGx(d, a, b, c, Hx[ 6],  9, 0xc040b340); /* 18 - d5 */
-  GGx(c, d, a, b, Hx[11], 14, 0x265e5a51); /* 19 - c5 */
-  GGx(b, c, d, a, Hx[ 0], 20, 0xe9b6c7aa); /* 20 - b5 */
-  GGx(a, b, c, d, Hx[ 5],  5, 0xd62f105d); /* 21 - a6 */
-  GGx(d, a, b, c, Hx[10],  9,  0x2441453); /* 22 - d6 */
-  GGx(c, d, a, b, Hx[15], 14, 0xd8a1e681); /* 23 - c6 */
-  GGx(b, c, d, a, Hx[ 4], 20, 0xe7d3fbc8); /* 24 - b6 */
-  GGx(a, b, c, d, Hx[ 9],  5, 0x21e1cde6); /* 25 - a7 */
-  GGx(d, a, b, c, Hx[14],  9, 0xc33707d6); /* 26 - d7 */
-  GGx(c, d, a, b, Hx[ 3], 14, 0xf4d50d87); /* 27 - c7 */
-  GGx(b, c, d, a, Hx[ 8], 20, 0x455a14ed); /* 28 - b7 */
-  GGx(a, b, c, d, Hx[13],  5, 0xa9e3e905); /* 29 - a8 */
-  GGx(d, a, b, c, Hx[ 2],  9, 0xfcefa3f8); /* 30 - d8 */
-  GGx(c, d, a, b, Hx[ 7], 14, 0x676f02d9); /* 31 - c8 */
-  GGx(b, c, d, a, Hx[12], 20, 0x8d2a4c8a); /* 32 - b8 */
-
-  HHx(a, b, c, d, Hx[ 5],  4, 0xfffa3942); /* 33 - a9 */
-  HHx(d, a, b, c, Hx[ 8], 11, 0x8771f681); /* 34 - d9 */
-  HHx(c, d, a, b, Hx[11], 16, 0x6d9d6122); /* 35 - c9 */
-  HHx(b, c, d, a, Hx[14], 23, 0xfde5380c); /* 36 - b9 */
-  HHx(a, b, c, d, Hx[ 1],  4, 0xa4beea44); /* 37 - a10 */
-  HHx(d, a, b, c, Hx[ 4], 11, 0x4bdecfa9); /* 38 - d10 */
-  HHx(c, d, a, b, Hx[ 7], 16, 0xf6bb4b60); /* 39 - c10 */
-  HHx(b, c, d, a, Hx[10], 23, 0xbebfbc70); /* 40 - b10 */
-  HHx(a, b, c, d, Hx[13],  4, 0x289b7ec6); /* 41 - a11 */
-  HHx(d, a, b, c, Hx[ 0], 11, 0xeaa127fa); /* 42 - d11 */
-  HHx(c, d, a, b, Hx[ 3], 16, 0xd4ef3085); /* 43 - c11 */
-  HHx(b, c, d, a, Hx[ 6], 23,  0x4881d05); /* 44 - b11 */
-  HHx(a, b, c, d, Hx[ 9],  4, 0xd9d4d039); /* 45 - a12 */
-  HHx(d, a, b, c, Hx[12], 11, 0xe6db99e5); /* 46 - d12 */
-  HHx(c, d, a, b, Hx[15], 16, 0x1fa27cf8); /* 47 - c12 */
-  HHx(b, c, d, a, Hx[ 2], 23, 0xc4ac5665); /* 48 - b12 */
-
-  IIx(a, b, c, d, Hx[ 0],  6, 0xf4292244); /* 49 - a13 */
-  IIx(d, a, b, c, Hx[ 7], 10, 0x432aff97); /* 50 - d13 */
-  IIx(c, d, a, b, Hx[14], 15, 0xab9423a7); /* 51 - c13 */
-  IIx(b, c, d, a, Hx[ 5], 21, 0xfc93a039); /* 52 - b13 */
-  IIx(a, b, c, d, Hx[12],  6, 0x655b59c3); /* 53 - a14 */
-  IIx(d, a, b, c, Hx[ 3], 10, 0x8f0ccc92); /* 54 - d14 */
-  IIx(c, d, a, b, Hx[10], 15, 0xffeff47d); /* 55 - c14 */
-  IIx(b, c, d, a, Hx[ 1], 21, 0x85845dd1); /* 56 - b14 */
-  IIx(a, b, c, d, Hx[ 8],  6, 0x6fa87e4f); /* 57 - a15 */
-  IIx(d, a, b, c, Hx[15], 10, 0xfe2ce6e0); /* 58 - d15 */
-  IIx(c, d, a, b, Hx[ 6], 15, 0xa3014314); /* 59 - c15 */
-  IIx(b, c, d, a, Hx[13], 21, 0x4e0811a1); /* 60 - b15 */
-  IIx(a, b, c, d, Hx[ 4],  6, 0xf7537e82); /* 61 - a16 */
-  IIx(d, a, b, c, Hx[11], 10, 0xbd3af235); /* 62 - d16 */
-  IIx(c, d, a, b, Hx[ 2], 15, 0x2ad7d2bb); /* 63 - c16 */
-  IIx(b, c, d, a, Hx[ 9], 21, 0xeb86d391); /* 64 - b16 */
+  MD5_STEPS(a, b, c, d, Hx);
 }
 
 
@@ -180,29 +336,186 @@ static void HMD5Tr() {
 ///        FUNCTIONS USED DURING BLOCK GENERATION            //
 ///////////////////////////////////////////////////////////////
 
-//Generates the vectors mask for tunnels, that is all the integers whose mask_bits can be 0 or 1.
-uint32_t * generate_mask(int32_t strength, int32_t * mask_bits) {     
+//Generates in mask[] the vectors mask for tunnels, that is all the integers whose mask_bits can be 0 or 1.
+//mask[] has to contain 2^strength elements.
+void generate_mask(uint32_t * mask, int32_t strength, const int32_t * mask_bits) {     
+
+        uint32_t i;
+        int32_t j;
 
-        int32_t mask_cardinality = (int32_t) pow(2, strength);
+        for (i=0; i < (1u << strength); i++) {
+                mask[i] = 0;
+                for (j=0; j<strength; j++)
+                        mask[i] = mask[i] ^ (((i >> j) & 1) << (mask_bits[j]-1));
+        }
 
-        uint32_t * mask = calloc( mask_cardinality , sizeof(uint32_t) );
+}
 
-        //If more or equal 32 bits tunneling is useless
-        if (strength < 32) {
 
-                int i,j;
+//Tunnels are walked in Gray code order: step itr > 0 of a tunnel changes only the bit mask_bits[j] of the tunnel word,
+//where j is the number of trailing zeros of itr. After 2^strength steps all the values of the mask have been visited.
+#define GRAY_BIT(itr, mask_bits) (mask_bit[(mask_bits)[__builtin_ctz(itr)]])
 
-                for (i=0; i<mask_cardinality; i++)
-                        for (j=0; j<strength; j++)
-                                mask[i] = mask[i] ^ (((i >> j) & 1) << (mask_bits[j]-1));
-                return mask;
-        }
+//Difference new - old of a word whose bit flip is changed, used to update by a delta the x[] that depend linearly on it
+#define FLIP_DELTA(word, flip) (((word) & (flip)) ? -(flip) : (flip))
 
-        else {
-                printf("Uncorrect parameters in mask generation.\n");
-                return NULL;
-        }
+//Byte constraints of --bytes: bit b of byte_allowed[p] is set if byte p of the blocks (0..63 block 1, 64..127 block 2)
+//can be b, in both messages. byte_rules is the number of rules given (0 = every byte is allowed).
+uint64_t byte_allowed[128][4];
+int byte_rules = 0;
+
+//Returns 1 if the bytes of the word w are allowed from byte p
+static inline __attribute__((always_inline)) int word_allowed(int p, uint32_t w) {
+
+  for (int j=0; j<4; j++, w >>= 8)
+    if ( ((byte_allowed[p + j][(w & 0xff) >> 6] >> (w & 63)) & 1) == 0 )
+      return 0;
+
+  return 1;
+}
+
+//Returns 1 if w can be the message word x[k] of block 1 or 2: the word of message 2 (see message2_ihv()) is checked
+//too. Every word is checked at the first level where it doesn't change any more, so the constraints prune the search 
+//as early as possible. No word is drawn directly (they all come from the Q[]), so the constraints can't be put in
+//the masks of the draws.
+static inline __attribute__((always_inline)) int x_allowed(const int block, const int k, uint32_t w) {
+
+  const int p = 64 * (block - 1) + 4 * k;
+
+  if (!word_allowed(p, w))
+    return 0;
+
+  if ( (k == 4) || (k == 14) )
+    return word_allowed(p, w + 0x80000000);
+
+  if (k == 11)
+    return word_allowed(p, w + ((block == 1) ? 0x00008000 : -0x00008000));
+
+  return 1;
+}
+
+//CHECK_X(s, block, k) is the check at level s of the constraints on x[k], only done when there are rules
+#define CHECK_X(s, block, k)  (byte_rules && CHECK(s, COND_BYTES, !x_allowed(block, k, x[k])))
+
+
+//Dynamic tunnel Q14 of block 1. Stores in admissible[] the indexes i of mask_Q14 such that const_unmasked + mask_Q14[i]
+//has zero bits in 0x03ffffd0, and returns their number. Indexes are stored in increasing order.
+//Mask bits 27,28,29 (index bits 7..9) don't change bits 1..26 of the sum, so only the 64 values of bits 1,2,3,5,6,7
+//(index bits 1..6) have to be checked. Adding these to const_unmasked gives at most a carry in bit 8, so bits 8..26 
+//of const_unmasked have to be all 0 or all 1, otherwise no value is admissible.
+uint32_t Q14_admissible(uint32_t const_unmasked, const uint32_t * mask_Q14, uint32_t * admissible) {
+
+  uint32_t i, j, n_low = 0, n = 0;
+  uint32_t low[64];
+
+  // 0x03ffff80 = 0000  0011  1111  1111  1111  1111  1000  0000
+  if ( ((const_unmasked & 0x03ffff80) != 0) && ((const_unmasked & 0x03ffff80) != 0x03ffff80) )
+    return 0;
+
+  for (i=0; i<64; i++)
+    if (((const_unmasked + mask_Q14[i]) & 0x03ffffd0) == 0)
+      low[n_low++] = i;
 
+  for (j=0; j<512; j+=64)
+    for (i=0; i<n_low; i++)
+      admissible[n++] = j + low[i];
+
+  return n;
+}
+
+
+//Prepares the search context for the chaining value A,B,C,D
+void prepare_context(search_context * ctx, uint32_t A, uint32_t B, uint32_t C, uint32_t D) {
+
+  ctx->QM3 = A;  ctx->QM0 = B;
+  ctx->QM1 = C;  ctx->QM2 = D;
+
+  ctx->step1 = F(ctx->QM0, ctx->QM1, ctx->QM2) + ctx->QM3 + 0xd76aa478;
+  ctx->step2 = ctx->QM2 + 0xe8c7b756;
+  ctx->step3 = ctx->QM1 + 0x242070db;
+  ctx->step4 = ctx->QM0 + 0xc1bdceee;
+
+}
+
+
+//Reads a comma separated list of tunnel names (or "all", "none") into a combination of TUNNEL_* flags. 
+//Returns 0 if ok, 1 if a name is unknown.
+int parse_tunnels(char * list, uint32_t * flags) {
+
+  char buff[256], * name;
+  int i;
+
+  strncpy(buff, list, sizeof(buff) - 1);
+  buff[sizeof(buff) - 1] = 0;
+
+  *flags = 0;
+  for (name = strtok(buff, ","); name != NULL; name = strtok(NULL, ",")) {
+
+    if (strcasecmp(name, "all") == 0) {
+      *flags = TUNNELS_B1 | TUNNELS_B2;
+      continue;
+    }
+
+    if (strcasecmp(name, "none") == 0) 
+      continue;
+
+    for (i=0; i<TUNNELS_NUMBER; i++)
+      if (strcasecmp(name, tunnel_names[i]) == 0)
+        break;
+
+    if (i == TUNNELS_NUMBER)
+      return 1;
+
+    *flags |= (1u << i);
+  }
+
+  return 0;
+}
+
+
+//Adds a rule of --bytes: [FIRST[-LAST]:]SET restricts the bytes FIRST..LAST of the blocks (all by default) to SET, a
+//comma separated list of hex bytes and ranges (e.g. 20-7e), or to the bytes not in it if it starts with ^.
+//Returns 0 if ok, 1 if the rule can't be read.
+int parse_bytes(const char * rule) {
+
+  uint64_t set[4] = { 0 };
+  unsigned long first = 0, last = 127, lo, hi;
+  const char * p = strchr(rule, ':');
+  char * end;
+  int negate;
+
+  if (byte_rules == 0)
+    memset(byte_allowed, 0xff, sizeof(byte_allowed));
+
+  if (p != NULL) {
+    first = last = strtoul(rule, &end, 10);
+    if (*end == '-')
+      last = strtoul(end + 1, &end, 10);
+    if ( (end != p) || (first > last) || (last > 127) )
+      return 1;
+    rule = p + 1;
+  }
+
+  negate = (*rule == '^');
+  rule += negate;
+
+  do {
+    lo = hi = strtoul(rule, &end, 16);
+    if (*end == '-')
+      hi = strtoul(end + 1, &end, 16);
+    if ( (end == rule) || (lo > hi) || (hi > 0xff) || ((*end != ',') && (*end != 0)) )
+      return 1;
+    for (unsigned long b = lo; b <= hi; b++)
+      set[b >> 6] |= 1ull << (b & 63);
+    rule = end + 1;
+  } while (*end == ',');
+
+  for (unsigned long i = first; i <= last; i++)
+    for (int j=0; j<4; j++)
+      byte_allowed[i][j] &= negate ? ~set[j] : set[j];
+
+  byte_rules++;
+  return 0;
 }
 
 
@@ -219,8 +532,9 @@ uint32_t mix(uint32_t a) {
 }
 
 
-//Random number generator. We will use an LCG pseudo random generator. Different options are possible
-uint32_t X;
+//Random number generator. We will use an LCG pseudo random generator. Different options are possible.
+//Every search thread has its own state.
+__thread uint32_t X;
 uint32_t rng( void ) {
   //X = (1664525*X + 1013904223) & 0xffffffff;
   X = (1103515245*X + 12345) & 0xffffffff;
@@ -234,21 +548,72 @@ uint32_t charhex_to_uint32( char *buff ) {
 }
 
 
-//Return time between 2 subsequent invocation
-clock_t time_start=0, time_end;
+//Search deadline, in seconds of the monotonic clock (0 = no deadline). Block1() and Block2() return -1 once it has passed.
+double search_deadline = 0;
+
+//Set by the first search thread that finds the (near-)collision: the other threads of the same search return -1 as at
+//the deadline. search_stop points to the flag of the search the thread is part of (search_found out of the searches).
+int search_found = 0;
+__thread int * search_stop = &search_found;
+
+//If set, every (near-)collision found by Block1() or Block2() is given to search_sink: the block of message 1 and 2
+//and the intermediate hash values of both messages (AA0..DD0, AA1..DD1). The search goes on until it returns 1, and
+//the (near-)collision that fills it is then stored as the result of the search.
+__thread int (* search_sink)(const uint32_t * x, const uint32_t * Hx, const uint32_t * ihv) = NULL;
+
+//Returns the seconds of the monotonic clock
+double now() {
+
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+
+}
+
+
+//Returns 1 if another thread found the (near-)collision or the search deadline has passed
+int search_expired() {
+  return __atomic_load_n(search_stop, __ATOMIC_RELAXED) || ((search_deadline != 0) && (now() > search_deadline));
+}
+
+
+//Claims the result for the calling thread. Returns 1 if no other thread found the (near-)collision before, 
+//so the caller can store it.
+int search_claim() {
+  return !__atomic_exchange_n(search_stop, 1, __ATOMIC_ACQ_REL);
+}
+
+
+//Returns the CPU seconds used by all the threads of the process
+double cpu_time() {
+
+  struct timespec t;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+
+}
+
+
+//Returns the wall time between 2 subsequent invocations, with the monotonic clock. The CPU time of the process 
+//in the same interval is left in timer_cpu.
+double timer_wall_start, timer_cpu_start, timer_cpu;
+int timer_running = 0;
+
 double Timer() { 
 
-  if (time_start==0) { 
-    time_start = clock();
+  if (!timer_running) { 
+    timer_running = 1;
+    timer_wall_start = now();
+    timer_cpu_start = cpu_time();
     return 0;
   }
 
   else {  
-    double delta;
-    time_end = clock();
-    delta = (double) (time_end - time_start) / CLOCKS_PER_SEC ;
-    time_start = 0;
-    return delta;
+    timer_running = 0;
+    timer_cpu = cpu_time() - timer_cpu_start;
+    return now() - timer_wall_start;
   }
 
 }
@@ -263,1310 +628,5458 @@ uint32_t bit(uint32_t a, uint32_t b) {
 }
 
 
-// Write block to disk - Returns 0 if ok, 1 if cannot open, 2 if write error
-int write_block(char *fname,void *block) {
-  
-  FILE *f;
-  size_t wrt;
+///////////////////////////////////////////////////////////////
+///                  PERFORMANCE COUNTERS                    //
+///////////////////////////////////////////////////////////////
 
-  f = fopen(fname,"wb");
-  if (f == NULL) 
-    return 1;
-  
-  wrt = fwrite(block,1,128,f);
-  
-  fclose(f);
-  
-  if (wrt == 128) 
+//Hardware events of --perf-stages, opened by perf_open() for the calling thread. The events that the kernel lets us 
+//read in user space are read with rdpmc, the others with read(). When the CPU cycles can't be counted (e.g. in 
+//virtual machines without a PMU) we count the task clock in nanoseconds instead.
+const char * perf_event_names[PERF_EVENTS] = { "cycles", "instructions", "branch-misses", "L1D-misses" };
+
+__thread int perf_fd[PERF_EVENTS] = { -1, -1, -1, -1 };
+__thread int perf_task_clock;
+
+#ifdef __linux__
+__thread struct perf_event_mmap_page * perf_page[PERF_EVENTS];
+#endif
+
+//Counts of every event when the running level started
+__thread uint64_t perf_start[PERF_EVENTS];
+
+
+//Returns the count of event e of the calling thread
+uint64_t perf_read(int e) {
+
+#ifdef __linux__
+  uint64_t count = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+  struct perf_event_mmap_page * pc = perf_page[e];
+  uint32_t seq, idx, lo, hi;
+  int64_t pmc;
+
+  //User space read of the counter, as documented in linux/perf_event.h
+  if ( (pc != NULL) && pc->cap_user_rdpmc ) {
+    do {
+      seq = pc->lock;
+      __asm__ volatile("" ::: "memory");
+      idx = pc->index;
+      count = pc->offset;
+      if (idx) {
+        __asm__ volatile("rdpmc" : "=a" (lo), "=d" (hi) : "c" (idx - 1));
+        pmc = (int64_t) (((uint64_t) hi << 32) | lo);
+        pmc <<= 64 - pc->pmc_width;
+        pmc >>= 64 - pc->pmc_width;
+        count += pmc;
+      }
+      __asm__ volatile("" ::: "memory");
+    } while (pc->lock != seq);
+
+    if (idx)
+      return count;
+  }
+#endif
+
+  if ( (perf_fd[e] < 0) || (read(perf_fd[e], &count, sizeof(count)) != sizeof(count)) )
     return 0;
-  
-  return 2;
 
+  return count;
+#else
+  (void) e;
+  return 0;
+#endif
 }
 
-///////////////////////////////////////////////////////////////
-///                    BLOCK FUNCTIONS                       //
-///////////////////////////////////////////////////////////////
 
-int Block1() {
+//Opens the event counters for the calling thread and starts counting. Returns 1 if no counter can be opened.
+int perf_open() {
 
-  uint32_t Q[65], x[16], QM0, QM1, QM2, QM3;
-  uint32_t sigma_Q19, sigma_Q20, sigma_Q23, sigma_Q35, sigma_Q62;
-  uint32_t i, itr_Q9, itr_Q4, itr_Q14, itr_Q13, itr_Q20, itr_Q10;
-  uint32_t tmp_q3, tmp_q4, tmp_q13, tmp_q14, tmp_q20, tmp_q21, tmp_q9, tmp_q10;
-  uint32_t tmp_x1, tmp_x15, tmp_x4;
-  uint32_t Q3_fix, Q4_fix, Q14_fix, const_masked, const_unmasked;
-  uint32_t AA0, BB0, CC0, DD0, AA1, BB1, CC1, DD1;
+#ifdef __linux__
+  struct perf_event_attr attr;
+  const uint32_t type[PERF_EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+  const uint64_t config[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+                                         PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | 
+                                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) };
+  int opened = 0;
 
+  for (int e=0; e<PERF_EVENTS; e++) {
 
-  //Mask generation for tunnel Q4 - 1 bit
-  int Q4_mask_bits[] = {26};
-  int Q4_strength = 1;
-  const uint32_t * mask_Q4 = generate_mask(Q4_strength, Q4_mask_bits);
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type[e];
+    attr.config = config[e];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
 
-  //Mask generation for tunnel Q9 - 3 bits
-  int Q9_mask_bits[] = {22, 23, 24};
-  int Q9_strength = 3;
-  const uint32_t * mask_Q9 = generate_mask(Q9_strength, Q9_mask_bits); 
+    perf_fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
 
-  //Mask generation for tunnel Q13 - 12 bits
-  int Q13_mask_bits[] = {2,3,5,7,10,11,12,21,22,23,28,29};
-  int Q13_strength = 12;
-  const uint32_t * mask_Q13 = generate_mask(Q13_strength, Q13_mask_bits); 
+    //Without a PMU we fall back to the task clock for the cycles
+    if ( (perf_fd[e] < 0) && (e == 0) ) {
+      attr.type = PERF_TYPE_SOFTWARE;
+      attr.config = PERF_COUNT_SW_TASK_CLOCK;
+      perf_fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      perf_task_clock = (perf_fd[e] >= 0);
+    }
 
-  //Mask generation for tunnel Q20 - 6 bits
-  int Q20_mask_bits[] = {1, 2, 10, 15, 22, 24};
-  int Q20_strength = 6;
-  const uint32_t * mask_Q20 = generate_mask(Q20_strength, Q20_mask_bits); 
+    if (perf_fd[e] < 0)
+      continue;
 
-  //Mask generation for tunnel Q10 - 3 bits
-  int Q10_mask_bits[] = {11, 25, 27};
-  int Q10_strength = 3;
-  const uint32_t * mask_Q10 = generate_mask(Q10_strength, Q10_mask_bits); 
+    perf_page[e] = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, perf_fd[e], 0);
+    if (perf_page[e] == MAP_FAILED)
+      perf_page[e] = NULL;
 
-  //Mask generation for tunnel Q14 - 9 bits
-  int Q14_mask_bits[] = {1, 2, 3, 5, 6, 7, 27, 28, 29};
-  int Q14_strength = 9;
-  const uint32_t * mask_Q14 = generate_mask(Q14_strength, Q14_mask_bits); 
+    opened++;
+  }
 
-  //Initialization vectors
-  QM3 = IV1;  QM0 = IV2;
-  QM1 = IV3;  QM2 = IV4;
+  if (opened == 0)
+    return 1;
 
+  for (int e=0; e<PERF_EVENTS; e++)
+    perf_start[e] = perf_read(e);
 
-  //Start block 1 generation. 
-  //TO-DO: add a time limit for collision search.
-  for( ; ; ) {
+  perf_stage = STAGES_NUMBER;
+  return 0;
+#else
+  return 1;
+#endif
+}
 
-    // Q[1]  = .... .... .... .... .... .... .... .... 
-    // RNG   = **** **** **** **** **** **** **** ****  0xffffffff
-    // 0     = .... .... .... .... .... .... .... ....  0x00000000
-    // 1     = .... .... .... .... .... .... .... ....  0x00000000
-    Q[1]  = rng();
 
-    // Q[2] will be generated from x[1] using Q[14..17]
+//Closes the event counters of the calling thread
+void perf_close() {
 
-    // Q[3]  = .... .... .vvv 0vvv vvvv 0vvv v0.. .... 
-    // RNG   = **** **** **** .*** **** .*** *.** ****  0xfff7f7bf
-    // 0     = .... .... .... *... .... *... .*.. ....  0x00080840   
-    // 1     = .... .... .... .... .... .... .... ....  0x00000000
-    Q[3]  = rng() & 0xfff7f7bf;
+#ifdef __linux__
+  for (int e=0; e<PERF_EVENTS; e++) {
+    if (perf_page[e] != NULL)
+      munmap(perf_page[e], sysconf(_SC_PAGESIZE));
+    if (perf_fd[e] >= 0)
+      close(perf_fd[e]);
+    perf_page[e] = NULL;
+    perf_fd[e] = -1;
+  }
+#endif
 
-    // Q[4]  = 1... .... 0^^^ 1^^^ ^^^^ 1^^^ ^011 .... 
-    // RNG   = .*** **** .... .... .... .... .... ****  0x7f00000f
-    // 0     = .... .... *... .... .... .... .*.. ....  0x00800040
-    // 1     = *... .... .... *... .... *... ..** ....  0x80080830
-    // Q[3]  = .... .... .*** .*** **** .*** *... ....  0x0077f780
-    Q[4]  = (rng() & 0x7f00000f) + 0x80080830 + (Q[3] & 0x0077f780);
+  perf_stage = -1;
+}
 
-    // I set bit 2 and 4 to zero, not necessary for Q14 tunnel
-    // Q[5]  = 1000 100v 0100 0000 0000 0000 0010 0101 
-    // RNG   = .... ...* .... .... .... .... .... ....  0x01000000
-    // 0     = .*** .**. *.** **** **** **** **.* *.*.  0x76bfffda
-    // 1     = *... *... .*.. .... .... .... ..*. .*.*  0x88400025
-    Q[5]  = (rng() & 0x01000000) + 0x88400025;
 
-    // I set bit 2 and 4 to zero, not necessary for Q14 tunnel
-    // Q[6]  = 0000 001^ 0111 1111 1011 1100 0100 0001 
-    // RNG   = .... .... .... .... .... .... .... ....  0x00000000
-    // 0     = **** **.. *... .... .*.. ..** *.** ***.  0xfc8043be
-    // 1     = .... ..*. .*** **** *.** **.. .*.. ...*  0x027fbc41
-    // Q[5]  = .... ...* .... .... .... .... .... ....  0x01000000
-    Q[6]  = 0x027fbc41 + (Q[ 5] & 0x01000000);
+//Adds the events counted since the last switch to the running level, and makes s the running level
+void perf_switch(int s) {
 
-    // Q[7]  = 0000 0011 1111 1110 1111 1000 0010 0000 
-    // RNG   = .... .... .... .... .... .... .... ....  0x00000000
-    // 0     = **** **.. .... ...* .... .*** **.* ****  0xfc0107df
-    // 1     = .... ..** **** ***. **** *... ..*. ....  0x03fef820
-    Q[7]  = 0x03fef820;
+  uint64_t count;
 
-    // Q[8]  = 0000 0001 1..1 0001 0.0v 0101 0100 0000 
-    // RNG   = .... .... .**. .... .*.* .... .... ....  0x00605000
-    // 0     = **** ***. .... ***. *.*. *.*. *.** ****  0xfe0eaabf
-    // 1     = .... ...* *..* ...* .... .*.* .*.. ....  0x01910540
-    Q[8]  = (rng() & 0x00605000) + 0x01910540;
+  for (int e=0; e<PERF_EVENTS; e++) {
+    if (perf_fd[e] < 0)
+      continue;
+    count = perf_read(e);
+    stats.perf_count[perf_stage][e] += count - perf_start[e];
+    perf_start[e] = count;
+  }
 
-    // Q[9]  = 1111 1011 ...1 0000 0.1^ 1111 0011 1101 
-    // RNG   = .... .... ***. .... .*.. .... .... ....  0x00e04000
-    // 0     = .... .*.. .... **** *... .... **.. ..*.  0x040f80c2
-    // 1     = **** *.** ...* .... ..*. **** ..** **.*  0xfb102f3d
-    // Q[8]  = .... .... .... .... ...* .... .... ....  0x00001000
-    Q[9]  = (rng() & 0x00e04000) + 0xfb102f3d + (Q[ 8] & 0x00001000);
+  perf_stage = s;
+}
 
-    // Q[10] = 0111 .... 0001 1111 1v01 ...0 01.. ..00 
-    // RNG   = .... **** .... .... .*.. ***. ..** **..  0x0f004e3c
-    // 0     = *... .... ***. .... ..*. ...* *... ..**  0x80e02183
-    // 1     = .*** .... ...* **** *..* .... .*.. ....  0x701f9040
-    Q[10] = (rng() & 0x0f004e3c) + 0x701f9040;
 
-    // Q[11] = 0010 .0v0 111. 0001 1^00 .0.0 11.. ..10 
-    // RNG   = .... *.*. ...* .... .... *.*. ..** **..  0x0a100a3c
-    // 0     = **.* .*.* .... ***. ..** .*.* .... ...*  0xd50e3501   
-    // 1     = ..*. .... ***. ...* *... .... **.. ..*.  0x20e180c2
-    // Q[10] = .... .... .... .... .*.. .... .... ....  0x00004000
-    Q[11] = (rng() & 0x0a100a3c) + 0x20e180c2 + (Q[10] & 0x00004000);
+//Prints the events counted in every level, with instructions per cycle and branch misses per 1000 instructions
+void print_perf_stages(const search_stats * t) {
 
-    // Q[12] = 000. ..^^ .... 1000 0001 ...1 0... .... 
-    // RNG   = ...* **.. **** .... .... ***. .*** ****  0x1cf00e7f
-    // 0     = ***. .... .... .*** ***. .... *... ....  0xe007e080
-    // 1     = .... .... .... *... ...* ...* .... ....  0x00081100
-    // Q[11] = .... ..** .... .... .... .... .... ....  0x03000000
-    Q[12] = (rng() & 0x1cf00e7f) + 0x00081100 + (Q[11] & 0x03000000);
+  uint64_t total = 0;
 
-    // Q[13] = 01.. ..01 .... 1111 111. ...0 0... 1... 
-    // RNG   = ..** **.. **** .... ...* ***. .*** .***  0x3cf01e77
-    // 0     = *... ..*. .... .... .... ...* *... ....  0x82000180
-    // 1     = .*.. ...* .... **** ***. .... .... *...  0x410fe008
-    Q[13] = (rng() & 0x3cf01e77) + 0x410fe008;
+  for (int s = 0; s < STAGES_NUMBER; s++)
+    total += t->perf_count[s][0];
 
-    // Q[14] = 000. ..00 .... 1011 111. ...1 1... 1... 
-    // RNG   = ...* **.. **** .... ...* ***. .*** .***  0x1cf01e77
-    // 0     = ***. ..** .... .*.. .... .... .... ....  0xe3040000
-    // 1     = .... .... .... *.** ***. ...* *... *...  0x000be188
-    Q[14] = (rng() & 0x1cf01e77) + 0x000be188;
+  printf("\n%-18s %15s %7s %15s %7s %14s %8s %14s\n", "Level", perf_task_clock ? "task-clock ns" : "cycles", "share", 
+         "instructions", "IPC", "branch-misses", "MPKI", "L1D-misses");
 
-    // Q[15] = v110 0001 ..V. .... 10.. .... .000 0000 
-    // RNG   = *... .... **** **** ..** **** *... ....  0x80ff3f80
-    // 0     = ...* ***. .... .... .*.. .... .*** ****  0x1e00407f
-    // 1     = .**. ...* .... .... *... .... .... ....  0x61008000
-    Q[15] = (rng() & 0x80ff3f80) + 0x61008000;
+  for (int s = 0; s < STAGES_NUMBER; s++) {
 
-    // Q[16] = ^010 00.. ..A. .... v... .... .000 v000 
-    // RNG   = .... ..** **.* **** **** **** *... *...  0x03dfff88
-    // 0     = .*.* **.. .... .... .... .... .*** .***  0x5c000077
-    // 1     = ..*. .... .... .... .... .... .... ....  0x20000000
-    // Q[15] = *... .... .... .... .... .... .... ....  0x80000000
-    // ~Q[15]= .... .... ..*. .... .... .... .... ....  0x00200000
-    Q[16] = (rng() & 0x03dfff88) + 0x20000000 + (Q[15] & 0x80000000) + ((~Q[15]) & 0x00200000);
+    const uint64_t * c = t->perf_count[s];
 
-    // Q[17] = ^1v. .... .... ..0. ^... .... .... ^... 
-    // RNG   = ..** **** **** **.* .*** **** **** .***  0x3ffd7ff7
-    // 0     = .... .... .... ..*. .... .... .... ....  0x00020000
-    // 1     = .*.. .... .... .... .... .... .... ....  0x40000000
-    // Q[16] = *... .... .... .... *... .... .... *...  0x80008008
-    Q[17] = (rng() & 0x3ffd7ff7) + 0x40000000 + (Q[16] & 0x80008008);
+    printf("%-18s %15llu %6.2f%% %15llu %7.3f %14llu %8.3f %14llu\n", stage_names[s], (unsigned long long) c[0], 
+           total ? 100.0 * c[0] / total : 0, (unsigned long long) c[1], 
+           (c[0] && !perf_task_clock) ? (double) c[1] / c[0] : 0, (unsigned long long) c[2], 
+           c[1] ? 1000.0 * c[2] / c[1] : 0, (unsigned long long) c[3]);
+  }
 
+  for (int e=0; e<PERF_EVENTS; e++)
+    if (perf_fd[e] < 0)
+      printf("%s could not be counted on this machine (0 above)\n", perf_event_names[e]);
+}
 
-    //Start message creation
-    x[ 0] = RR(Q[ 1] - QM0  ,  7) - F(QM0  , QM1  , QM2  ) - QM3   - 0xd76aa478; 
-    x[ 1] = RR(Q[17] - Q[16],  5) - G(Q[16], Q[15], Q[14]) - Q[13] - 0xf61e2562;
-    x[ 4] = RR(Q[ 5] - Q[ 4],  7) - F(Q[ 4], Q[ 3], Q[ 2]) - Q[ 1] - 0xf57c0faf;
-    x[ 5] = RR(Q[ 6] - Q[ 5], 12) - F(Q[ 5], Q[ 4], Q[ 3]) - Q[ 2] - 0x4787c62a;
-    x[ 6] = RR(Q[ 7] - Q[ 6], 17) - F(Q[ 6], Q[ 5], Q[ 4]) - Q[ 3] - 0xa8304613; 
-    x[10] = RR(Q[11] - Q[10], 17) - F(Q[10], Q[ 9], Q[ 8]) - Q[ 7] - 0xffff5bb1; 
-    x[11] = RR(Q[12] - Q[11], 22) - F(Q[11], Q[10], Q[ 9]) - Q[ 8] - 0x895cd7be; 
-    x[15] = RR(Q[16] - Q[15], 22) - F(Q[15], Q[14], Q[13]) - Q[12] - 0x49b40821; 
 
+///////////////////////////////////////////////////////////////
+///                    BLOCK FUNCTIONS                       //
+///////////////////////////////////////////////////////////////
 
-    // Q[2] = .... .... .... .... .... .... .... .... 
-    Q[ 2] = Q[ 1] + RL( F(Q[ 1],QM0  ,QM1  ) + QM2   + x[1] + 0xe8c7b756,12);
+//Block 1 - Computes Q[21..24] from Q[17..20] and x, verifying their conditions. Returns 0 as soon as one fails.
+//The checks are counted in level s.
+static inline __attribute__((always_inline)) int Block1_Q21_Q24(uint32_t * Q, const uint32_t * x, const int s) {
 
-    // Q[18] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    Q[18] = Q[17] + RL( G(Q[17],Q[16],Q[15]) + Q[14] + x[6] + 0xc040b340, 9);
+  uint32_t sigma_Q23;
 
-    // Q[17] = ^1v. .... .... ..0. ^... .... .... ^... 
-    // Q[18] = ^.^. .... .... ..1. .... .... .... .... 
-    //         1010 0000 0000 0010 0000 0000 0000 0000  0xa0020000
-    if ( ((Q[18] ^ Q[17]) & 0xa0020000) != 0x00020000 ) 
-      continue;
+  (void)s;    //Only used when COUNT_CONDITIONS is on
 
-    // Q[19] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // Extra conditions: Σ19,4 ~ Σ19,18 not all 1
-    // 0x0003fff8 = 0000 0000 0000 0011 1111 1111 1111 1000
-    sigma_Q19 = G(Q[18],Q[17],Q[16]) + Q[15] + x[11] + 0x265e5a51;
-    if ( (sigma_Q19 & 0x0003fff8) == 0x0003fff8 ) 
-      continue;
+  // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  Q[21] = Q[20] + RL(G(Q[20],Q[19],Q[18]) + Q[17] + x[5] + 0xd62f105d, 5);
 
-    Q[19] = Q[18] + RL(sigma_Q19, 14);
+  // Q[20] = ^... .... .... ..v. .... .... .... ....
+  // Q[21] = ^... .... .... ..^. .... .... .... ....
+  //         1000 0000 0000 0010 0000 0000 0000 0000  0x80020000
+  if ( CHECK(s, COND_Q(21), ((Q[21] ^ Q[20]) & 0x80020000) != 0) )
+    return 0;
 
-    // Q[18] = ^.^. .... .... ..1. .... .... .... .... 
-    // Q[19] = ^... .... .... ..0. .... .... .... .... 
-    //         1000 0000 0000 0010 0000 0000 0000 0000  0x80020000 
-    if ( ((Q[19] ^ Q[18]) & 0x80020000) != 0x00020000 ) 
-      continue;
+  // Q[22] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  Q[22] = Q[21] + RL(G(Q[21],Q[20],Q[19]) + Q[18] + x[10] + 0x2441453, 9);
 
-    // Q[20] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // Extra conditions: Σ20,30 ~ Σ20,32 not all 0
-    // 0xe0000000 = 1110 0000 0000 0000 0000 0000 0000 0000
-    sigma_Q20 = G(Q[19],Q[18],Q[17]) + Q[16] + x[0] + 0xe9b6c7aa;
-    if ( (sigma_Q20  & 0xe0000000) == 0 ) 
-      continue;
+  // Q[22] = ^... .... .... .... .... .... .... ....
+  if ( CHECK(s, COND_Q(22), bit(Q[22],32) != bit(Q[15],32)) )
+    return 0;
 
-    Q[20] = Q[19] + RL(sigma_Q20, 20);
+  // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Extra conditions: Σ23,18 = 0
+  sigma_Q23 = G(Q[22],Q[21],Q[20]) + Q[19] + x[15] + 0xd8a1e681;
+  if ( CHECK(s, COND_SIGMA(23), bit(sigma_Q23,18) != 0) )
+    return 0;
 
-    // Q[20] = ^... .... .... ..v. .... .... .... .... 
-    if ( bit(Q[20],32) != bit(Q[15],32) ) 
-      continue;
+  Q[23] = Q[22] + RL(sigma_Q23, 14);
 
-    // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    Q[21] = Q[20] + RL(G(Q[20],Q[19],Q[18]) + Q[17] + x[5] + 0xd62f105d, 5);   
+  // Q[23] = 0... .... .... .... .... .... .... ....
+  if ( CHECK(s, COND_Q(23), bit(Q[23],32) != 0) )
+    return 0;
 
-    // Q[20] = ^... .... .... ..v. .... .... .... .... 
-    // Q[21] = ^... .... .... ..^. .... .... .... ....
-    //         1000 0000 0000 0010 0000 0000 0000 0000  0x80020000 
-    if ( ((Q[21] ^ Q[20]) & 0x80020000) != 0 ) 
-      continue;
+  // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  Q[24] = Q[23] + RL(G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
 
-    // Q[22] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    Q[22] = Q[21] + RL(G(Q[21],Q[20],Q[19]) + Q[18] + x[10] + 0x2441453, 9);
+  // Q[24] = 1... .... .... .... .... .... .... ....
+  if ( CHECK(s, COND_Q(24), bit(Q[24],32) != 1) )
+    return 0;
 
-    // Q[22] = ^... .... .... .... .... .... .... ....
-    if ( bit(Q[22],32) != bit(Q[15],32) ) 
-      continue;
+  return 1;
+}
 
-    // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // Extra conditions: Σ23,18 = 0
-    sigma_Q23 = G(Q[22],Q[21],Q[20]) + Q[19] + x[15] + 0xd8a1e681;
-    if ( bit(sigma_Q23,18) != 0 ) 
-      continue;
 
-    Q[23] = Q[22] + RL(sigma_Q23, 14);
+//Block 1 - Computes Q[25..64] from Q[21..24] and x, verifying their conditions. Returns 0 as soon as one fails.
+static inline __attribute__((always_inline)) int Block1_tail(uint32_t * Q, const uint32_t * x) {
 
-    // Q[23] = 0... .... .... .... .... .... .... ....
-    if ( bit(Q[23],32) != 0 ) 
-      continue;
+  uint32_t sigma_Q35, sigma_Q62;
 
-    // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    Q[24] = Q[23] + RL(G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+  Q[25] = Q[24] + RL(G(Q[24], Q[23], Q[22]) + Q[21] + x[ 9] + 0x21e1cde6,  5);
+  Q[26] = Q[25] + RL(G(Q[25], Q[24], Q[23]) + Q[22] + x[14] + 0xc33707d6,  9);
+  Q[27] = Q[26] + RL(G(Q[26], Q[25], Q[24]) + Q[23] + x[ 3] + 0xf4d50d87, 14);
+  Q[28] = Q[27] + RL(G(Q[27], Q[26], Q[25]) + Q[24] + x[ 8] + 0x455a14ed, 20);
+  Q[29] = Q[28] + RL(G(Q[28], Q[27], Q[26]) + Q[25] + x[13] + 0xa9e3e905,  5);
+  Q[30] = Q[29] + RL(G(Q[29], Q[28], Q[27]) + Q[26] + x[ 2] + 0xfcefa3f8,  9);
+  Q[31] = Q[30] + RL(G(Q[30], Q[29], Q[28]) + Q[27] + x[ 7] + 0x676f02d9, 14);
+  Q[32] = Q[31] + RL(G(Q[31], Q[30], Q[29]) + Q[28] + x[12] + 0x8d2a4c8a, 20);
+  Q[33] = Q[32] + RL(H(Q[32], Q[31], Q[30]) + Q[29] + x[ 5] + 0xfffa3942,  4);
+  Q[34] = Q[33] + RL(H(Q[33], Q[32], Q[31]) + Q[30] + x[ 8] + 0x8771f681, 11);
 
-    // Q[24] = 1... .... .... .... .... .... .... ....
-    if ( bit(Q[24],32) != 1) 
-      continue;
+  // Extra conditions: Σ35,16 = 0
+  sigma_Q35 = H(Q[34],Q[33],Q[32]) + Q[31] + x[11] + 0x6d9d6122;
+  if ( CHECK(ST_B1_Q9, COND_SIGMA(35), bit(sigma_Q35,16) != 0) )
+    return 0;
 
-    //Every bit condition in Q[1]..Q[24] is now satisfied. We proceed with tunnelling.
+  Q[35] = Q[34] + RL(sigma_Q35, 16);
+
+  Q[36] = Q[35] + RL(H(Q[35], Q[34], Q[33]) + Q[32] + x[14] + 0xfde5380c, 23);
+  Q[37] = Q[36] + RL(H(Q[36], Q[35], Q[34]) + Q[33] + x[ 1] + 0xa4beea44,  4);
+  Q[38] = Q[37] + RL(H(Q[37], Q[36], Q[35]) + Q[34] + x[ 4] + 0x4bdecfa9, 11);
+  Q[39] = Q[38] + RL(H(Q[38], Q[37], Q[36]) + Q[35] + x[ 7] + 0xf6bb4b60, 16);
+  Q[40] = Q[39] + RL(H(Q[39], Q[38], Q[37]) + Q[36] + x[10] + 0xbebfbc70, 23);
+  Q[41] = Q[40] + RL(H(Q[40], Q[39], Q[38]) + Q[37] + x[13] + 0x289b7ec6,  4);
+  Q[42] = Q[41] + RL(H(Q[41], Q[40], Q[39]) + Q[38] + x[ 0] + 0xeaa127fa, 11);
+  Q[43] = Q[42] + RL(H(Q[42], Q[41], Q[40]) + Q[39] + x[ 3] + 0xd4ef3085, 16);
+  Q[44] = Q[43] + RL(H(Q[43], Q[42], Q[41]) + Q[40] + x[ 6] + 0x04881d05, 23);
+  Q[45] = Q[44] + RL(H(Q[44], Q[43], Q[42]) + Q[41] + x[ 9] + 0xd9d4d039,  4);
+  Q[46] = Q[45] + RL(H(Q[45], Q[44], Q[43]) + Q[42] + x[12] + 0xe6db99e5, 11);
+  Q[47] = Q[46] + RL(H(Q[46], Q[45], Q[44]) + Q[43] + x[15] + 0x1fa27cf8, 16);
+  Q[48] = Q[47] + RL(H(Q[47], Q[46], Q[45]) + Q[44] + x[ 2] + 0xc4ac5665, 23);
+
+  //Sufficient conditions
+  if ( CHECK(ST_B1_Q9, COND_Q(48), bit(Q[46], 32) != bit(Q[48], 32)) )
+    return 0;
 
+  RELAXED_ADD(stats.tail_q48[0], 1);
 
-    //Temporary variables to perform Multiple Messages modifications.
-    tmp_x1  = x[1];
-    tmp_x4  = x[4];
-    tmp_x15 = x[15];
+  Q[49] = Q[48] + RL(I(Q[48], Q[47], Q[46]) + Q[45] + x[ 0] + 0xf4292244,  6);
 
-    tmp_q3  = Q[3];
-    tmp_q4  = Q[4];
-    tmp_q9  = Q[9];
-    tmp_q10 = Q[10];
-    tmp_q13 = Q[13];
-    tmp_q14 = Q[14];
-    tmp_q20 = Q[20];
-    tmp_q21 = Q[21];
+  if ( CHECK(ST_B1_Q9, COND_Q(49), bit(Q[47],32) != bit(Q[49],32)) )
+    return 0;
 
-    ///////////////////////////////////////////////////////////////
-    ///                       Tunnel Q10                         //
-    ///////////////////////////////////////////////////////////////
-    //Tunnel Q10 - 3 bits - Probabilistic. Modifications on x[10] disturb probabilistically conditions for Q[22-24]
-    for (itr_Q10 = 0; itr_Q10 < (USE_B1_Q10 ? pow(2,Q10_strength) : 1); itr_Q10++ ) {
+  Q[50] = Q[49] + RL(I(Q[49], Q[48], Q[47]) + Q[46] + x[ 7] + 0x432aff97, 10);
 
-      Q[9]  = tmp_q9;
-      Q[10] = tmp_q10;  
-      Q[13] = tmp_q13;
-      Q[20] = tmp_q20;
-      Q[21] = tmp_q21;
+  if ( CHECK(ST_B1_Q9, COND_Q(50), bit(Q[50],32) != (bit(Q[48],32) ^ 1)) )
+    return 0;
 
-      x[4]  = tmp_x4;
-      x[15] = tmp_x15;
+  Q[51] = Q[50] + RL(I(Q[50], Q[49], Q[48]) + Q[47] + x[14] + 0xab9423a7, 15);
 
-      //Multi message modification - Q10 is modified according to its mask (bits 11,25,27)
-      Q[10] = tmp_q10 ^ mask_Q10[USE_B1_Q10 ? itr_Q10 : 0];
-      
-      //x[10] is modified and related states are regenerated
-      x[10] = RR(Q[11]-Q[10],17) - F(Q[10],Q[ 9],Q[ 8]) - Q[ 7] - 0xffff5bb1; 
+  if ( CHECK(ST_B1_Q9, COND_Q(51), bit(Q[51],32) != bit(Q[49],32)) )
+    return 0;
 
-      //Q10 Tunnel - Verification of bit conditions on Q[22-24]
-      
-      // Q[22] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-      Q[22] = Q[21] + RL(G(Q[21],Q[20],Q[19]) + Q[18] + x[10] + 0x2441453, 9);
+  Q[52] = Q[51] + RL(I(Q[51], Q[50], Q[49]) + Q[48] + x[ 5] + 0xfc93a039, 21);
 
-      // Q[22] = ^... .... .... .... .... .... .... ....
-      if ( bit(Q[22],32) != bit(Q[15],32) ) 
-        continue;
-      
-      // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-      // Extra conditions: Σ23,18 = 0
-      sigma_Q23 = G(Q[22],Q[21],Q[20]) + Q[19] + x[15] + 0xd8a1e681;
-      if ( bit(sigma_Q23,18) != 0 ) 
-        continue;
+  if ( CHECK(ST_B1_Q9, COND_Q(52), bit(Q[52],32) != bit(Q[50],32)) )
+    return 0;
 
-      Q[23] = Q[22] + RL(sigma_Q23, 14);
+  Q[53] = Q[52] + RL(I(Q[52], Q[51], Q[50]) + Q[49] + x[12] + 0x655b59c3, 6);
 
-      // Q[23] = 0... .... .... .... .... .... .... ....
-      if ( bit(Q[23],32) != 0 ) 
-        continue;
+  if ( CHECK(ST_B1_Q9, COND_Q(53), bit(Q[53],32) != bit(Q[51],32)) )
+    return 0;
 
-      // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-      Q[24] = Q[23] + RL(G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+  Q[54] = Q[53] + RL(I(Q[53], Q[52], Q[51]) + Q[50] + x[ 3] + 0x8f0ccc92, 10);
 
-      // Q[24] = 1... .... .... .... .... .... .... ....
-      if ( bit(Q[24],32) != 1) 
-        continue;
+  if ( CHECK(ST_B1_Q9, COND_Q(54), bit(Q[54],32) != bit(Q[52],32)) )
+    return 0;
 
-      ///////////////////////////////////////////////////////////////
-      ///                       Tunnel Q20                         //
-      ///////////////////////////////////////////////////////////////
-      //Tunnel Q20 - 6 bits - Probabilistic. Modifications on Q[20] and free choice of Q[1] and Q[2] lead to change in x[0] and x[2..5]
-      for (itr_Q20 = 0; itr_Q20 < (USE_B1_Q20 ? pow(2,Q20_strength) : 1); itr_Q20++) {
+  Q[55] = Q[54] + RL(I(Q[54], Q[53], Q[52]) + Q[51] + x[10] + 0xffeff47d, 15);
 
-        Q[3]  = tmp_q3;
-        Q[4]  = tmp_q4;
+  if ( CHECK(ST_B1_Q9, COND_Q(55), bit(Q[55],32) != bit(Q[53],32)) )
+    return 0;
 
-        x[1]  = tmp_x1;
-        x[15] = tmp_x15;
+  Q[56] = Q[55] + RL(I(Q[55], Q[54], Q[53]) + Q[52] + x[ 1] + 0x85845dd1, 21);
 
-        //Q20 is modified according to its mask (bits 1,2,10,15,22,24)
-        Q[20] = tmp_q20 ^ mask_Q20[USE_B1_Q20 ? itr_Q20 : 0];
+  if ( CHECK(ST_B1_Q9, COND_Q(56), bit(Q[56],32) != bit(Q[54],32)) )
+    return 0;
 
-        x[ 0] = RR(Q[20] - Q[19],20) - G(Q[19],Q[18],Q[17]) - Q[16] - 0xe9b6c7aa;
+  Q[57] = Q[56] + RL(I(Q[56], Q[55], Q[54]) + Q[53] + x[ 8] + 0x6fa87e4f, 6);
 
-        Q[ 1] = QM0  + RL(F( QM0, QM1, QM2) + QM3 + x[0] + 0xd76aa478,  7);
-        Q[ 2] = Q[1] + RL(F(Q[1], QM0, QM1) + QM2 + x[1] + 0xe8c7b756, 12);
+  if ( CHECK(ST_B1_Q9, COND_Q(57), bit(Q[57],32) != bit(Q[55],32)) )
+    return 0;
 
-        x[ 4] = RR(Q[5] - Q[4],  7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
-        x[ 5] = RR(Q[6] - Q[5], 12) - F(Q[5], Q[4], Q[3]) - Q[2] - 0x4787c62a;
+  Q[58] = Q[57] + RL(I(Q[57], Q[56], Q[55]) + Q[54] + x[15] + 0xfe2ce6e0, 10);
 
-        // Tunnel Q20 - Verification of bit conditions on Q[21-24]
-        // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        Q[21] = Q[20] + RL(G(Q[20],Q[19],Q[18]) + Q[17] + x[5] + 0xd62f105d, 5);   
+  if ( CHECK(ST_B1_Q9, COND_Q(58), bit(Q[58],32) != bit(Q[56],32)) )
+    return 0;
 
-        // Q[20] = ^... .... .... ..v. .... .... .... .... 
-        // Q[21] = ^... .... .... ..^. .... .... .... ....
-        //         1000 0000 0000 0010 0000 0000 0000 0000  0x80020000 
-        if ( ((Q[21] ^ Q[20]) & 0x80020000) != 0 ) 
-          continue;
+  Q[59] = Q[58] + RL(I(Q[58], Q[57], Q[56]) + Q[55] + x[ 6] + 0xa3014314, 15);
 
-        // Q[22] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        Q[22] = Q[21] + RL(G(Q[21],Q[20],Q[19]) + Q[18] + x[10] + 0x2441453, 9);
+  if ( CHECK(ST_B1_Q9, COND_Q(59), bit(Q[59],32) != bit(Q[57],32)) )
+    return 0;
 
-        // Q[22] = ^... .... .... .... .... .... .... ....
-        if ( bit(Q[22],32) != bit(Q[15],32) ) 
-          continue;
+  Q[60] = Q[59] + RL(I(Q[59], Q[58], Q[57]) + Q[56] + x[13] + 0x4e0811a1, 21);
 
-        // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        // Extra conditions: Σ23,18 = 0
-        sigma_Q23 = G(Q[22],Q[21],Q[20]) + Q[19] + x[15] + 0xd8a1e681;
-        if ( bit(sigma_Q23,18) != 0 ) 
-          continue;
+  if ( CHECK(ST_B1_Q9, COND_Q(60), bit(Q[60],26) != 0) )
+    return 0;
 
-        Q[23] = Q[22] + RL(sigma_Q23, 14);
+  if ( CHECK_ALSO(ST_B1_Q9, COND_Q(60), bit(Q[60],32) != (bit(Q[58],32) ^ 1)) )
+    return 0;
 
-        // Q[23] = 0... .... .... .... .... .... .... ....
-        if ( bit(Q[23],32) != 0 ) 
-          continue;
+  Q[61] = Q[60] + RL(I(Q[60], Q[59], Q[58]) + Q[57] + x[ 4] + 0xf7537e82,  6);
 
-        // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        Q[24] = Q[23] + RL(G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+  if ( CHECK(ST_B1_Q9, COND_Q(61), bit(Q[61],26) != 1) )
+    return 0;
 
-        // Q[24] = 1... .... .... .... .... .... .... ....
-        if ( bit(Q[24],32) != 1) 
-          continue;
+  if ( CHECK_ALSO(ST_B1_Q9, COND_Q(61), bit(Q[61],32) != bit(Q[59],32)) )
+    return 0;
 
-        ///////////////////////////////////////////////////////////////
-        ///                       Tunnel Q13                         //
-        ///////////////////////////////////////////////////////////////
-        //Tunnel Q13 - 12 bits - Probabilistic. Modifications on Q[13] and free choice of Q[2] lead to change in x[1..5] and x[15]
-        for(itr_Q13 = 0; itr_Q13 < (USE_B1_Q13 ? pow(2,Q13_strength) : 1); itr_Q13++ ) {
-          
-          Q[3]  = tmp_q3;
-          Q[4]  = tmp_q4;
-          Q[14] = tmp_q14;
+  //Extra conditions: Σ62,16 ~ Σ62,22 not all ones
+  //0x003f8000 = 0000  0000  0011  1111  1000  0000  0000  0000
+  sigma_Q62 = I(Q[61],Q[60],Q[59]) + Q[58] + x[11] + 0xbd3af235;
+  if ( CHECK(ST_B1_Q9, COND_SIGMA(62), (sigma_Q62 & 0x003f8000) == 0x003f8000) )
+    return 0;
 
-          Q[13] = tmp_q13 ^ mask_Q13[USE_B1_Q13 ? itr_Q13 : 0];
-          
-          x[ 1] = RR(Q[17] - Q[16], 5) - G(Q[16], Q[15], Q[14]) - Q[13] - 0xf61e2562;
-          
-          Q[ 2] = Q[ 1] + RL(F(Q[1 ], QM0, QM1) + QM2 + x[ 1] + 0xe8c7b756, 12);
-          
-          x[ 4] = RR(Q[ 5] - Q[ 4], 7) - F(Q[ 4], Q[ 3], Q[ 2]) - Q[ 1] - 0xf57c0faf;
-          x[ 5] = RR(Q[ 6] - Q[ 5],12) - F(Q[ 5], Q[ 4], Q[ 3]) - Q[ 2] - 0x4787c62a;
-          x[15] = RR(Q[16] - Q[15],22) - F(Q[15], Q[14], Q[13]) - Q[12] - 0x49b40821;
+  Q[62] = Q[61] + RL(sigma_Q62 , 10);
 
-          // Tunnel Q13 - Verification of bit conditions on Q[21-24]
-          // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-          Q[21] = Q[20] + RL(G(Q[20],Q[19],Q[18]) + Q[17] + x[5] + 0xd62f105d, 5);   
+  Q[63] = Q[62] + RL(I(Q[62], Q[61], Q[60]) + Q[59] + x[2] + 0x2ad7d2bb, 15);
+  Q[64] = Q[63] + RL(I(Q[63], Q[62], Q[61]) + Q[60] + x[9] + 0xeb86d391, 21);
 
-          // Q[20] = ^... .... .... ..v. .... .... .... .... 
-          // Q[21] = ^... .... .... ..^. .... .... .... ....
-          //         1000 0000 0000 0010 0000 0000 0000 0000  0x80020000 
-          if ( ((Q[21] ^ Q[20]) & 0x80020000) != 0 ) 
-            continue;
+  return 1;
+}
 
-          // Q[22] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-          Q[22] = Q[21] + RL(G(Q[21],Q[20],Q[19]) + Q[18] + x[10] + 0x2441453, 9);
 
-          // Q[22] = ^... .... .... .... .... .... .... ....
-          if ( bit(Q[22],32) != bit(Q[15],32) ) 
-            continue;
+//Block 2 - Computes Q[25..64] from Q[21..24] and x, verifying their conditions. Returns 0 as soon as one fails.
+static inline __attribute__((always_inline)) int Block2_tail(uint32_t * Q, const uint32_t * x) {
 
-          // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-          // Extra conditions: Σ23,18 = 0
-          sigma_Q23 = G(Q[22],Q[21],Q[20]) + Q[19] + x[15] + 0xd8a1e681;
-          if ( bit(sigma_Q23,18) != 0 ) 
-            continue;
+  uint32_t sigma_Q35, sigma_Q62;
 
-          Q[23] = Q[22] + RL(sigma_Q23, 14);
+  Q[25] = Q[24] + RL(G(Q[24], Q[23], Q[22]) + Q[21] + x[ 9] + 0x21e1cde6,  5);
+  Q[26] = Q[25] + RL(G(Q[25], Q[24], Q[23]) + Q[22] + x[14] + 0xc33707d6,  9);
+  Q[27] = Q[26] + RL(G(Q[26], Q[25], Q[24]) + Q[23] + x[ 3] + 0xf4d50d87, 14);
+  Q[28] = Q[27] + RL(G(Q[27], Q[26], Q[25]) + Q[24] + x[ 8] + 0x455a14ed, 20);
+  Q[29] = Q[28] + RL(G(Q[28], Q[27], Q[26]) + Q[25] + x[13] + 0xa9e3e905,  5);
+  Q[30] = Q[29] + RL(G(Q[29], Q[28], Q[27]) + Q[26] + x[ 2] + 0xfcefa3f8,  9);
+  Q[31] = Q[30] + RL(G(Q[30], Q[29], Q[28]) + Q[27] + x[ 7] + 0x676f02d9, 14);
+  Q[32] = Q[31] + RL(G(Q[31], Q[30], Q[29]) + Q[28] + x[12] + 0x8d2a4c8a, 20);
+  Q[33] = Q[32] + RL(H(Q[32], Q[31], Q[30]) + Q[29] + x[ 5] + 0xfffa3942,  4);
+  Q[34] = Q[33] + RL(H(Q[33], Q[32], Q[31]) + Q[30] + x[ 8] + 0x8771f681, 11);
 
-          // Q[23] = 0... .... .... .... .... .... .... ....
-          if ( bit(Q[23],32) != 0 ) 
-            continue;
+  // Extra conditions: Σ35,16 = 1
+  sigma_Q35 = H(Q[34],Q[33],Q[32]) + Q[31] + x[11] + 0x6d9d6122;
+  if ( CHECK(ST_B2_Q9, COND_SIGMA(35), bit(sigma_Q35,16) != 1) )
+    return 0;
 
-          // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-          Q[24] = Q[23] + RL(G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+  Q[35] = Q[34] + RL(sigma_Q35 ,16);
+
+  Q[36] = Q[35] + RL(H(Q[35], Q[34], Q[33]) + Q[32] + x[14] + 0xfde5380c, 23);
+  Q[37] = Q[36] + RL(H(Q[36], Q[35], Q[34]) + Q[33] + x[ 1] + 0xa4beea44,  4);
+  Q[38] = Q[37] + RL(H(Q[37], Q[36], Q[35]) + Q[34] + x[ 4] + 0x4bdecfa9, 11);
+  Q[39] = Q[38] + RL(H(Q[38], Q[37], Q[36]) + Q[35] + x[ 7] + 0xf6bb4b60, 16);
+  Q[40] = Q[39] + RL(H(Q[39], Q[38], Q[37]) + Q[36] + x[10] + 0xbebfbc70, 23);
+  Q[41] = Q[40] + RL(H(Q[40], Q[39], Q[38]) + Q[37] + x[13] + 0x289b7ec6,  4);
+  Q[42] = Q[41] + RL(H(Q[41], Q[40], Q[39]) + Q[38] + x[ 0] + 0xeaa127fa, 11);
+  Q[43] = Q[42] + RL(H(Q[42], Q[41], Q[40]) + Q[39] + x[ 3] + 0xd4ef3085, 16);
+  Q[44] = Q[43] + RL(H(Q[43], Q[42], Q[41]) + Q[40] + x[ 6] + 0x04881d05, 23);
+  Q[45] = Q[44] + RL(H(Q[44], Q[43], Q[42]) + Q[41] + x[ 9] + 0xd9d4d039,  4);
+  Q[46] = Q[45] + RL(H(Q[45], Q[44], Q[43]) + Q[42] + x[12] + 0xe6db99e5, 11);
+  Q[47] = Q[46] + RL(H(Q[46], Q[45], Q[44]) + Q[43] + x[15] + 0x1fa27cf8, 16);
+  Q[48] = Q[47] + RL(H(Q[47], Q[46], Q[45]) + Q[44] + x[ 2] + 0xc4ac5665, 23);
+
+  //Last sufficient conditions
+  if ( CHECK(ST_B2_Q9, COND_Q(48), bit(Q[48],32) != bit(Q[46],32)) )
+    return 0;
 
-          // Q[24] = 1... .... .... .... .... .... .... ....
-          if ( bit(Q[24],32) != 1) 
-            continue;
+  RELAXED_ADD(stats.tail_q48[1], 1);
 
-          ///////////////////////////////////////////////////////////////
-          ///                       Tunnel Q14                         //
-          ///////////////////////////////////////////////////////////////
-          //Tunnel Q14 - 9 bits - Dynamic tunnel. We will find bit positions i where we can change Q[3][i] 
-          //and/or Q[4][i] such that doesn't affect x[5] in the equation for Q[6]
-          //In particular v = F(Q[5][i],Q[4][i],Q[5][i]) has to remain unchanged.
-          //Is dynamic because, according to the value of Q[5][i] we will decide which one of the bits
-          //of Q[4][i],Q[5][i] will be changed to maintain v unchanged.
-          //If we change both bits Q[4][i],Q[5][i] v will change. Thus bit positions where
-          //we have sufficient conditions Q[3][i] = Q[4][i] are useless (we want to change them to have MMM)
+  Q[49] = Q[48] + RL(I(Q[48], Q[47], Q[46]) + Q[45] + x[0] + 0xf4292244, 6);
 
-          //Bits for Q[3]
-          // The ones that has to remain unchanged or are useless
-          // 0x77ffffda = 0111  0111  1111  1111  1111  1111  1101  1010 
-          // The ones that can be changed
-          // 0x88000025 = 1000  1000  0000  0000  0000  0000  0010  0101
+  if ( CHECK(ST_B2_Q9, COND_Q(49), bit(Q[49], 32) != bit(Q[47],32)) )
+    return 0;
 
-          //Bits for Q[4]
-          // The ones that has to remain unchanged or are useless
-          // 0x8bfffff5 = 1000  1011  1111  1111  1111  1111  1111  0101
-          // The ones that can be changed
-          // 0x7400000a = 0111  0100  0000  0000  0000  0000  0000  1010
+  Q[50] = Q[49] + RL( I(Q[49],Q[48],Q[47]) + Q[46]  + x[7] + 0x432aff97, 10);
 
-          //Bits for Q[14]
-          // The ones that has to remain unchanged or are useless. (the not-in-mask bits)
-          // 0xe3ffff88 = 1110  0011  1111  1111  1111  1111  1000  1000
-          // The ones that can be changed (mask bits)
-          // 0x7400000a = 0001  1100  0000  0000  0000  0000  0111  0111
+  if ( CHECK(ST_B2_Q9, COND_Q(50), bit(Q[50], 32) != (bit(Q[48],32) ^ 1)) )
+    return 0;
 
-          //Summarizing, bits that can be changed in Q[3]/Q[4] are the XOR
-          // 0x88000025 = 1000  1000  0000  0000  0000  0000  0010  0101
-          //    XOR
-          // 0x7400000a = 0111  0100  0000  0000  0000  0000  0000  1010
-          // -----------------------------------------------------------
-          // 0xfc00002f = 1111  1100  0000  0000  0000  0000  0010  1111
-          //              \______/                              |___\__/
-          //                (1)                                    (2)
-          //
-          //Change in bits 1,2,3,5,6,7 for Q[14] will affect bits in (1)
-          //Change in bits 27,28,29 for Q[14] will affect bits in (2)
+  Q[51] = Q[50] + RL( I(Q[50],Q[49],Q[48]) + Q[47] + x[14] + 0xab9423a7, 15);
 
-          //Unchanged bits of Q[3],Q[4],Q[14]
-          Q3_fix  = Q[ 3] & 0x77ffffda;
-          Q4_fix  = Q[ 4] & 0x8bfffff5;
-          Q14_fix = Q[14] & 0xe3ffff88;
+  if ( CHECK(ST_B2_Q9, COND_Q(51), bit(Q[51], 32) != bit(Q[49],32)) )
+    return 0;
 
-          //Relation for Q[18], Q[7]:
-          // Q[18] = Q[17]+RL(G(Q[17],Q[16],Q[15])+Q[14]+x[ 6]+0xc040b340, 9);
-          // Q[ 7] = Q[ 6]+RL(F(Q[ 6],Q[ 5],Q[ 4])+Q[ 3]+x[ 6]+0xa8304613,17); 
+  Q[52] = Q[51] + RL( I(Q[51],Q[50],Q[49]) + Q[48] + x[5] + 0xfc93a039, 21);
 
-          //We eliminate x[6] from our equations. We will work on const_unmasked to compensate variations on bits
-          const_unmasked = RR(Q[7]-Q[6],17) - 0xa8304613 //= F(Q[ 6],Q[ 5],Q[ 4]) + Q[ 3] + x[ 6]
-                          -RR(Q[18]-Q[17],9) + G(Q[17],Q[16],Q[15]) + 0xc040b340 //= -Q[14] -x[ 6]
-                          -F(Q[6],Q[5],Q4_fix) - Q3_fix + Q14_fix;
+  if( CHECK(ST_B2_Q9, COND_Q(52), bit(Q[52], 32) != bit(Q[50],32)) )
+    return 0;
 
-          //So const_unmasked is the difference (F(Q[6],Q[5],Q[4]) - F(Q[6],Q[5],Q4_fix)) + (Q[3]-Q3_fix) - (Q[14]-Q14_fix)
-          
-          //From const_unmasked, that depends on the current value for Q[5], we'll get the new values for Q[3],Q[4] 
-          //(i.e. the bits that we have to change to don't affect x[5])
+  Q[53] = Q[52] + RL( I(Q[52],Q[51],Q[50]) + Q[49]  + x[12] + 0x655b59c3, 6);
 
+  if ( CHECK(ST_B2_Q9, COND_Q(53), bit(Q[53], 32) != bit(Q[51],32)) )
+    return 0;
 
-          //Tunnel Q14 starts
-          for(itr_Q14 = 0; itr_Q14 < (USE_B1_Q14 ? pow(2,Q14_strength) : 1); itr_Q14++ ) {
+  Q[54] = Q[53] + RL( I(Q[53],Q[52],Q[51]) + Q[50] + x[3] + 0x8f0ccc92, 10);
 
-            //Q14 is modified according to its mask {1, 2, 3, 5, 6, 7, 27, 28, 29}
-            //NOTE that const_unmasked consider carries. So operations are +,- and not XOR.
-            const_masked = const_unmasked + mask_Q14[USE_B1_Q14 ? itr_Q14 : 0];
-            
-            //If the current value for Q[14] affects bits in const_masked that are outside 
-            //0xfc00002f = 1111  1100  0000  0000  0000  0000  0010  1111
-            //this means that this modification cannot be compensated by Q[3]/Q[4] and then we need to continue
-            //
-            //0x03ffffd0 = 0000  0011  1111  1111  1111  1111  1101  0000
-            if ((const_masked & 0x03ffffd0) != 0)
-              continue;
+  if ( CHECK(ST_B2_Q9, COND_Q(54), bit(Q[54], 32) != bit(Q[52],32)) )
+    return 0;
 
-            //We recover the remaining bits of Q[3],Q[4] and Q[14] from the current const_masked
-            Q[ 3] = Q3_fix + (const_masked & 0x88000025);
-            Q[ 4] = Q4_fix + (const_masked & 0x7400000a);
-            Q[14] = Q14_fix + mask_Q14[itr_Q14];
+  Q[55] = Q[54] + RL( I(Q[54],Q[53],Q[52]) + Q[51] + x[10] + 0xffeff47d, 15);
 
-            x[2] = RR(Q[3] - Q[2], 17) - F(Q[2], Q[1], QM0) - QM1 - 0x242070db;
+  if ( CHECK(ST_B2_Q9, COND_Q(55), bit(Q[55], 32) != bit(Q[53],32)) )
+    return 0;
 
-            ///////////////////////////////////////////////////////////////
-            ///                       Tunnel Q4                          //
-            ///////////////////////////////////////////////////////////////
-            //Tunnel Q4 - 1 bit - Probabilistic tunnel. Modification on Q[4][26] will probably affect Q[24][32] 
-            for (itr_Q4 = 0; itr_Q4 < (USE_B1_Q4 ? pow(2,Q4_strength) : 1); itr_Q4++) {
+  Q[56] = Q[55] + RL( I(Q[55],Q[54],Q[53]) + Q[52] + x[1] + 0x85845dd1, 21);
 
-              Q[4] = Q[4] ^ mask_Q4[USE_B1_Q4 ? itr_Q4 : 0];
+  if ( CHECK(ST_B2_Q9, COND_Q(56), bit(Q[56], 32) != bit(Q[54],32)) )
+    return 0;
 
-              x[4] = RR(Q[5] - Q[4],  7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
+  Q[57] = Q[56] + RL( I(Q[56],Q[55],Q[54]) + Q[53] + x[8] + 0x6fa87e4f, 6);
 
-              // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-              Q[24] = Q[23] + RL( G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
-                
-              // Q[24] = 1... .... .... .... .... .... .... ....
-              if (bit(Q[24],32) != 1) 
-                continue;
+  if ( CHECK(ST_B2_Q9, COND_Q(57), bit(Q[57], 32) != bit(Q[55],32)) )
+    return 0;
 
-              x[ 3] = RR(Q[ 4] - Q[ 3], 22) - F(Q[ 3], Q[ 2], Q[ 1]) -   QM0 - 0xc1bdceee;
-              x[ 6] = RR(Q[ 7] - Q[ 6], 17) - F(Q[ 6], Q[ 5], Q[ 4]) - Q[ 3] - 0xa8304613; 
-              x[ 7] = RR(Q[ 8] - Q[ 7], 22) - F(Q[ 7], Q[ 6], Q[ 5]) - Q[ 4] - 0xfd469501;
-              x[13] = RR(Q[14] - Q[13], 12) - F(Q[13], Q[12], Q[11]) - Q[10] - 0xfd987193; 
-              x[14] = RR(Q[15] - Q[14], 17) - F(Q[14], Q[13], Q[12]) - Q[11] - 0xa679438e; 
+  Q[58] = Q[57] + RL( I(Q[57],Q[56],Q[55]) + Q[54] + x[15] + 0xfe2ce6e0, 10);
 
-     
-              ///////////////////////////////////////////////////////////////
-              ///                       Tunnel Q9                          //
-              ///////////////////////////////////////////////////////////////
-              //Tunnel Q9 - 3 bits - Deterministic tunnel. If the i-th bit of Q[10] would be zero 
-              //and the i-th bit of Q[11] would be one, an eventual change of the i-th 
-              //bit of Q[9] shouldn't affect the equations for Q[11] and Q[12].
-              for(itr_Q9 = 0; itr_Q9 < (USE_B1_Q9 ? pow(2,Q9_strength) : 1); itr_Q9++ ) {
+  if ( CHECK(ST_B2_Q9, COND_Q(58), bit(Q[58], 32) != bit(Q[56],32)) )
+    return 0;
 
-                  Q[ 9] = tmp_q9 ^ mask_Q9[USE_B1_Q9 ? itr_Q9 : 0]; 
+  Q[59] = Q[58] + RL( I(Q[58],Q[57],Q[56]) + Q[55] + x[6] + 0xa3014314, 15);
 
-                  x[ 8] = RR(Q[ 9]-Q[ 8],  7) - F(Q[ 8], Q[ 7], Q[ 6]) - Q[5] - 0x698098d8;
-                  x[ 9] = RR(Q[10]-Q[ 9], 12) - F(Q[ 9], Q[ 8], Q[ 7]) - Q[6] - 0x8b44f7af;    
-                  x[12] = RR(Q[13]-Q[12],  7) - F(Q[12], Q[11], Q[10]) - Q[9] - 0x6b901122;
-                 
-                  Q[25] = Q[24] + RL(G(Q[24], Q[23], Q[22]) + Q[21] + x[ 9] + 0x21e1cde6,  5);
-                  Q[26] = Q[25] + RL(G(Q[25], Q[24], Q[23]) + Q[22] + x[14] + 0xc33707d6,  9);            
-                  Q[27] = Q[26] + RL(G(Q[26], Q[25], Q[24]) + Q[23] + x[ 3] + 0xf4d50d87, 14);
-                  Q[28] = Q[27] + RL(G(Q[27], Q[26], Q[25]) + Q[24] + x[ 8] + 0x455a14ed, 20);
-                  Q[29] = Q[28] + RL(G(Q[28], Q[27], Q[26]) + Q[25] + x[13] + 0xa9e3e905,  5);
-                  Q[30] = Q[29] + RL(G(Q[29], Q[28], Q[27]) + Q[26] + x[ 2] + 0xfcefa3f8,  9);
-                  Q[31] = Q[30] + RL(G(Q[30], Q[29], Q[28]) + Q[27] + x[ 7] + 0x676f02d9, 14);
-                  Q[32] = Q[31] + RL(G(Q[31], Q[30], Q[29]) + Q[28] + x[12] + 0x8d2a4c8a, 20);
-                  Q[33] = Q[32] + RL(H(Q[32], Q[31], Q[30]) + Q[29] + x[ 5] + 0xfffa3942,  4);          
-                  Q[34] = Q[33] + RL(H(Q[33], Q[32], Q[31]) + Q[30] + x[ 8] + 0x8771f681, 11);
-
-                  // Extra conditions: Σ35,16 = 0
-                  sigma_Q35 = H(Q[34],Q[33],Q[32]) + Q[31] + x[11] + 0x6d9d6122;
-                  if (bit(sigma_Q35,16) != 0)
-                    continue; 
-
-                  Q[35] = Q[34] + RL(sigma_Q35, 16);
-
-                  Q[36] = Q[35] + RL(H(Q[35], Q[34], Q[33]) + Q[32] + x[14] + 0xfde5380c, 23);
-                  Q[37] = Q[36] + RL(H(Q[36], Q[35], Q[34]) + Q[33] + x[ 1] + 0xa4beea44,  4);
-                  Q[38] = Q[37] + RL(H(Q[37], Q[36], Q[35]) + Q[34] + x[ 4] + 0x4bdecfa9, 11);
-                  Q[39] = Q[38] + RL(H(Q[38], Q[37], Q[36]) + Q[35] + x[ 7] + 0xf6bb4b60, 16);
-                  Q[40] = Q[39] + RL(H(Q[39], Q[38], Q[37]) + Q[36] + x[10] + 0xbebfbc70, 23);
-                  Q[41] = Q[40] + RL(H(Q[40], Q[39], Q[38]) + Q[37] + x[13] + 0x289b7ec6,  4);
-                  Q[42] = Q[41] + RL(H(Q[41], Q[40], Q[39]) + Q[38] + x[ 0] + 0xeaa127fa, 11);
-                  Q[43] = Q[42] + RL(H(Q[42], Q[41], Q[40]) + Q[39] + x[ 3] + 0xd4ef3085, 16);
-                  Q[44] = Q[43] + RL(H(Q[43], Q[42], Q[41]) + Q[40] + x[ 6] + 0x04881d05, 23);
-                  Q[45] = Q[44] + RL(H(Q[44], Q[43], Q[42]) + Q[41] + x[ 9] + 0xd9d4d039,  4);
-                  Q[46] = Q[45] + RL(H(Q[45], Q[44], Q[43]) + Q[42] + x[12] + 0xe6db99e5, 11);
-                  Q[47] = Q[46] + RL(H(Q[46], Q[45], Q[44]) + Q[43] + x[15] + 0x1fa27cf8, 16);
-                  Q[48] = Q[47] + RL(H(Q[47], Q[46], Q[45]) + Q[44] + x[ 2] + 0xc4ac5665, 23);
-                                  
-                  //Sufficient conditions
-                  if ( bit(Q[46], 32) != bit(Q[48], 32) ) 
-                    continue; 
-
-                  Q[49] = Q[48] + RL(I(Q[48], Q[47], Q[46]) + Q[45] + x[ 0] + 0xf4292244,  6);
-                              
-                  if (bit(Q[47],32) != bit(Q[49],32)) 
-                    continue;
+  if ( CHECK(ST_B2_Q9, COND_Q(59), bit(Q[59], 32) != bit(Q[57],32)) )
+    return 0;
 
-                  Q[50] = Q[49] + RL(I(Q[49], Q[48], Q[47]) + Q[46] + x[ 7] + 0x432aff97, 10);
-              
-                  if (bit(Q[50],32) != (bit(Q[48],32) ^ 1)) 
-                    continue;
+  Q[60] = Q[59] + RL( I(Q[59],Q[58],Q[57]) + Q[56] + x[13] + 0x4e0811a1, 21);
 
-                  Q[51] = Q[50] + RL(I(Q[50], Q[49], Q[48]) + Q[47] + x[14] + 0xab9423a7, 15);
-                  
-                  if (bit(Q[51],32) != bit(Q[49],32)) 
-                    continue;  
-                  
-                  Q[52] = Q[51] + RL(I(Q[51], Q[50], Q[49]) + Q[48] + x[ 5] + 0xfc93a039, 21);
-                      
-                  if (bit(Q[52],32) != bit(Q[50],32)) 
-                    continue; 
+  if ( CHECK(ST_B2_Q9, COND_Q(60), bit(Q[60], 26) != 0) )
+    return 0;
 
-                  Q[53] = Q[52] + RL(I(Q[52], Q[51], Q[50]) + Q[49] + x[12] + 0x655b59c3, 6); 
-                                
-                  if (bit(Q[53],32) != bit(Q[51],32)) 
-                    continue; 
+  if ( CHECK_ALSO(ST_B2_Q9, COND_Q(60), bit(Q[60], 32) != (bit(Q[58],32) ^ 1)) )
+    return 0;
 
-                  Q[54] = Q[53] + RL(I(Q[53], Q[52], Q[51]) + Q[50] + x[ 3] + 0x8f0ccc92, 10);    
-                  
-                  if (bit(Q[54],32) != bit(Q[52],32)) 
-                    continue; 
+  Q[61] = Q[60] + RL( I(Q[60],Q[59],Q[58]) + Q[57] + x[4] + 0xf7537e82, 6);
 
-                  Q[55] = Q[54] + RL(I(Q[54], Q[53], Q[52]) + Q[51] + x[10] + 0xffeff47d, 15);   
-                  
-                  if (bit(Q[55],32) != bit(Q[53],32)) 
-                    continue; 
+  if ( CHECK(ST_B2_Q9, COND_Q(61), bit(Q[61], 26) != 1) )
+    return 0;
 
-                  Q[56] = Q[55] + RL(I(Q[55], Q[54], Q[53]) + Q[52] + x[ 1] + 0x85845dd1, 21);    
-                  
-                  if (bit(Q[56],32) != bit(Q[54],32)) 
-                    continue; 
+  if ( CHECK_ALSO(ST_B2_Q9, COND_Q(61), bit(Q[61], 32) != bit(Q[59],32)) )
+    return 0;
 
-                  Q[57] = Q[56] + RL(I(Q[56], Q[55], Q[54]) + Q[53] + x[ 8] + 0x6fa87e4f, 6);   
-                  
-                  if (bit(Q[57],32) != bit(Q[55],32)) 
-                    continue; 
+  // Extra conditions: Σ62,16 ~ Σ62,22 not all 0
+  // 0x003f8000 =  0000 0000 0011 1111 1000 0000 0000 0000
+  sigma_Q62 = I(Q[61],Q[60],Q[59]) + Q[58] + x[11] + 0xbd3af235;
+  if ( CHECK(ST_B2_Q9, COND_SIGMA(62), (sigma_Q62 & 0x003f8000) == 0) )
+    return 0;
 
-                  Q[58] = Q[57] + RL(I(Q[57], Q[56], Q[55]) + Q[54] + x[15] + 0xfe2ce6e0, 10);   
-                  
-                  if (bit(Q[58],32) != bit(Q[56],32)) 
-                    continue; 
+  Q[62] = Q[61] + RL(sigma_Q62 , 10);
 
-                  Q[59] = Q[58] + RL(I(Q[58], Q[57], Q[56]) + Q[55] + x[ 6] + 0xa3014314, 15);    
-                  
-                  if (bit(Q[59],32) != bit(Q[57],32)) 
-                    continue; 
+  if ( CHECK(ST_B2_Q9, COND_Q(62), bit(Q[62], 26) != 1) )
+    return 0;
 
-                  Q[60] = Q[59] + RL(I(Q[59], Q[58], Q[57]) + Q[56] + x[13] + 0x4e0811a1, 21);   
-                  
-                  if (bit(Q[60],26) != 0) 
-                    continue; 
+  if ( CHECK_ALSO(ST_B2_Q9, COND_Q(62), bit(Q[62], 32) != bit(Q[60],32)) )
+    return 0;
 
-                  if (bit(Q[60],32) != (bit(Q[58],32) ^ 1)) 
-                    continue; 
+  Q[63] = Q[62] + RL( I(Q[62],Q[61],Q[60]) + Q[59] + x[2] + 0x2ad7d2bb, 15);
 
-                  Q[61] = Q[60] + RL(I(Q[60], Q[59], Q[58]) + Q[57] + x[ 4] + 0xf7537e82,  6);   
-                  
-                  if (bit(Q[61],26) != 1) 
-                    continue; 
+  if ( CHECK(ST_B2_Q9, COND_Q(63), bit(Q[63], 26) != 1) )
+    return 0;
 
-                  if (bit(Q[61],32) != bit(Q[59],32)) 
-                    continue; 
+  if ( CHECK_ALSO(ST_B2_Q9, COND_Q(63), bit(Q[63], 32) != bit(Q[61],32)) )
+    return 0;
 
-                  //Extra conditions: Σ62,16 ~ Σ62,22 not all ones
-                  //0x003f8000 = 0000  0000  0011  1111  1000  0000  0000  0000
-                  sigma_Q62 = I(Q[61],Q[60],Q[59]) + Q[58] + x[11] + 0xbd3af235;
-                  if ( (sigma_Q62 & 0x003f8000) == 0x003f8000 )
-                    continue;
+  Q[64] = Q[63] + RL( I(Q[63],Q[62],Q[61]) + Q[60] + x[9] + 0xeb86d391, 21);
 
-                  Q[62] = Q[61] + RL(sigma_Q62 , 10); 
+  //Condition not necessary (Sasaki), try to remove
+  if ( CHECK(ST_B2_Q9, COND_Q(64), bit(Q[64], 26) != 1) )
+    return 0;
 
-                  Q[63] = Q[62] + RL(I(Q[62], Q[61], Q[60]) + Q[59] + x[2] + 0x2ad7d2bb, 15);    
-                  Q[64] = Q[63] + RL(I(Q[63], Q[62], Q[61]) + Q[60] + x[9] + 0xeb86d391, 21);    
-                    
-                  //We add the initial vector to obtain the Intermediate Hash Values of the current block
-                  AA0 = IV1 + Q[61];  BB0 = IV2 + Q[64];
-                  CC0 = IV3 + Q[63];  DD0 = IV4 + Q[62];
-                  
-                  //Last sufficient conditions  
-                  if (bit(BB0,6) != 0) 
-                    continue;
+  return 1;
+}
 
-                  if (bit(BB0,26) != 0) 
-                    continue;
 
-                  if (bit(BB0,27) != 0) 
-                    continue;
+//Whether the Intermediate Hash Value B, C, D of message 1 after block 1 meets the conditions the path of block 2 
+//starts from: bits 6, 26, 27 of B, 26, 27 of C and 26 of D, and the same bit 32 in B, C and D
+static inline __attribute__((always_inline)) int block1_ihv_ok(uint32_t B, uint32_t C, uint32_t D) {
 
-                  if (bit(CC0,26) != 1)
-                    continue;
+  return (bit(B,6) == 0) && (bit(B,26) == 0) && (bit(B,27) == 0) && (bit(C,26) == 1) && (bit(C,27) == 0) && 
+         (bit(D,26) == 0) && (bit(B,32) == bit(C,32)) && (bit(C,32) == bit(D,32));
+}
 
-                  if (bit(CC0,27) != 0) 
-                    continue;  
 
-                  if (bit(DD0,26) != 0 ) 
-                    continue;
+//Computes in Hx the block of message 2, that is x plus 2^31 in x[4] and x[14] and plus d11 in x[11], and its 
+//Intermediate Hash Value AA1..DD1 from the chaining value A, B, C, D
+static inline __attribute__((always_inline)) void message2_ihv(const uint32_t * x, uint32_t d11, 
+                                                              uint32_t A, uint32_t B, uint32_t C, uint32_t D,
+                                                              uint32_t * AA1, uint32_t * BB1, uint32_t * CC1, uint32_t * DD1) {
 
-                  if (bit(BB0,32) != bit(CC0,32)) 
-                    continue;
+  for(int i = 0; i < 16; i++) 
+    Hx[i] = x[i];
 
-                  if (bit(CC0,32) != bit(DD0,32)) 
-                    continue;
+  Hx[ 4] = x[ 4] + 0x80000000;
+  Hx[11] = x[11] + d11;
+  Hx[14] = x[14] + 0x80000000;
 
-                  //Message 1 block 1 computation completed. 
-                  
-                  //Now we see if the differential path is verified
-                  //Note that message 1 block 1 is x = x[0]||...||x[15]
-                  //While message 2 block 1 is Hx = x + C
+  a = A;  b = B;
+  c = C;  d = D; 
 
-                  //Message 2 block 1 hash computation
-                  for(i = 0; i < 16; i++) 
-                    Hx[i] = x[i];
+  HMD5Tr();
+  
+  *AA1 = A + a;  *BB1 = B + b;
+  *CC1 = C + c;  *DD1 = D + d;
+}
 
-                  Hx[ 4] = x[ 4] + 0x80000000;
-                  Hx[11] = x[11] + 0x00008000;
-                  Hx[14] = x[14] + 0x80000000;
 
-                  //We set the IV, hash Hx and get the Intermediate Hash Value
-                  a = IV1;  b = IV2;
-                  c = IV3;  d = IV4; 
+//Block 1 search. use is a constant combination of TUNNEL_B1_* flags in every call, so the compiler
+//generates one kernel for each combination of tunnels (see Block1()).
+static inline __attribute__((always_inline)) int Block1_kernel(const search_context * ctx, const uint32_t use) {
 
-                  HMD5Tr();
-                  
-                  AA1 = IV1 + a;  BB1 = IV2 + b;
-                  CC1 = IV3 + c;  DD1 = IV4 + d;
-                  
-                  //We see if the Differential Path is verified,
-                  if ( ((AA1-AA0) != 0x80000000) || 
-                       ((BB1-BB0) != 0x82000000) || 
-                       ((CC1-CC0) != 0x82000000) || 
-                       ((DD1-DD0) != 0x82000000)  )
-                    continue;
-                  
-                  //We store the intermediate hash values
-                  A0=AA0; B0=BB0; C0=CC0; D0=DD0;
-                  A1=AA1; B1=BB1; C1=CC1; D1=DD1;
+  uint32_t Q[65], x[16], QM0, QM1;
+  uint32_t sigma_Q19, sigma_Q20, sigma_Q23;
+  uint32_t i, itr_Q9, itr_Q4, itr_Q14, itr_Q13, itr_Q20, itr_Q10, itr_Q17, itr_outer = 0;
+  uint32_t tmp_q3, tmp_q4, tmp_q13, tmp_q14, tmp_q20, tmp_q21, tmp_q9;
+  uint32_t tmp_x1, tmp_x15, tmp_x4;
+  uint32_t flip, delta;
+  uint32_t Q3_fix, Q4_fix, Q14_fix, const_masked, const_unmasked;
+  uint32_t adm_Q14[512], n_Q14;
+  uint32_t AA0, BB0, CC0, DD0, AA1, BB1, CC1, DD1;
 
-                  //We store both first blocks
-                  for (i=0; i<16; i++) {
-                    memcpy( &v1[4*i], &x[i],  4); 
-                    memcpy( &v2[4*i], &Hx[i], 4);
-                  }
 
-                  return 0;
+  //Bits for tunnel Q4 - 1 bit
+  static const int32_t Q4_mask_bits[] = {26};
+  const uint32_t Q4_strength = 1;
 
-                } //End of Q9 Tunnel
-              } //End of Q4 Tunnel
-            } //End of Q14 Tunnel
-          } //End of Q13 Tunnel
-        } //End of Q20 Tunnel
-      } //End of Q10 Tunnel
-    } //End of general for
-  return(-1); //Collision not found;
-}
-/*=========================================================*/
+  //Bits for tunnel Q9 - 3 bits
+  static const int32_t Q9_mask_bits[] = {22, 23, 24};
+  const uint32_t Q9_strength = 3;
 
+  //Bits for tunnel Q13 - 12 bits
+  static const int32_t Q13_mask_bits[] = {2,3,5,7,10,11,12,21,22,23,28,29};
+  const uint32_t Q13_strength = 12;
 
-/*=========================================================*/
+  //Bits for tunnel Q20 - 6 bits
+  static const int32_t Q20_mask_bits[] = {1, 2, 10, 15, 22, 24};
+  const uint32_t Q20_strength = 6;
 
+  //Bits for tunnel Q10 - 3 bits
+  static const int32_t Q10_mask_bits[] = {11, 25, 27};
+  const uint32_t Q10_strength = 3;
 
+  //Mask for tunnel Q14 - 9 bits. Q14 is a dynamic tunnel and is not walked in Gray code order, so all its values
+  //are stored. The table is generated at the first call of each thread (its last value is 0 only before generation).
+  static const int32_t Q14_mask_bits[] = {1, 2, 3, 5, 6, 7, 27, 28, 29};
+  const uint32_t Q14_strength = 9;
+  static __thread uint32_t mask_Q14[1 << 9];
+  if (mask_Q14[(1 << 9) - 1] == 0)
+    generate_mask(mask_Q14, Q14_strength, Q14_mask_bits);
 
-int Block2( ) {
+  //Maximum number of Q[17] values tried for each choice of Q[3..16]
+  uint32_t Q17_tries = 256;
 
-  uint32_t Q[65], x[16];
-  uint32_t QM0, QM1, QM2, QM3;
-  uint32_t i, itr_q16, itr_q1q2, itr_q9, itr_q4, tmp_q1, tmp_q2, tmp_q4, tmp_q9;
-  uint32_t I,not_I;
-  uint32_t sigma_Q17, sigma_Q19, sigma_Q20, sigma_Q23, sigma_Q35, sigma_Q62;
-  uint32_t Q1_fix, Q2_fix, mask_Q1Q2, Q1Q2_strength;
-  uint32_t AA0, BB0, CC0, DD0, AA1, BB1, CC1, DD1;
+  //Initialization vectors (QM2, QM3 are only used in the terms of ctx)
+  QM0 = ctx->QM0;
+  QM1 = ctx->QM1;
 
-  QM3 = A0;  QM0 = B0;  QM1 = C0;   QM2 = D0;
 
-  //Mask generation for tunnel Q9 - 8 bits
-  int Q9_mask_bits[] = {3, 4, 5, 11, 19, 21, 22, 23};
-  int Q9_strength = 8;
-  const uint32_t * mask_Q9 = generate_mask(Q9_strength, Q9_mask_bits); 
+  //Start block 1 generation. 
+  for( ; ; ) {
+
+    //The search deadline is checked every 4096 draws and at every step of tunnel Q20
+    if ( ((++itr_outer & 0xfff) == 0) && search_expired() )
+      return(-1);
+
+    STAGE_ITR(ST_B1_OUTER);
+
+    // Q[1] has no conditions: it will be generated from x[0] using Q[16..20]
+
+    // Q[2] will be generated from x[1] using Q[14..17]
+
+    // Q[3]  = .... .... .vvv 0vvv vvvv 0vvv v0.. .... 
+    // RNG   = **** **** **** .*** **** .*** *.** ****  0xfff7f7bf
+    // 0     = .... .... .... *... .... *... .*.. ....  0x00080840   
+    // 1     = .... .... .... .... .... .... .... ....  0x00000000
+    Q[3]  = rng() & 0xfff7f7bf;
+
+    // Q[4]  = 1... .... 0^^^ 1^^^ ^^^^ 1^^^ ^011 .... 
+    // RNG   = .*** **** .... .... .... .... .... ****  0x7f00000f
+    // 0     = .... .... *... .... .... .... .*.. ....  0x00800040
+    // 1     = *... .... .... *... .... *... ..** ....  0x80080830
+    // Q[3]  = .... .... .*** .*** **** .*** *... ....  0x0077f780
+    Q[4]  = (rng() & 0x7f00000f) + 0x80080830 + (Q[3] & 0x0077f780);
+
+    // I set bit 2 and 4 to zero, not necessary for Q14 tunnel
+    // Q[5]  = 1000 100v 0100 0000 0000 0000 0010 0101 
+    // RNG   = .... ...* .... .... .... .... .... ....  0x01000000
+    // 0     = .*** .**. *.** **** **** **** **.* *.*.  0x76bfffda
+    // 1     = *... *... .*.. .... .... .... ..*. .*.*  0x88400025
+    Q[5]  = (rng() & 0x01000000) + 0x88400025;
+
+    // I set bit 2 and 4 to zero, not necessary for Q14 tunnel
+    // Q[6]  = 0000 001^ 0111 1111 1011 1100 0100 0001 
+    // RNG   = .... .... .... .... .... .... .... ....  0x00000000
+    // 0     = **** **.. *... .... .*.. ..** *.** ***.  0xfc8043be
+    // 1     = .... ..*. .*** **** *.** **.. .*.. ...*  0x027fbc41
+    // Q[5]  = .... ...* .... .... .... .... .... ....  0x01000000
+    Q[6]  = 0x027fbc41 + (Q[ 5] & 0x01000000);
+
+    // Q[7]  = 0000 0011 1111 1110 1111 1000 0010 0000 
+    // RNG   = .... .... .... .... .... .... .... ....  0x00000000
+    // 0     = **** **.. .... ...* .... .*** **.* ****  0xfc0107df
+    // 1     = .... ..** **** ***. **** *... ..*. ....  0x03fef820
+    Q[7]  = 0x03fef820;
+
+    // Q[8]  = 0000 0001 1..1 0001 0.0v 0101 0100 0000 
+    // RNG   = .... .... .**. .... .*.* .... .... ....  0x00605000
+    // 0     = **** ***. .... ***. *.*. *.*. *.** ****  0xfe0eaabf
+    // 1     = .... ...* *..* ...* .... .*.* .*.. ....  0x01910540
+    Q[8]  = (rng() & 0x00605000) + 0x01910540;
+
+    // Q[9]  = 1111 1011 ...1 0000 0.1^ 1111 0011 1101 
+    // RNG   = .... .... ***. .... .*.. .... .... ....  0x00e04000
+    // 0     = .... .*.. .... **** *... .... **.. ..*.  0x040f80c2
+    // 1     = **** *.** ...* .... ..*. **** ..** **.*  0xfb102f3d
+    // Q[8]  = .... .... .... .... ...* .... .... ....  0x00001000
+    Q[9]  = (rng() & 0x00e04000) + 0xfb102f3d + (Q[ 8] & 0x00001000);
+
+    // Q[10] = 0111 .... 0001 1111 1v01 ...0 01.. ..00 
+    // RNG   = .... **** .... .... .*.. ***. ..** **..  0x0f004e3c
+    // 0     = *... .... ***. .... ..*. ...* *... ..**  0x80e02183
+    // 1     = .*** .... ...* **** *..* .... .*.. ....  0x701f9040
+    Q[10] = (rng() & 0x0f004e3c) + 0x701f9040;
+
+    // Q[11] = 0010 .0v0 111. 0001 1^00 .0.0 11.. ..10 
+    // RNG   = .... *.*. ...* .... .... *.*. ..** **..  0x0a100a3c
+    // 0     = **.* .*.* .... ***. ..** .*.* .... ...*  0xd50e3501   
+    // 1     = ..*. .... ***. ...* *... .... **.. ..*.  0x20e180c2
+    // Q[10] = .... .... .... .... .*.. .... .... ....  0x00004000
+    Q[11] = (rng() & 0x0a100a3c) + 0x20e180c2 + (Q[10] & 0x00004000);
+
+    // Q[12] = 000. ..^^ .... 1000 0001 ...1 0... .... 
+    // RNG   = ...* **.. **** .... .... ***. .*** ****  0x1cf00e7f
+    // 0     = ***. .... .... .*** ***. .... *... ....  0xe007e080
+    // 1     = .... .... .... *... ...* ...* .... ....  0x00081100
+    // Q[11] = .... ..** .... .... .... .... .... ....  0x03000000
+    Q[12] = (rng() & 0x1cf00e7f) + 0x00081100 + (Q[11] & 0x03000000);
+
+    // Q[13] = 01.. ..01 .... 1111 111. ...0 0... 1... 
+    // RNG   = ..** **.. **** .... ...* ***. .*** .***  0x3cf01e77
+    // 0     = *... ..*. .... .... .... ...* *... ....  0x82000180
+    // 1     = .*.. ...* .... **** ***. .... .... *...  0x410fe008
+    Q[13] = (rng() & 0x3cf01e77) + 0x410fe008;
+
+    // Q[14] = 000. ..00 .... 1011 111. ...1 1... 1... 
+    // RNG   = ...* **.. **** .... ...* ***. .*** .***  0x1cf01e77
+    // 0     = ***. ..** .... .*.. .... .... .... ....  0xe3040000
+    // 1     = .... .... .... *.** ***. ...* *... *...  0x000be188
+    Q[14] = (rng() & 0x1cf01e77) + 0x000be188;
+
+    // Q[15] = v110 0001 ..V. .... 10.. .... .000 0000 
+    // RNG   = *... .... **** **** ..** **** *... ....  0x80ff3f80
+    // 0     = ...* ***. .... .... .*.. .... .*** ****  0x1e00407f
+    // 1     = .**. ...* .... .... *... .... .... ....  0x61008000
+    Q[15] = (rng() & 0x80ff3f80) + 0x61008000;
+
+    // Q[16] = ^010 00.. ..A. .... v... .... .000 v000 
+    // RNG   = .... ..** **.* **** **** **** *... *...  0x03dfff88
+    // 0     = .*.* **.. .... .... .... .... .*** .***  0x5c000077
+    // 1     = ..*. .... .... .... .... .... .... ....  0x20000000
+    // Q[15] = *... .... .... .... .... .... .... ....  0x80000000
+    // ~Q[15]= .... .... ..*. .... .... .... .... ....  0x00200000
+    Q[16] = (rng() & 0x03dfff88) + 0x20000000 + (Q[15] & 0x80000000) + ((~Q[15]) & 0x00200000);
+
+    //Start message creation
+    x[ 6] = RR(Q[ 7] - Q[ 6], 17) - F(Q[ 6], Q[ 5], Q[ 4]) - Q[ 3] - 0xa8304613; 
+    x[10] = RR(Q[11] - Q[10], 17) - F(Q[10], Q[ 9], Q[ 8]) - Q[ 7] - 0xffff5bb1; 
+    x[11] = RR(Q[12] - Q[11], 22) - F(Q[11], Q[10], Q[ 9]) - Q[ 8] - 0x895cd7be; 
+    x[15] = RR(Q[16] - Q[15], 22) - F(Q[15], Q[14], Q[13]) - Q[12] - 0x49b40821; 
+
+    //x[11] doesn't change in the tunnels
+    if (CHECK_X(ST_B1_OUTER, 1, 11))
+      continue;
+
+    //Q[17] only changes x[1], that is used for Q[2] and not for Q[3..16]. When conditions on Q[18] and Q[19] 
+    //fail we draw a new Q[17], without generating again Q[3..16].
+    for (itr_Q17 = 0; itr_Q17 < Q17_tries; itr_Q17++) {
+
+      // Q[17] = ^1v. .... .... ..0. ^... .... .... ^... 
+      // RNG   = ..** **** **** **.* .*** **** **** .***  0x3ffd7ff7
+      // 0     = .... .... .... ..*. .... .... .... ....  0x00020000
+      // 1     = .*.. .... .... .... .... .... .... ....  0x40000000
+      // Q[16] = *... .... .... .... *... .... .... *...  0x80008008
+      Q[17] = (rng() & 0x3ffd7ff7) + 0x40000000 + (Q[16] & 0x80008008);
+
+      // Q[18] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      Q[18] = Q[17] + RL( G(Q[17],Q[16],Q[15]) + Q[14] + x[6] + 0xc040b340, 9);
+
+      // Q[17] = ^1v. .... .... ..0. ^... .... .... ^... 
+      // Q[18] = ^.^. .... .... ..1. .... .... .... .... 
+      //         1010 0000 0000 0010 0000 0000 0000 0000  0xa0020000
+      if ( CHECK(ST_B1_OUTER, COND_Q(18), ((Q[18] ^ Q[17]) & 0xa0020000) != 0x00020000) ) 
+        continue;
+
+      // Q[19] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // Extra conditions: Σ19,4 ~ Σ19,18 not all 1
+      // 0x0003fff8 = 0000 0000 0000 0011 1111 1111 1111 1000
+      sigma_Q19 = G(Q[18],Q[17],Q[16]) + Q[15] + x[11] + 0x265e5a51;
+      if ( CHECK(ST_B1_OUTER, COND_SIGMA(19), (sigma_Q19 & 0x0003fff8) == 0x0003fff8) ) 
+        continue;
+
+      Q[19] = Q[18] + RL(sigma_Q19, 14);
+
+      // Q[18] = ^.^. .... .... ..1. .... .... .... .... 
+      // Q[19] = ^... .... .... ..0. .... .... .... .... 
+      //         1000 0000 0000 0010 0000 0000 0000 0000  0x80020000 
+      if ( CHECK(ST_B1_OUTER, COND_Q(19), ((Q[19] ^ Q[18]) & 0x80020000) != 0x00020000) ) 
+        continue;
+
+      break;
+    }
+
+    if (itr_Q17 == Q17_tries)
+      continue;
+
+    // Q[20] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    //Q[20] is chosen satisfying its conditions and x[0] is computed from it. As Q[1] is free,
+    //we get Q[1] from x[0]: conditions on Q[20] hold by construction.
+    // Q[20] = ^... .... .... ..v. .... .... .... .... 
+    // RNG   = .*** **** **** **** **** **** **** ****  0x7fffffff
+    // Q[15] = *... .... .... .... .... .... .... ....  0x80000000
+    //
+    // Extra conditions: Σ20,30 ~ Σ20,32 not all 0
+    // 0xe0000000 = 1110 0000 0000 0000 0000 0000 0000 0000
+    do {
+      Q[20] = (rng() & 0x7fffffff) + (Q[15] & 0x80000000);
+      sigma_Q20 = RR(Q[20] - Q[19], 20);
+    } while ( CHECK(ST_B1_OUTER, COND_SIGMA(20), (sigma_Q20  & 0xe0000000) == 0) );
+
+    x[ 0] = sigma_Q20 - G(Q[19],Q[18],Q[17]) - Q[16] - 0xe9b6c7aa;
+    x[ 1] = RR(Q[17] - Q[16],  5) - G(Q[16], Q[15], Q[14]) - Q[13] - 0xf61e2562;
+
+    // Q[1] = .... .... .... .... .... .... .... .... 
+    Q[ 1] = QM0   + RL( ctx->step1 + x[0], 7);
+
+    // Q[2] = .... .... .... .... .... .... .... .... 
+    Q[ 2] = Q[ 1] + RL( F(Q[ 1],QM0  ,QM1  ) + ctx->step2 + x[1], 12);
+
+    x[ 4] = RR(Q[ 5] - Q[ 4],  7) - F(Q[ 4], Q[ 3], Q[ 2]) - Q[ 1] - 0xf57c0faf;
+    x[ 5] = RR(Q[ 6] - Q[ 5], 12) - F(Q[ 5], Q[ 4], Q[ 3]) - Q[ 2] - 0x4787c62a;
+
+    if (!Block1_Q21_Q24(Q, x, ST_B1_OUTER))
+      continue;
+
+    //Every bit condition in Q[1]..Q[24] is now satisfied. We proceed with tunnelling.
+    STAGE_PASS(ST_B1_OUTER);
+    PROBE(outer_draw_accept, 1, itr_outer);
+
+
+    //Temporary variables to perform Multiple Messages modifications.
+    tmp_x1  = x[1];
+    tmp_x4  = x[4];
+    tmp_x15 = x[15];
+
+    tmp_q3  = Q[3];
+    tmp_q4  = Q[4];
+    tmp_q9  = Q[9];
+    tmp_q13 = Q[13];
+    tmp_q14 = Q[14];
+    tmp_q20 = Q[20];
+    tmp_q21 = Q[21];
+
+    ///////////////////////////////////////////////////////////////
+    ///                       Tunnel Q10                         //
+    ///////////////////////////////////////////////////////////////
+    //Tunnel Q10 - 3 bits - Probabilistic. Modifications on x[10] disturb probabilistically conditions for Q[22-24]
+    PROBE(level_enter, ST_B1_Q10, stats.stage_itr[ST_B1_Q10]);
+    for (itr_Q10 = 0; itr_Q10 < ((use & TUNNEL_B1_Q10) ? 1u << Q10_strength : 1); itr_Q10++ ) {
+
+      STAGE_ITR(ST_B1_Q10);
+
+      Q[9]  = tmp_q9;
+      Q[13] = tmp_q13;
+      Q[20] = tmp_q20;
+      Q[21] = tmp_q21;
+
+      x[4]  = tmp_x4;
+      x[15] = tmp_x15;
+
+      //Multi message modification - Q10 is modified according to its mask (bits 11,25,27)
+      if (itr_Q10)
+        Q[10] ^= GRAY_BIT(itr_Q10, Q10_mask_bits);
+      
+      //x[10] is modified and related states are regenerated
+      x[10] = RR(Q[11]-Q[10],17) - F(Q[10],Q[ 9],Q[ 8]) - Q[ 7] - 0xffff5bb1; 
+
+      if (CHECK_X(ST_B1_Q10, 1, 10))
+        continue;
+
+      //Q10 Tunnel - Verification of bit conditions on Q[22-24]
+      
+      // Q[22] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      Q[22] = Q[21] + RL(G(Q[21],Q[20],Q[19]) + Q[18] + x[10] + 0x2441453, 9);
+
+      // Q[22] = ^... .... .... .... .... .... .... ....
+      if ( CHECK(ST_B1_Q10, COND_Q(22), bit(Q[22],32) != bit(Q[15],32)) ) 
+        continue;
+      
+      // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // Extra conditions: Σ23,18 = 0
+      sigma_Q23 = G(Q[22],Q[21],Q[20]) + Q[19] + x[15] + 0xd8a1e681;
+      if ( CHECK(ST_B1_Q10, COND_SIGMA(23), bit(sigma_Q23,18) != 0) ) 
+        continue;
+
+      Q[23] = Q[22] + RL(sigma_Q23, 14);
+
+      // Q[23] = 0... .... .... .... .... .... .... ....
+      if ( CHECK(ST_B1_Q10, COND_Q(23), bit(Q[23],32) != 0) ) 
+        continue;
+
+      // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      Q[24] = Q[23] + RL(G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+
+      // Q[24] = 1... .... .... .... .... .... .... ....
+      if ( CHECK(ST_B1_Q10, COND_Q(24), bit(Q[24],32) != 1) ) 
+        continue;
+
+      STAGE_PASS(ST_B1_Q10);
+
+      ///////////////////////////////////////////////////////////////
+      ///                       Tunnel Q20                         //
+      ///////////////////////////////////////////////////////////////
+      //Tunnel Q20 - 6 bits - Probabilistic. Modifications on Q[20] and free choice of Q[1] and Q[2] lead to change in x[0] and x[2..5]
+      PROBE(level_enter, ST_B1_Q20, stats.stage_itr[ST_B1_Q20]);
+      for (itr_Q20 = 0; itr_Q20 < ((use & TUNNEL_B1_Q20) ? 1u << Q20_strength : 1); itr_Q20++) {
+
+        if (search_expired())
+          return(-1);
+
+        STAGE_ITR(ST_B1_Q20);
+
+        Q[3]  = tmp_q3;
+        Q[4]  = tmp_q4;
+
+        x[1]  = tmp_x1;
+        x[15] = tmp_x15;
+
+        //Q20 is modified according to its mask (bits 1,2,10,15,22,24)
+        if (itr_Q20)
+          Q[20] ^= GRAY_BIT(itr_Q20, Q20_mask_bits);
+
+        x[ 0] = RR(Q[20] - Q[19],20) - G(Q[19],Q[18],Q[17]) - Q[16] - 0xe9b6c7aa;
+
+        if (CHECK_X(ST_B1_Q20, 1, 0))
+          continue;
+
+        Q[ 1] = QM0  + RL(ctx->step1 + x[0],  7);
+        Q[ 2] = Q[1] + RL(F(Q[1], QM0, QM1) + ctx->step2 + x[1], 12);
+
+        x[ 4] = RR(Q[5] - Q[4],  7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
+        x[ 5] = RR(Q[6] - Q[5], 12) - F(Q[5], Q[4], Q[3]) - Q[2] - 0x4787c62a;
+
+        // Tunnel Q20 - Verification of bit conditions on Q[21-24]
+        if (!Block1_Q21_Q24(Q, x, ST_B1_Q20))
+          continue;
+
+        STAGE_PASS(ST_B1_Q20);
+
+        //x[1] = tmp_x1 corresponds to Q[13] = tmp_q13
+        Q[13] = tmp_q13;
+
+        ///////////////////////////////////////////////////////////////
+        ///                       Tunnel Q13                         //
+        ///////////////////////////////////////////////////////////////
+        //Tunnel Q13 - 12 bits - Probabilistic. Modifications on Q[13] and free choice of Q[2] lead to change in x[1..5] and x[15]
+        PROBE(level_enter, ST_B1_Q13, stats.stage_itr[ST_B1_Q13]);
+        for(itr_Q13 = 0; itr_Q13 < ((use & TUNNEL_B1_Q13) ? 1u << Q13_strength : 1); itr_Q13++ ) {
+
+          STAGE_ITR(ST_B1_Q13);
+          
+          Q[3]  = tmp_q3;
+          Q[4]  = tmp_q4;
+          Q[14] = tmp_q14;
+
+          //x[1] depends linearly on Q[13]: it is updated by the difference of the flipped bit
+          if (itr_Q13) {
+            flip  = GRAY_BIT(itr_Q13, Q13_mask_bits);
+            delta = FLIP_DELTA(Q[13], flip);
+            Q[13] ^= flip;
+            x[ 1] -= delta;
+          }
+          
+          Q[ 2] = Q[ 1] + RL(F(Q[1 ], QM0, QM1) + ctx->step2 + x[ 1], 12);
+          
+          x[ 4] = RR(Q[ 5] - Q[ 4], 7) - F(Q[ 4], Q[ 3], Q[ 2]) - Q[ 1] - 0xf57c0faf;
+          x[ 5] = RR(Q[ 6] - Q[ 5],12) - F(Q[ 5], Q[ 4], Q[ 3]) - Q[ 2] - 0x4787c62a;
+          x[15] = RR(Q[16] - Q[15],22) - F(Q[15], Q[14], Q[13]) - Q[12] - 0x49b40821;
+
+          if (CHECK_X(ST_B1_Q13, 1, 1) || CHECK_X(ST_B1_Q13, 1, 5) || CHECK_X(ST_B1_Q13, 1, 15))
+            continue;
+
+          // Tunnel Q13 - Verification of bit conditions on Q[21-24]
+          if (!Block1_Q21_Q24(Q, x, ST_B1_Q13))
+            continue;
+
+          STAGE_PASS(ST_B1_Q13);
+
+          ///////////////////////////////////////////////////////////////
+          ///                       Tunnel Q14                         //
+          ///////////////////////////////////////////////////////////////
+          //Tunnel Q14 - 9 bits - Dynamic tunnel. We will find bit positions i where we can change Q[3][i] 
+          //and/or Q[4][i] such that doesn't affect x[5] in the equation for Q[6]
+          //In particular v = F(Q[5][i],Q[4][i],Q[5][i]) has to remain unchanged.
+          //Is dynamic because, according to the value of Q[5][i] we will decide which one of the bits
+          //of Q[4][i],Q[5][i] will be changed to maintain v unchanged.
+          //If we change both bits Q[4][i],Q[5][i] v will change. Thus bit positions where
+          //we have sufficient conditions Q[3][i] = Q[4][i] are useless (we want to change them to have MMM)
+
+          //Bits for Q[3]
+          // The ones that has to remain unchanged or are useless
+          // 0x77ffffda = 0111  0111  1111  1111  1111  1111  1101  1010 
+          // The ones that can be changed
+          // 0x88000025 = 1000  1000  0000  0000  0000  0000  0010  0101
+
+          //Bits for Q[4]
+          // The ones that has to remain unchanged or are useless
+          // 0x8bfffff5 = 1000  1011  1111  1111  1111  1111  1111  0101
+          // The ones that can be changed
+          // 0x7400000a = 0111  0100  0000  0000  0000  0000  0000  1010
+
+          //Bits for Q[14]
+          // The ones that has to remain unchanged or are useless. (the not-in-mask bits)
+          // 0xe3ffff88 = 1110  0011  1111  1111  1111  1111  1000  1000
+          // The ones that can be changed (mask bits)
+          // 0x7400000a = 0001  1100  0000  0000  0000  0000  0111  0111
+
+          //Summarizing, bits that can be changed in Q[3]/Q[4] are the XOR
+          // 0x88000025 = 1000  1000  0000  0000  0000  0000  0010  0101
+          //    XOR
+          // 0x7400000a = 0111  0100  0000  0000  0000  0000  0000  1010
+          // -----------------------------------------------------------
+          // 0xfc00002f = 1111  1100  0000  0000  0000  0000  0010  1111
+          //              \______/                              |___\__/
+          //                (1)                                    (2)
+          //
+          //Change in bits 1,2,3,5,6,7 for Q[14] will affect bits in (1)
+          //Change in bits 27,28,29 for Q[14] will affect bits in (2)
+
+          //Unchanged bits of Q[3],Q[4],Q[14]
+          Q3_fix  = Q[ 3] & 0x77ffffda;
+          Q4_fix  = Q[ 4] & 0x8bfffff5;
+          Q14_fix = Q[14] & 0xe3ffff88;
+
+          //Relation for Q[18], Q[7]:
+          // Q[18] = Q[17]+RL(G(Q[17],Q[16],Q[15])+Q[14]+x[ 6]+0xc040b340, 9);
+          // Q[ 7] = Q[ 6]+RL(F(Q[ 6],Q[ 5],Q[ 4])+Q[ 3]+x[ 6]+0xa8304613,17); 
+
+          //We eliminate x[6] from our equations. We will work on const_unmasked to compensate variations on bits
+          const_unmasked = RR(Q[7]-Q[6],17) - 0xa8304613 //= F(Q[ 6],Q[ 5],Q[ 4]) + Q[ 3] + x[ 6]
+                          -RR(Q[18]-Q[17],9) + G(Q[17],Q[16],Q[15]) + 0xc040b340 //= -Q[14] -x[ 6]
+                          -F(Q[6],Q[5],Q4_fix) - Q3_fix + Q14_fix;
+
+          //So const_unmasked is the difference (F(Q[6],Q[5],Q[4]) - F(Q[6],Q[5],Q4_fix)) + (Q[3]-Q3_fix) - (Q[14]-Q14_fix)
+          
+          //From const_unmasked, that depends on the current value for Q[5], we'll get the new values for Q[3],Q[4] 
+          //(i.e. the bits that we have to change to don't affect x[5])
+
+
+          //If the current value for Q[14] affects bits in const_masked that are outside 
+          //0xfc00002f = 1111  1100  0000  0000  0000  0000  0010  1111
+          //this means that this modification cannot be compensated by Q[3]/Q[4]. 
+          //
+          //0x03ffffd0 = 0000  0011  1111  1111  1111  1111  1101  0000
+          //
+          //We compute once the values of the mask where this doesn't happen, and we iterate only on them.
+          if (use & TUNNEL_B1_Q14)
+            n_Q14 = Q14_admissible(const_unmasked, mask_Q14, adm_Q14);
+          else {
+            adm_Q14[0] = 0;
+            n_Q14 = ((const_unmasked & 0x03ffffd0) == 0);
+          }
+
+          STAGE_ITR_N(ST_B1_Q14, (use & TUNNEL_B1_Q14) ? 1u << Q14_strength : 1);
+          STAGE_PASS_N(ST_B1_Q14, n_Q14);
+
+          //Tunnel Q14 starts
+          PROBE(level_enter, ST_B1_Q14, stats.stage_itr[ST_B1_Q14]);
+          for(itr_Q14 = 0; itr_Q14 < n_Q14; itr_Q14++ ) {
+
+            PERF_STAGE(ST_B1_Q14);
+
+            //Q14 is modified according to its mask {1, 2, 3, 5, 6, 7, 27, 28, 29}
+            //NOTE that const_unmasked consider carries. So operations are +,- and not XOR.
+            const_masked = const_unmasked + mask_Q14[adm_Q14[itr_Q14]];
+
+            //We recover the remaining bits of Q[3],Q[4] and Q[14] from the current const_masked
+            Q[ 3] = Q3_fix + (const_masked & 0x88000025);
+            Q[ 4] = Q4_fix + (const_masked & 0x7400000a);
+            Q[14] = Q14_fix + mask_Q14[adm_Q14[itr_Q14]];
+
+            x[2] = RR(Q[3] - Q[2], 17) - F(Q[2], Q[1], QM0) - ctx->step3;
+
+            if (CHECK_X(ST_B1_Q14, 1, 2))
+              continue;
+
+            ///////////////////////////////////////////////////////////////
+            ///                       Tunnel Q4                          //
+            ///////////////////////////////////////////////////////////////
+            //Tunnel Q4 - 1 bit - Probabilistic tunnel. Modification on Q[4][26] will probably affect Q[24][32] 
+            PROBE(level_enter, ST_B1_Q4, stats.stage_itr[ST_B1_Q4]);
+            for (itr_Q4 = 0; itr_Q4 < ((use & TUNNEL_B1_Q4) ? 1u << Q4_strength : 1); itr_Q4++) {
+
+              STAGE_ITR(ST_B1_Q4);
+
+              if (itr_Q4)
+                Q[4] ^= GRAY_BIT(itr_Q4, Q4_mask_bits);
+
+              x[4] = RR(Q[5] - Q[4],  7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
+
+              // Q[24] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+              Q[24] = Q[23] + RL( G(Q[23],Q[22],Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+                
+              // Q[24] = 1... .... .... .... .... .... .... ....
+              if ( CHECK(ST_B1_Q4, COND_Q(24), bit(Q[24],32) != 1) ) 
+                continue;
+
+              STAGE_PASS(ST_B1_Q4);
+
+              x[ 3] = RR(Q[ 4] - Q[ 3], 22) - F(Q[ 3], Q[ 2], Q[ 1]) - ctx->step4;
+              x[ 6] = RR(Q[ 7] - Q[ 6], 17) - F(Q[ 6], Q[ 5], Q[ 4]) - Q[ 3] - 0xa8304613; 
+              x[ 7] = RR(Q[ 8] - Q[ 7], 22) - F(Q[ 7], Q[ 6], Q[ 5]) - Q[ 4] - 0xfd469501;
+              x[13] = RR(Q[14] - Q[13], 12) - F(Q[13], Q[12], Q[11]) - Q[10] - 0xfd987193; 
+              x[14] = RR(Q[15] - Q[14], 17) - F(Q[14], Q[13], Q[12]) - Q[11] - 0xa679438e; 
+
+              if (CHECK_X(ST_B1_Q4, 1, 3) || CHECK_X(ST_B1_Q4, 1, 4)  || CHECK_X(ST_B1_Q4, 1, 6) || 
+                  CHECK_X(ST_B1_Q4, 1, 7) || CHECK_X(ST_B1_Q4, 1, 13) || CHECK_X(ST_B1_Q4, 1, 14))
+                continue;
+     
+              ///////////////////////////////////////////////////////////////
+              ///                       Tunnel Q9                          //
+              ///////////////////////////////////////////////////////////////
+              //Tunnel Q9 - 3 bits - Deterministic tunnel. If the i-th bit of Q[10] would be zero 
+              //and the i-th bit of Q[11] would be one, an eventual change of the i-th 
+              //bit of Q[9] shouldn't affect the equations for Q[11] and Q[12].
+              Q[ 9] = tmp_q9;
+              x[12] = RR(Q[13]-Q[12],  7) - F(Q[12], Q[11], Q[10]) - Q[9] - 0x6b901122;
+
+              PROBE(level_enter, ST_B1_Q9, stats.stage_itr[ST_B1_Q9]);
+              for(itr_Q9 = 0; itr_Q9 < ((use & TUNNEL_B1_Q9) ? 1u << Q9_strength : 1); itr_Q9++ ) {
+
+                  STAGE_ITR(ST_B1_Q9);
+
+                  //x[12] depends linearly on Q[9]: it is updated by the difference of the flipped bit
+                  if (itr_Q9) {
+                    flip  = GRAY_BIT(itr_Q9, Q9_mask_bits);
+                    delta = FLIP_DELTA(Q[9], flip);
+                    Q[ 9] ^= flip;
+                    x[12] -= delta;
+                  }
+
+                  x[ 8] = RR(Q[ 9]-Q[ 8],  7) - F(Q[ 8], Q[ 7], Q[ 6]) - Q[5] - 0x698098d8;
+                  x[ 9] = RR(Q[10]-Q[ 9], 12) - F(Q[ 9], Q[ 8], Q[ 7]) - Q[6] - 0x8b44f7af;    
+
+                  if (CHECK_X(ST_B1_Q9, 1, 8) || CHECK_X(ST_B1_Q9, 1, 9) || CHECK_X(ST_B1_Q9, 1, 12))
+                    continue;
+                 
+                  //Tail: Q[25..64] and their conditions
+                  if (!Block1_tail(Q, x))
+                    continue;
+                    
+                  //We add the initial vector to obtain the Intermediate Hash Values of the current block
+                  AA0 = IV1 + Q[61];  BB0 = IV2 + Q[64];
+                  CC0 = IV3 + Q[63];  DD0 = IV4 + Q[62];
+                  
+                  //Last sufficient conditions  
+                  if ( CHECK(ST_B1_Q9, COND_IHV, !block1_ihv_ok(BB0, CC0, DD0)) ) 
+                    continue;
+
+                  //Message 1 block 1 computation completed. 
+                  
+                  //Now we see if the differential path is verified
+                  //Note that message 1 block 1 is x = x[0]||...||x[15]
+                  //While message 2 block 1 is Hx = x + C
+
+                  STAGE_PASS(ST_B1_Q9);
+                  PROBE(tail_survival, 1, stats.stage_itr[ST_B1_Q9]);
+                  STAGE_ITR(ST_B1_DIFF);
+
+                  //Message 2 block 1 hash computation from the IV
+                  message2_ihv(x, 0x00008000, IV1, IV2, IV3, IV4, &AA1, &BB1, &CC1, &DD1);
+                  
+                  //We see if the Differential Path is verified,
+                  if ( CHECK(ST_B1_DIFF, COND_DIFF, ((AA1-AA0) != 0x80000000) || 
+                                                    ((BB1-BB0) != 0x82000000) || 
+                                                    ((CC1-CC0) != 0x82000000) || 
+                                                    ((DD1-DD0) != 0x82000000)) )
+                    continue;
+                  
+                  STAGE_PASS(ST_B1_DIFF);
+                  PROBE(near_collision, AA0, BB0, CC0, DD0, AA1, BB1, CC1, DD1);
+
+                  //With a sink (--harvest) the walk of the tunnels goes on until the sink is full
+                  if ( (search_sink != NULL) && 
+                       !search_sink(x, Hx, (const uint32_t[8]) { AA0, BB0, CC0, DD0, AA1, BB1, CC1, DD1 }) )
+                    continue;
+
+                  //Only the first thread that finds a near-collision stores it
+                  if (!search_claim())
+                    return(-1);
+
+                  //We store the intermediate hash values
+                  A0=AA0; B0=BB0; C0=CC0; D0=DD0;
+                  A1=AA1; B1=BB1; C1=CC1; D1=DD1;
+
+                  //We store both first blocks
+                  for (i=0; i<16; i++) {
+                    memcpy( &v1[4*i], &x[i],  4); 
+                    memcpy( &v2[4*i], &Hx[i], 4);
+                  }
+
+                  return 0;
+
+                } //End of Q9 Tunnel
+              } //End of Q4 Tunnel
+            } //End of Q14 Tunnel
+          } //End of Q13 Tunnel
+        } //End of Q20 Tunnel
+      } //End of Q10 Tunnel
+    } //End of general for
+  return(-1); //Collision not found;
+}
+
+
+//A case for every combination of tunnels: each one inlines the kernel with a constant combination and the context ctx.
+#define KERNEL_CASE(kernel, t)       case (t): return kernel(&ctx, t);
+#define KERNEL_CASES_4(kernel, t)    KERNEL_CASE(kernel, t)        KERNEL_CASE(kernel, (t)+1)     \
+                                     KERNEL_CASE(kernel, (t)+2)    KERNEL_CASE(kernel, (t)+3)
+#define KERNEL_CASES_16(kernel, t)   KERNEL_CASES_4(kernel, t)     KERNEL_CASES_4(kernel, (t)+4)  \
+                                     KERNEL_CASES_4(kernel, (t)+8) KERNEL_CASES_4(kernel, (t)+12)
+#define KERNEL_CASES_64(kernel, t)   KERNEL_CASES_16(kernel, t)      KERNEL_CASES_16(kernel, (t)+16) \
+                                     KERNEL_CASES_16(kernel, (t)+32) KERNEL_CASES_16(kernel, (t)+48)
+
+//Block 1 generation with the tunnels in use
+int Block1() {
+
+  search_context ctx;
+
+  prepare_context(&ctx, IV1, IV2, IV3, IV4);
+
+  switch (tunnels & TUNNELS_B1) {
+    KERNEL_CASES_64(Block1_kernel, 0)
+  }
+
+  return(-1);
+}
+/*=========================================================*/
+
+
+/*=========================================================*/
+
+
+
+//Block 2 search. use is a constant combination of TUNNEL_B2_* flags in every call (see Block1_kernel()), 
+//I is the constant 32th bit of B0 (0 or 0x80000000): there is a kernel for each of its values.
+static inline __attribute__((always_inline)) int Block2_kernel(const search_context * ctx, const uint32_t use, const uint32_t I) {
+
+  uint32_t Q[65], x[16];
+  uint32_t QM0, QM1;
+  uint32_t i, itr_q16, itr_q1q2, itr_q9, itr_q4, itr_q12q11, tmp_q1, tmp_q2, tmp_q4, tmp_q9, tmp_q11, tmp_q12;
+  uint32_t tmp_x10, tmp_x15;
+  const uint32_t not_I = I ^ 0x80000000;
+  uint32_t sigma_Q17, sigma_Q19, sigma_Q20, sigma_Q23;
+  uint32_t Q1_fix, Q2_fix, mask_Q1Q2, Q1Q2_strength;
+  uint32_t flip, delta;
+  uint32_t AA0, BB0, CC0, DD0, AA1, BB1, CC1, DD1;
+
+  //Chaining value (QM2, QM3 are only used in the terms of ctx)
+  QM0 = ctx->QM0;  
+  QM1 = ctx->QM1;
+
+  //Bits for tunnel Q9 - 8 bits
+  static const int32_t Q9_mask_bits[] = {3, 4, 5, 11, 19, 21, 22, 23};
+  const uint32_t Q9_strength = 8;
+  
+  //Bits for MMMM Q4 - 6 bits
+  static const int32_t Q4_mask_bits[] = {14, 15, 16, 23, 24, 25};
+  const uint32_t Q4_strength = 6;
+
+  //Bits for MMMM Q12/Q11 - 6 bits
+  static const int32_t Q12Q11_mask_bits[] = {6, 27, 28, 29, 30, 31};
+  const uint32_t Q12Q11_strength = 6;
+
+
+  //Start block 2 generation. 
+  for ( ; ; ) {   
+
+    //The draw of Q[1..14] is counted in MMMM Q16 by --perf-stages
+    PERF_STAGE(ST_B2_Q16);
   
-  //Mask generation for MMMM Q4 - 6 bits
-  int Q4_mask_bits[] = {14, 15, 16, 23, 24, 25};
-  int Q4_strength = 6;
-  const uint32_t * mask_Q4 = generate_mask(Q4_strength, Q4_mask_bits); 
+    // Q[ 1] = ~Ivvv  010v  vv1v  vvv1  .vvv  0vvv  vv0.  ...v 
+    // RNG   =  .***  ...*  **.*  ***.  ****  .***  **.*  ****  0x71def7df
+    // 0     =  ....  *.*.  ....  ....  ....  *...  ..*.  ....  0x0a000820
+    // 1     =  ....  .*..  ..*.  ...*  ....  ....  ....  ....  0x04210000
+    Q[1] = (rng() & 0x71def7df) + 0x04210000 + not_I;
+
+    // Multi message modif. meth. (MMMM) Q1Q2, Klima
+    // Q[ 2] = ~I^^^  110^  ^^0^  ^^^1  0^^^  1^^^  ^^0v  v00^ 
+    // RNG   =  ....  ....  ....  ....  ....  ....  ...*  *...  0x00000018
+    // 0     =  ....  ..*.  ..*.  ....  *...  ....  ..*.  .**.  0x02208026
+    // 1     =  ....  **..  ....  ...*  ....  *...  ....  ....  0x0c010800
+    // Q[ 1] =  .***  ...*  **.*  ***.  .***  .***  **..  ...*  0x71de77c1
+    Q[2] = (rng() & 0x00000018) + 0x0c010800 + (Q[1] & 0x71de77c1) + not_I;
+
+    // Q[ 3] = ~I011  111.  ..01  1111  1..0  1vv1  011^  ^111 
+    // RNG   =  ....  ...*  **..  ....  .**.  .**.  ....  ....  0x01c06600
+    // 0     =  .*..  ....  ..*.  ....  ...*  ....  *...  ....  0x40201080
+    // 1     =  ..**  ***.  ...*  ****  *...  *..*  .**.  .***  0x3e1f8967
+    // Q[ 2] =  ....  ....  ....  ....  ....  ....  ...*  *...  0x00000018
+    Q[3] = (rng() & 0x01c06600) + 0x3e1f8967 + (Q[2] & 0x00000018) + not_I;
+
+    // Q[ 4] = ~I011  101.  ..00  0100  ...0  0^^0  0001  0001 
+    // RNG   =  ....  ...*  **..  ....  ***.  ....  ....  ....  0x01c0e000
+    // 0     =  .*..  .*..  ..**  *.**  ...*  *..*  ***.  ***.  0x443b19ee
+    // 1     =  ..**  *.*.  ....  .*..  ....  ....  ...*  ...*  0x3a040011
+    // Q[ 3] =  ....  ....  ....  ....  ....  .**.  ....  ....  0x00000600
+    Q[4] = (rng() & 0x01c0e000) + 0x3a040011 + (Q[3] & 0x00000600) + not_I;
+
+    // Q4 tunnel, Klima, bits 25-23,16-14
+    // Q[ 5] =  I100  10.0  0010  1111  0000  1110  0101  0000 
+    // RNG   =  ....  ..*.  ....  ....  ....  ....  ....  ....  0x02000000
+    // 0     =  ..**  .*.*  **.*  ....  ****  ...*  *.*.  ****  0x35d0f1af
+    // 1     =  .*..  *...  ..*.  ****  ....  ***.  .*.*  ....  0x482f0e50
+    Q[5] = (rng() & 0x02000000) + 0x482f0e50 + I;
+
+    // Q4 tunnel, Klima, bits 25-23,16-14
+    // Q[ 6] =  I..0  0101  1110  ..10  1110  1100  0101  0110 
+    // RNG   =  .**.  ....  ....  **..  ....  ....  ....  ....  0x600c0000
+    // 0     =  ...*  *.*.  ...*  ...*  ...*  ..**  *.*.  *..*  0x1a1113a9
+    // 1     =  ....  .*.*  ***.  ..*.  ***.  **..  .*.*  .**.  0x05e2ec56
+    Q[6] = (rng() & 0x600c0000) + 0x05e2ec56 + I;
+
+    // Q[ 7] = ~I..1  0111  1.00  ..01  10.1  1110  00..  ..v1 
+    // RNG   =  .**.  ....  .*..  **..  ..*.  ....  ..**  ***.  0x604c203e
+    // 0     =  ....  *...  ..**  ..*.  .*..  ...*  **..  ....  0x083241c0
+    // 1     =  ...*  .***  *...  ...*  *..*  ***.  ....  ...*  0x17819e01
+    Q[7] = (rng() & 0x604c203e) + 0x17819e01 + not_I;
+     
+    // Q[ 8] = ~I..0  0100  0.11  ..10  1..v  ..11  111.  ..^0 
+    // RNG   =  .**.  ....  .*..  **..  .***  **..  ...*  **..  0x604c7c1c
+    // 0     =  ...*  *.**  *...  ...*  ....  ....  ....  ...*  0x1b810001
+    // 1     =  ....  .*..  ..**  ..*.  *...  ..**  ***.  ....  0x043283e0
+    // Q[ 7] =  ....  ....  ....  ....  ....  ....  ....  ..*.  0x00000002
+    Q[8] = (rng() & 0x604c7c1c) + 0x043283e0 + (Q[7] & 0x00000002) + not_I;
+
+    // Q9 tunnel plus MMMM-Q12Q11, Klima
+    // Q[ 9] = ~Ivv1  1100  0xxx  .x01  0..^  .x01  110x  xx01 
+    // RNG   =  .**.  ....  .***  **..  .**.  **..  ...*  **..  0x607c6c1c
+    // 0     =  ....  ..**  *...  ..*.  *...  ..*.  ..*.  ..*.  0x03828222
+    // 1     =  ...*  **..  ....  ...*  ....  ...*  **..  ...*  0x1c0101c1
+    // Q[ 8] =  ....  ....  ....  ....  ...*  ....  ....  ....  0x00001000
+    Q[9] = (rng() & 0x607c6c1c) + 0x1c0101c1 + (Q[8] & 0x00001000) + not_I;
+
+    // Q9 tunnel plus MMMM-Q12Q11, Klima
+    // Q[10] = ~I^^1  1111  1000  v011  1vv0  1011  1100  0000 
+    // RNG   =  ....  ....  ....  *...  .**.  ....  ....  ....  0x00086000
+    // 0     =  ....  ....  .***  .*..  ...*  .*..  ..**  ****  0x0074143f
+    // 1     =  ...*  ****  *...  ..**  *...  *.**  **..  ....  0x1f838bc0
+    // Q[ 9] =  .**.  ....  ....  ....  ....  ....  ....  ....  0x60000000
+    Q[10] = (rng() & 0x00086000) + 0x1f838bc0 + (Q[ 9] & 0x60000000) + not_I;
+
+    // Q9 tunnel plus MMMM-Q12Q11, Klima
+    // Q[11] = ~Ivvv  vvvv  .111  ^101  1^^0  0111  11v1  1111 
+    // RNG   =  .***  ****  *...  ....  ....  ....  ..*.  ....  0x7f800020
+    // 0     =  ....  ....  ....  ..*.  ...*  *...  ....  ....  0x00021800
+    // 1     =  ....  ....  .***  .*.*  *...  .***  **.*  ****  0x007587df
+    // Q[10] =  ....  ....  ....  *...  .**.  ....  ....  ....  0x00086000
+    Q[11] = (rng() & 0x7f800020) + 0x007587df + (Q[10] & 0x00086000) + not_I;
+
+    // MMMM-Q12Q11, Klima
+    // Q[12] = ~I^^^  ^^^^  ....  1000  0001  ....  1.^.  .... 
+    // RNG   =  ....  ....  ****  ....  ....  ****  .*.*  ****  0x00f00f5f
+    // 0     =  ....  ....  ....  .***  ***.  ....  ....  ....  0x0007e000
+    // 1     =  ....  ....  ....  *...  ...*  ....  *...  ....  0x00081080
+    // Q[11] =  .***  ****  ....  ....  ....  ....  ..*.  ....  0x7f000020
+    Q[12] = (rng() & 0x00f00f5f) + 0x00081080 + (Q[11] & 0x7f000020) + not_I;
+
+    // Q[13] =  I011  1111  0...  1111  111.  ....  0...  1... 
+    // RNG   =  ....  ....  .***  ....  ...*  ****  .***  .***  0x00701f77
+    // 0     =  .*..  ....  *...  ....  ....  ....  *...  ....  0x40800080
+    // 1     =  ..**  ****  ....  ****  ***.  ....  ....  *...  0x3f0fe008
+    Q[13] = (rng() & 0x00701f77) + 0x3f0fe008 + I;
+
+    // Q[14] =  I100  0000  1...  1011  111.  ....  1...  1... 
+    // RNG   =  ....  ....  .***  ....  ...*  ****  .***  .***  0x00701f77
+    // 0     =  ..**  ****  ....  .*..  ....  ....  ....  ....  0x3f040000
+    // 1     =  .*..  ....  *...  *.**  ***.  ....  *...  *...  0x408be088
+    Q[14] = (rng() & 0x00701f77) + 0x408be088 + I;
+
+    // Next sufficient conditions until Q[24]:
+    // Q[15] =  0111  1101  ....  ..10  00..  ....  ....  0... 
+    // Q[16] =  ^.10  ....  ....  ..01  1...  ....  ....  1... 
+    // Q[17] =  ^.v.  ....  ....  ..0.  1...  ....  ....  1... 
+    // Q[18] =  ^.^.  ....  ....  ..1.  ....  ....  ....  .... 
+    // Q[19] =  ^...  ....  ....  ..0.  ....  ....  ....  .... 
+    // Q[20] =  ^...  ....  ....  ..v.  ....  ....  ....  .... 
+    // Q[21] =  ^...  ....  ....  ..^.  ....  ....  ....  .... 
+    // Q[22] =  ^...  ....  ....  ....  ....  ....  ....  ....   
+    // Q[23] =  0...  ....  ....  ....  ....  ....  ....  ....   
+    // Q[24] =  1...  ....  ....  ....  ....  ....  ....  ....   
+
+    //In MMMM-Q[1]/Q[2] we want to change the value of x[0] without updating the value of x[1], as updating x[1] will cause
+    //conditions on Q[17] not hold. According to F, if QM0[i] = QM1[i] randomly choose the value where
+    //Q[1][i] = Q[2][i] will not change the value of F(Q[1],QM0,QM1). We select these bits
+    // Q[ 1] = ~Ivvv  010v  vv1v  vvv1  .vvv  0vvv  vv0.  ...v 
+    // Q[ 2] = ~I^^^  110^  ^^0^  ^^^1  0^^^  1^^^  ^^0v  v00^ 
+    //          0111  0001  1101  1110  0111  0111  1100  0001 = 0x71de77c1
+    //
+    //Note that (~(QM0 ^ QM1)) are all the bits where QM0[i] = QM1[i] and so mask_Q1Q2 are all the bits 
+    //where QM0[i] = QM1[i] and where Q[1][i] = Q[2][i]. These bits will be changed.
+    mask_Q1Q2 = (~(QM0 ^ QM1)) & 0x71de77c1 ;
+    Q1Q2_strength = __builtin_popcount(mask_Q1Q2);
+
+    Q1_fix = Q[1] & ~mask_Q1Q2;
+    Q2_fix = Q[2] & ~mask_Q1Q2;
+
+    //x[1], x[6] and x[11] don't change in the MMMMs and tunnels
+    x[ 1] = RR(Q[ 2] - Q[ 1], 12) - F(Q[ 1],   QM0,   QM1) - ctx->step2;
+    x[ 6] = RR(Q[ 7] - Q[ 6], 17) - F(Q[ 6], Q[ 5], Q[ 4]) - Q[ 3] - 0xa8304613;
+    x[11] = RR(Q[12] - Q[11], 22) - F(Q[11], Q[10], Q[ 9]) - Q[ 8] - 0x895cd7be;
+
+    if (CHECK_X(ST_B2_Q16, 2, 1) || CHECK_X(ST_B2_Q16, 2, 6) || CHECK_X(ST_B2_Q16, 2, 11))
+      continue;
+
+    tmp_q1 = Q[1]; 
+    tmp_q2 = Q[2]; 
+    tmp_q4 = Q[4]; 
+    tmp_q9 = Q[9]; 
+    tmp_q11 = Q[11];
+    tmp_q12 = Q[12];
+
+    ///////////////////////////////////////////////////////////////
+    ///                        MMMM Q16                          //
+    ///////////////////////////////////////////////////////////////
+    //MMMM Q16 - 25 bits           
+    PROBE(level_enter, ST_B2_Q16, stats.stage_itr[ST_B2_Q16]);
+    for(itr_q16= 0; itr_q16 < (1u << 25); itr_q16++) {
+
+      //The search deadline is checked every 4096 steps of MMMM Q16 and at every step of MMMM Q1/Q2, which can take 
+      //milliseconds each
+      if ( ((itr_q16 & 0xfff) == 0) && search_expired() )
+        return(-1);
+
+      STAGE_ITR(ST_B2_Q16);
+
+      Q[1] = tmp_q1;
+      Q[2] = tmp_q2;
+      Q[4]  = tmp_q4;
+      Q[9]  = tmp_q9;
+      Q[11] = tmp_q11;
+      Q[12] = tmp_q12;
+
+      // Conditions by Liang-Lai says: Q[15] = (rng() & 0x80fc3ff7) + 0x7d020000, 
+      // Q[15] =  0111  1101  ....  ..10  00..  ....  ....  0... 
+      // RNG   =  ....  ....  ****  **..  ..**  ****  ****  .***  0x80fc3ff7
+      // 0     =  *...  ..*.  ....  ...*  **..  ....  ....  *...  0x0201c008
+      // 1     =  .***  **.*  ....  ..*.  ....  ....  ....  ....  0x7d020000
+      Q[15] = (rng() & 0x00fc3ff7) + 0x7d020000;
+
+      // Q[16] =  ^.10  ....  ....  ..01  1...  ....  ....  1... 
+      // RNG   =  .*..  ****  ****  **..  .***  ****  ****  .***  0x4ffc7ff7
+      // 0     =  ...*  ....  ....  ..*.  ....  ....  ....  ....  0x10020000
+      // 1     =  ..*.  ....  ....  ...*  *...  ....  ....  *...  0x20018008
+      // Q[15] =  *.... ..... ..... .... ..... ..... ...... ....  0x80000000
+      Q[16] = (rng() & 0x4ffc7ff7) + 0x20018008 + (Q[15] & 0x80000000);
+
+      // Q[17] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // Extra conditions: Σ17,25 ~ Σ17,27 not all 1  
+      // 0x07000000 =  0000 0111 0000 0000 0000 0000 0000 0000 
+      sigma_Q17 = G(Q[16], Q[15], Q[14]) + Q[13] + x[1] + 0xf61e2562;
+      if ( CHECK(ST_B2_Q16, COND_SIGMA(17), (sigma_Q17 & 0x07000000) == 0x07000000) ) 
+        continue;
+
+      // Q[16] =  ^.10  ....  ....  ..01  1...  ....  ....  1... 
+      // Q[17] =  ^.v.  ....  ....  ..0.  1...  ....  ....  1... 
+      //          1000  0000  0000  0010  1000  0000  0000  1000 0x80028008  
+      Q[17] = Q[16] + RL(sigma_Q17, 5);
+      
+      if ( CHECK(ST_B2_Q16, COND_Q(17), (Q[17] & 0x80028008) != (Q[16] & 0x80028008)) ) 
+        continue;
+
+      // Q[18] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      Q[18] = Q[17] + RL(G(Q[17], Q[16], Q[15]) + Q[14] + x[6] + 0xc040b340, 9);
+      
+      // Q[18] =  ^.^.  ....  ....  ..1.  ....  ....  ....  .... 
+      if ( CHECK(ST_B2_Q16, COND_Q(18), bit(Q[18],18) != 1) ) 
+        continue;
+
+      if ( CHECK_ALSO(ST_B2_Q16, COND_Q(18), (Q[18] & 0xa0000000) != (Q[17] & 0xa0000000)) ) 
+        continue;
+
+      // Q[19] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // Extra conditions: Σ19,4 ~ Σ19,18 not all 1  
+      // 0x0003fff8 =  0000 0000 0000 0011 1111 1111 1111 1000 
+      sigma_Q19 = G(Q[18], Q[17], Q[16]) + Q[15] + x[11] + 0x265e5a51;
+      if ( CHECK(ST_B2_Q16, COND_SIGMA(19), (sigma_Q19 & 0x0003fff8) == 0x0003fff8) ) 
+        continue;
+
+      Q[19] = Q[18] + RL(sigma_Q19, 14);
+
+      // Q[19] =  ^...  ....  ....  ..0.  ....  ....  ....  .... 
+      if ( CHECK(ST_B2_Q16, COND_Q(19), bit(Q[19],18) != 0) ) 
+        continue;
+
+      if ( CHECK_ALSO(ST_B2_Q16, COND_Q(19), bit(Q[19],32) != bit(Q[18],32)) ) 
+        continue;
+
+      STAGE_PASS(ST_B2_Q16);
+     
+      x[10] = RR(Q[11] - Q[10], 17) - F(Q[10], Q[ 9], Q[ 8]) - Q[ 7] - 0xffff5bb1;
+      x[15] = RR(Q[16] - Q[15], 22) - F(Q[15], Q[14], Q[13]) - Q[12] - 0x49b40821;
+
+      tmp_x10 = x[10];
+      tmp_x15 = x[15];
+
+      ///////////////////////////////////////////////////////////////
+      ///                      MMMM Q1/Q2                          //
+      ///////////////////////////////////////////////////////////////
+      //MMMM Q1/Q2 - variable bits
+      PROBE(level_enter, ST_B2_Q1Q2, stats.stage_itr[ST_B2_Q1Q2]);
+      for(itr_q1q2 = 0; itr_q1q2 < (1u << Q1Q2_strength); itr_q1q2++) {
+
+        if ( search_expired() )
+          return(-1);
+
+        STAGE_ITR(ST_B2_Q1Q2);
+
+        Q[4]  = tmp_q4;
+        Q[9]  = tmp_q9;
+        Q[11] = tmp_q11;
+        Q[12] = tmp_q12;
+
+        x[10] = tmp_x10;
+        x[15] = tmp_x15;
+
+        //We randomly change the mask bits where QM0[i] = QM1[i] and where Q[1][i] = Q[2][i]
+        Q[1] = (rng() & mask_Q1Q2) + Q1_fix;
+        Q[2] = ( Q[1] & mask_Q1Q2) + Q2_fix;
+        
+        x[0] = RR(Q[1] - QM0, 7) - ctx->step1;
+
+        if (CHECK_X(ST_B2_Q1Q2, 2, 0))
+          continue;
+        
+        // Q[20] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        // Extra conditions: Σ20,30 ~ Σ20,32 not all 0  
+        // 0xe0000000 =  1110 0000 0000 0000 0000 0000 0000 0000 
+        sigma_Q20 = G(Q[19], Q[18], Q[17]) + Q[16] + x[0] + 0xe9b6c7aa;
+        if ( CHECK(ST_B2_Q1Q2, COND_SIGMA(20), (sigma_Q20  & 0xe0000000) == 0) )
+          continue;
+        
+        Q[20] = Q[19] + RL(sigma_Q20, 20);
+        
+        // Q[20] =  ^...  ....  ....  ..v.  ....  ....  ....  ....   
+        if ( CHECK(ST_B2_Q1Q2, COND_Q(20), bit(Q[20],32) != bit(Q[19],32)) )
+          continue;
+        
+        // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        x[ 5] = RR(Q[6] - Q[5], 12) - F(Q[5], Q[4], Q[3]) - Q[2] - 0x4787c62a;
+
+        if (CHECK_X(ST_B2_Q1Q2, 2, 5))
+          continue;
+        
+        Q[21] = Q[20] + RL(G(Q[20], Q[19], Q[18]) + Q[17] + x[5] + 0xd62f105d, 5);   
+        
+        // Q[21] =  ^...  ....  ....  ..^.  ....  ....  ....  .... 
+        //          1000  0000  0000  0010  0000  0000  0000  0000 = 0x80020000
+        if ( CHECK(ST_B2_Q1Q2, COND_Q(21), (Q[21] & 0x80020000) != (Q[20] & 0x80020000)) )
+          continue;
+        
+        // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        Q[22] = Q[21] + RL(G(Q[21], Q[20], Q[19]) + Q[18] + x[10] + 0x2441453, 9);
+        
+        // Q[22] =  ^...  ....  ....  ....  ....  ....  ....  ....   
+        if ( CHECK(ST_B2_Q1Q2, COND_Q(22), bit(Q[22],32) != bit(Q[21],32)) )
+          continue;
+
+        // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        // Extra conditions: Σ23,18 = 0  
+        sigma_Q23 = G(Q[22], Q[21], Q[20]) + Q[19] + x[15] + 0xd8a1e681;
+        if ( CHECK(ST_B2_Q1Q2, COND_SIGMA(23), bit(sigma_Q23,18) != 0) )
+          continue;
+        
+        Q[23] = Q[22] + RL(sigma_Q23, 14);
+        
+        // Q[23] =  0...  ....  ....  ....  ....  ....  ....  ....   
+        if ( CHECK(ST_B2_Q1Q2, COND_Q(23), bit(Q[23],32) != 0) ) 
+          continue;
+        
+        // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+        x[ 4] = RR(Q[5] - Q[4], 7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
+
+        Q[24] = Q[23] + RL(G(Q[23], Q[22], Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+        
+        // Q[24] =  1...  ....  ....  ....  ....  ....  ....  ....   
+        if ( CHECK(ST_B2_Q1Q2, COND_Q(24), bit(Q[24],32) != 1) )
+          continue;
+
+        STAGE_PASS(ST_B2_Q1Q2);
+        PROBE(outer_draw_accept, 2, stats.stage_itr[ST_B2_Q1Q2]);
+
+        x[ 2] = RR(Q[ 3] - Q[ 2], 17) - F(Q[ 2], Q[ 1],   QM0) - ctx->step3;
+
+        if (CHECK_X(ST_B2_Q1Q2, 2, 2))
+          continue;
+
+        ///////////////////////////////////////////////////////////////
+        ///                      MMMM Q12/Q11                        //
+        ///////////////////////////////////////////////////////////////
+        //MMMM Q12/Q11 - 6 bits. Q[12][i] = Q[11][i] in bits 6,27-31, so flipping both bits leaves Q[12]-Q[11] unchanged.
+        //In the same bits Q[10][i] = Q[9][i], so F(Q[11],Q[10],Q[9]) does not depend on Q[11][i] and x[11] is preserved:
+        //conditions on Q[17..21] still hold. x[10] and x[12..15] change, so we verify again conditions on Q[22..23]
+        //(Q[24] is verified in MMMM Q4).
+        // Q[ 9] = ~Ivv1  1100  0xxx  .x01  0..^  .x01  110x  xx01 
+        // Q[10] = ~I^^1  1111  1000  v011  1vv0  1011  1100  0000 
+        // Q[11] = ~Ivvv  vvvv  .111  ^101  1^^0  0111  11v1  1111 
+        // Q[12] = ~I^^^  ^^^^  ....  1000  0001  ....  1.^.  .... 
+        //          .***  **..  ....  ....  ....  ....  ..*.  ....  0x7c000020
+        PROBE(level_enter, ST_B2_Q12Q11, stats.stage_itr[ST_B2_Q12Q11]);
+        for(itr_q12q11 = 0; itr_q12q11 < ((use & TUNNEL_B2_Q12Q11) ? 1u << Q12Q11_strength : 1); itr_q12q11++) {
+
+          STAGE_ITR(ST_B2_Q12Q11);
+
+          if (itr_q12q11) {
+            flip   = GRAY_BIT(itr_q12q11, Q12Q11_mask_bits);
+            Q[11] ^= flip;
+            Q[12] ^= flip;
+          }
+
+          x[10] = RR(Q[11] - Q[10], 17) - F(Q[10], Q[ 9], Q[ 8]) - Q[ 7] - 0xffff5bb1;
+          x[13] = RR(Q[14] - Q[13], 12) - F(Q[13], Q[12], Q[11]) - Q[10] - 0xfd987193; 
+          x[14] = RR(Q[15] - Q[14], 17) - F(Q[14], Q[13], Q[12]) - Q[11] - 0xa679438e; 
+          x[15] = RR(Q[16] - Q[15], 22) - F(Q[15], Q[14], Q[13]) - Q[12] - 0x49b40821;
+
+          if (CHECK_X(ST_B2_Q12Q11, 2, 10) || CHECK_X(ST_B2_Q12Q11, 2, 13) || CHECK_X(ST_B2_Q12Q11, 2, 14) || 
+              CHECK_X(ST_B2_Q12Q11, 2, 15))
+            continue;
+
+          // Q[22] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+          Q[22] = Q[21] + RL(G(Q[21], Q[20], Q[19]) + Q[18] + x[10] + 0x2441453, 9);
+          
+          // Q[22] =  ^...  ....  ....  ....  ....  ....  ....  ....   
+          if ( CHECK(ST_B2_Q12Q11, COND_Q(22), bit(Q[22],32) != bit(Q[21],32)) )
+            continue;
+
+          // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+          // Extra conditions: Σ23,18 = 0  
+          sigma_Q23 = G(Q[22], Q[21], Q[20]) + Q[19] + x[15] + 0xd8a1e681;
+          if ( CHECK(ST_B2_Q12Q11, COND_SIGMA(23), bit(sigma_Q23,18) != 0) )
+            continue;
+          
+          Q[23] = Q[22] + RL(sigma_Q23, 14);
+          
+          // Q[23] =  0...  ....  ....  ....  ....  ....  ....  ....   
+          if ( CHECK(ST_B2_Q12Q11, COND_Q(23), bit(Q[23],32) != 0) ) 
+            continue;
+
+          STAGE_PASS(ST_B2_Q12Q11);
+
+          ///////////////////////////////////////////////////////////////
+          ///                         MMMM Q4                          //
+          ///////////////////////////////////////////////////////////////
+          //MMMM Q4 - 6 bits
+          Q[4] = tmp_q4;
+
+          PROBE(level_enter, ST_B2_Q4, stats.stage_itr[ST_B2_Q4]);
+          for(itr_q4 = 0; itr_q4 < (1u << Q4_strength); itr_q4++) {
+
+            STAGE_ITR(ST_B2_Q4);
+
+            if (itr_q4)
+              Q[4] ^= GRAY_BIT(itr_q4, Q4_mask_bits);
+
+            x[4] = RR(Q[5] - Q[4], 7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
+          
+            Q[24] = Q[23] + RL(G(Q[23], Q[22], Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
+          
+            // Q[24] =  1...  ....  ....  ....  ....  ....  ....  ....   
+            if( CHECK(ST_B2_Q4, COND_Q(24), bit(Q[24], 32) != 1) ) 
+              continue;
+
+            STAGE_PASS(ST_B2_Q4);
+
+            x[3] = RR(Q[4] - Q[3], 22) - F(Q[3], Q[2], Q[1]) - ctx->step4;
+            x[7] = RR(Q[8] - Q[7], 22) - F(Q[7], Q[6], Q[5]) - Q[4] - 0xfd469501;   
+
+            if (CHECK_X(ST_B2_Q4, 2, 3) || CHECK_X(ST_B2_Q4, 2, 4) || CHECK_X(ST_B2_Q4, 2, 7))
+              continue;
+
+
+            ///////////////////////////////////////////////////////////////
+            ///                       Tunnel Q9                          //
+            ///////////////////////////////////////////////////////////////
+            //Tunnel Q9 - 8 bits 
+            Q[9]  = tmp_q9;
+            x[12] = RR(Q[13] - Q[12],  7) - F(Q[12], Q[11], Q[10]) - Q[9] - 0x6b901122;
+
+            PROBE(level_enter, ST_B2_Q9, stats.stage_itr[ST_B2_Q9]);
+            for(itr_q9 = 0; itr_q9 < ((use & TUNNEL_B2_Q9) ? 1u << Q9_strength : 1); itr_q9++ ) {
+            
+              STAGE_ITR(ST_B2_Q9);
+
+              //x[12] depends linearly on Q[9]: it is updated by the difference of the flipped bit
+              if (itr_q9) {
+                flip  = GRAY_BIT(itr_q9, Q9_mask_bits);
+                delta = FLIP_DELTA(Q[9], flip);
+                Q[9] ^= flip;
+                x[12] -= delta;
+              }
+            
+              x[ 8] = RR(Q[ 9] - Q[ 8],  7) - F(Q[ 8], Q[ 7], Q[ 6]) - Q[5] - 0x698098d8;   
+              x[ 9] = RR(Q[10] - Q[ 9], 12) - F(Q[ 9], Q[ 8], Q[ 7]) - Q[6] - 0x8b44f7af;   
+
+              if (CHECK_X(ST_B2_Q9, 2, 8) || CHECK_X(ST_B2_Q9, 2, 9) || CHECK_X(ST_B2_Q9, 2, 12))
+                continue;
+
+              //Tail: Q[25..64] and their conditions
+              if (!Block2_tail(Q, x))
+                continue;
+             
+              //Block 2 is now completed. We verify if the differential path is reached.
+
+              STAGE_PASS(ST_B2_Q9);
+              PROBE(tail_survival, 2, stats.stage_itr[ST_B2_Q9]);
+              STAGE_ITR(ST_B2_DIFF);
+
+              //Message 1 intermediate hash     
+              AA0 = A0 + Q[61]; BB0 = B0 + Q[64];
+              CC0 = C0 + Q[63]; DD0 = D0 + Q[62];
+
+              //Message 2 intermediate hash computation
+              message2_ihv(x, -0x00008000, A1, B1, C1, D1, &AA1, &BB1, &CC1, &DD1);
+            
+              if ( CHECK(ST_B2_DIFF, COND_DIFF, ((AA1-AA0) != 0) || ((BB1-BB0) != 0) || ((CC1-CC0) != 0) || ((DD1-DD0) != 0)) )
+                continue;
+            
+              //We have now found a collision!!
+              STAGE_PASS(ST_B2_DIFF);
+              PROBE(collision, AA0, BB0, CC0, DD0);
+
+              //With a sink (--fanout) the search goes on until the sink is full
+              if ( (search_sink != NULL) && 
+                   !search_sink(x, Hx, (const uint32_t[8]) { AA0, BB0, CC0, DD0, AA0, BB0, CC0, DD0 }) )
+                continue;
+
+              //Only the first thread that finds a collision stores it
+              if (!search_claim())
+                return(-1);
+
+              //I save the last intermediate hash for final hash computation
+              A0 = AA0; B0 = BB0; C0 = CC0; D0 = DD0;
+
+              //I save both second blocks
+              for( i = 0; i < 16; i++ ) {
+                memcpy( &v1[64 + (i * 4)], &x[i],  4);
+                memcpy( &v2[64 + (i * 4)], &Hx[i], 4);
+              }
+          
+              return(0);
+
+            } //End of Tunnel Q9
+          } //End of MMMM Q4
+        } //End of MMMM Q12/Q11
+      } //End of MMMM Q1/12
+    } //End of MMMM Q16
+  } //End of general for
+  return(-1); //Collision not found
+}
+
+
+//A case for every combination of Block 2 tunnels t and 32th bit of B0 (bit 1 of t).
+#define B2_KERNEL_CASE(t)            case (t): return Block2_kernel(&ctx, (t) & TUNNELS_B2, ((t) & 1) << 31);
+
+//Block 2 generation with the tunnels in use, for the chaining value A0,B0,C0,D0
+int Block2() {
+
+  search_context ctx;
+
+  prepare_context(&ctx, A0, B0, C0, D0);
+
+  switch ((tunnels & TUNNELS_B2) | (B0 >> 31)) {
+    B2_KERNEL_CASE(0x00)
+    B2_KERNEL_CASE(0x01)
+    B2_KERNEL_CASE(TUNNEL_B2_Q9)
+    B2_KERNEL_CASE(TUNNEL_B2_Q9 | 0x01)
+    B2_KERNEL_CASE(TUNNEL_B2_Q12Q11)
+    B2_KERNEL_CASE(TUNNEL_B2_Q12Q11 | 0x01)
+    B2_KERNEL_CASE(TUNNEL_B2_Q9 | TUNNEL_B2_Q12Q11)
+    B2_KERNEL_CASE(TUNNEL_B2_Q9 | TUNNEL_B2_Q12Q11 | 0x01)
+  }
+
+  return(-1);
+}
+
+
+///////////////////////////////////////////////////////////////
+///                     STATISTICS                           //
+///////////////////////////////////////////////////////////////
+
+//Adds the stats of the calling thread to total and clears them
+void merge_stats(search_stats * total) {
+
+  uint64_t * t = (uint64_t *) total, * s = (uint64_t *) &stats;
+
+  for (size_t i = 0; i < sizeof(search_stats) / sizeof(uint64_t); i++)
+    t[i] += s[i];
+
+  memset(&stats, 0, sizeof(stats));
+}
+
+
+#if COUNT_CONDITIONS
+
+//Writes in name the name of condition c
+void condition_name(int c, char * name) {
+
+  if (c == COND_IHV)
+    sprintf(name, "IHV");
+  else if (c == COND_DIFF)
+    sprintf(name, "differential");
+  else if (c == COND_BYTES)
+    sprintf(name, "bytes");
+  else if (c & 1)
+    sprintf(name, "Sigma%d", (c + 1) / 2);
+  else
+    sprintf(name, "Q[%d]", c / 2);
+}
+
+
+//First level of the block of level s: its iterations are the draws of the block
+int first_stage(int s) {
+  return (s < ST_B2_Q16) ? ST_B1_OUTER : ST_B2_Q16;
+}
+
+
+//Prints the attempts, passes and pass probability of every level and of every condition checked in it.
+//Per draw is how many candidates pass the level for every draw of its block, as the tunnels multiply them. 
+//Work is the iterations of the level and of the levels before it in its block.
+void print_stats(const search_stats * t) {
+
+  char name[16];
+  uint64_t work = 0, attempts, passes;
+
+  printf("\n%-22s %15s %15s %11s %11s %15s\n", "Level / condition", "Attempts", "Passes", "Pass prob", "Per draw", "Work");
+
+  for (int s = 0; s < STAGES_NUMBER; s++) {
+
+    if (s == first_stage(s))
+      work = 0;
+    work += t->stage_itr[s];
+
+    printf("%-22s %15llu %15llu %11.4g %11.4g %15llu\n", stage_names[s], (unsigned long long) t->stage_itr[s], 
+           (unsigned long long) t->stage_pass[s], t->stage_itr[s] ? (double) t->stage_pass[s] / t->stage_itr[s] : 0, 
+           t->stage_itr[first_stage(s)] ? (double) t->stage_pass[s] / t->stage_itr[first_stage(s)] : 0, 
+           (unsigned long long) work);
+
+    for (int c = 0; c < COND_NUMBER; c++) {
+
+      attempts = t->cond_attempt[s][c];
+      if (attempts == 0)
+        continue;
+
+      passes = attempts - t->cond_reject[s][c];
+      condition_name(c, name);
+      printf("  %-20s %15llu %15llu %11.4g\n", name, (unsigned long long) attempts, (unsigned long long) passes, 
+             (double) passes / attempts);
+    }
+  }
+}
+
+
+//Writes the statistics printed by print_stats() as JSON in filename. Returns 1 if the file can't be written.
+int write_stats_json(char * filename, const search_stats * t, uint32_t seed) {
+
+  char name[16];
+  uint64_t work = 0, attempts, passes;
+  int first;
+  FILE * f;
+
+  f = fopen(filename, "w");
+  if (f == NULL)
+    return 1;
+
+  fprintf(f, "{\n  \"seed\": \"0x%08X\",\n  \"stages\": [\n", seed);
+
+  for (int s = 0; s < STAGES_NUMBER; s++) {
+
+    if (s == first_stage(s))
+      work = 0;
+    work += t->stage_itr[s];
+
+    fprintf(f, "    { \"name\": \"%s\", \"attempts\": %llu, \"passes\": %llu, \"pass_probability\": %.6g, "
+               "\"per_draw\": %.6g, \"work\": %llu,\n      \"conditions\": [", 
+            stage_names[s], (unsigned long long) t->stage_itr[s], (unsigned long long) t->stage_pass[s], 
+            t->stage_itr[s] ? (double) t->stage_pass[s] / t->stage_itr[s] : 0, 
+            t->stage_itr[first_stage(s)] ? (double) t->stage_pass[s] / t->stage_itr[first_stage(s)] : 0, 
+            (unsigned long long) work);
+
+    first = 1;
+    for (int c = 0; c < COND_NUMBER; c++) {
+
+      attempts = t->cond_attempt[s][c];
+      if (attempts == 0)
+        continue;
+
+      passes = attempts - t->cond_reject[s][c];
+      condition_name(c, name);
+      fprintf(f, "%s\n        { \"name\": \"%s\", \"attempts\": %llu, \"passes\": %llu, \"pass_probability\": %.6g }", 
+              first ? "" : ",", name, (unsigned long long) attempts, (unsigned long long) passes, (double) passes / attempts);
+      first = 0;
+    }
+
+    fprintf(f, "%s] }%s\n", first ? "" : "\n      ", (s == STAGES_NUMBER - 1) ? "" : ",");
+  }
+
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+
+  return 0;
+}
+
+#endif
+
+
+///////////////////////////////////////////////////////////////
+///                    PARALLEL SEARCH                       //
+///////////////////////////////////////////////////////////////
+
+//Maximum number of search threads and of NUMA nodes
+#define MAX_THREADS 256
+#define MAX_NODES   64
+
+//Threads searching every block (--threads) and hardware events counted by each of them (--perf-stages)
+int search_threads = 1;
+int perf_stages = 0;
+
+//How the search threads are pinned (--pin): not pinned, one per physical core first, filling the SMT siblings of
+//a core first, or round robin on the NUMA nodes (free to move within their node)
+enum { PIN_NONE, PIN_CORE, PIN_SMT, PIN_NODE };
+const char * pin_names[] = { "none", "core", "smt", "node" };
+int pin_mode = PIN_NONE;
+
+//CPU sets of the threads: thread k runs on pin_sets[k % pin_count]
+cpu_set_t pin_sets[MAX_THREADS];
+int pin_count;
+
+//Stats of the running search threads, that they register and the monitor reads. search_lock protects them and the
+//merges of the stats into the totals.
+search_stats * running[MAX_THREADS];
+pthread_mutex_t search_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//A search shared by its threads: the IV, the chaining values and the message blocks of the thread that started it,
+//replaced by those of the (near-)collision found, the flag that stops the threads and the sink of the collisions
+typedef struct {
+  uint32_t iv[4], cv[8];
+  uint8_t v1[128], v2[128];
+  int stop;
+  int (* sink)(const uint32_t * x, const uint32_t * Hx, const uint32_t * ihv);
+} search_state;
+
+//A search thread: the block it searches, its index, the seed of its generator, its search and the stats to merge its 
+//own in
+typedef struct {
+  int block, k, result;
+  uint32_t seed;
+  search_state * state;
+  search_stats * total;
+  pthread_t id;
+} search_job;
+
+
+//Reads the integer in the file /sys/devices/system/<path>, or returns -1
+int read_sys_int(const char * path, int n) {
+
+  char fname[256];
+  FILE * f;
+  int value = -1;
+
+  snprintf(fname, sizeof(fname), path, n);
+  f = fopen(fname, "r");
+  if (f == NULL)
+    return -1;
+  if (fscanf(f, "%d", &value) != 1)
+    value = -1;
+  fclose(f);
+
+  return value;
+}
+
+
+//Reads the CPU list (e.g. "0-3,8-11") of NUMA node n into set. Returns 1 if the node doesn't exist.
+int read_node_cpus(int n, cpu_set_t * set) {
+
+  char fname[256];
+  FILE * f;
+  int first, last;
+
+  snprintf(fname, sizeof(fname), "/sys/devices/system/node/node%d/cpulist", n);
+  f = fopen(fname, "r");
+  if (f == NULL)
+    return 1;
+
+  CPU_ZERO(set);
+  while (fscanf(f, "%d", &first) == 1) {
+    last = first;
+    if (fscanf(f, "-%d", &last) != 1)
+      last = first;
+    for (int cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++)
+      CPU_SET(cpu, set);
+    if (fgetc(f) != ',')
+      break;
+  }
+  fclose(f);
+
+  return 0;
+}
+
+
+//Computes the CPU sets of the threads for mode, among the CPUs the process can run on, and returns the number of
+//these CPUs
+int pin_plan(int mode) {
+
+  cpu_set_t allowed, node;
+  int cpu[CPU_SETSIZE], core[CPU_SETSIZE], package[CPU_SETSIZE], sibling[CPU_SETSIZE];
+  int64_t key[CPU_SETSIZE], tmp;
+  int n = 0, i, j;
+
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+
+  for (i=0; i<CPU_SETSIZE; i++) {
+    if (!CPU_ISSET(i, &allowed))
+      continue;
+    cpu[n] = i;
+    core[n] = read_sys_int("/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+    package[n] = read_sys_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+    if (core[n] < 0)
+      core[n] = i;
+    if (package[n] < 0)
+      package[n] = 0;
+
+    //Index of this CPU among the SMT siblings of its core
+    sibling[n] = 0;
+    for (j=0; j<n; j++)
+      sibling[n] += (core[j] == core[n]) && (package[j] == package[n]);
+    n++;
+  }
+
+  pin_count = 0;
+
+  if (mode == PIN_NODE) {
+    for (i=0; (i < MAX_NODES) && (pin_count < MAX_THREADS); i++) {
+      if (read_node_cpus(i, &node))
+        continue;
+      CPU_AND(&pin_sets[pin_count], &node, &allowed);
+      if (CPU_COUNT(&pin_sets[pin_count]) > 0)
+        pin_count++;
+    }
+    if (pin_count == 0)
+      pin_sets[pin_count++] = allowed;
+  }
+
+  else if ( (mode == PIN_CORE) || (mode == PIN_SMT) ) {
+
+    //Sort the CPUs by sibling index, then by core (PIN_CORE), or by core, then by sibling index (PIN_SMT)
+    for (i=0; i<n; i++)
+      key[i] = (mode == PIN_CORE) ? ((int64_t) sibling[i] << 48) | ((int64_t) package[i] << 32) | core[i] :
+                                    ((int64_t) package[i] << 40) | ((int64_t) core[i] << 16) | sibling[i];
+
+    for (i=1; i<n; i++)
+      for (j=i; (j > 0) && (key[j-1] > key[j]); j--) {
+        tmp = key[j]; key[j] = key[j-1]; key[j-1] = tmp;
+        tmp = cpu[j]; cpu[j] = cpu[j-1]; cpu[j-1] = tmp;
+      }
+
+    for (i=0; (i < n) && (pin_count < MAX_THREADS); i++) {
+      CPU_ZERO(&pin_sets[pin_count]);
+      CPU_SET(cpu[i], &pin_sets[pin_count]);
+      pin_count++;
+    }
+  }
+
+  return n;
+}
+
+
+//Search thread: runs Block1() or Block2() with its own generator on the values of its search, then merges its stats 
+//in job->total. The thread that finds the (near-)collision stores it in the search.
+void * search_worker(void * arg) {
+
+  search_job * job = arg;
+  search_state * st = job->state;
+  int slot;
+
+  //The threads of all the searches running are registered in different slots, that also choose their CPUs
+  pthread_mutex_lock(&search_lock);
+  for (slot = 0; (slot < MAX_THREADS) && (running[slot] != NULL); slot++);
+  if (slot < MAX_THREADS)
+    running[slot] = &stats;
+  pthread_mutex_unlock(&search_lock);
+
+  if (pin_mode != PIN_NONE)
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &pin_sets[(slot % MAX_THREADS) % pin_count]);
+
+  X = job->seed;
+  IV1 = st->iv[0]; IV2 = st->iv[1]; IV3 = st->iv[2]; IV4 = st->iv[3];
+  A0 = st->cv[0];  B0 = st->cv[1];  C0 = st->cv[2];  D0 = st->cv[3];
+  A1 = st->cv[4];  B1 = st->cv[5];  C1 = st->cv[6];  D1 = st->cv[7];
+  memcpy(v1, st->v1, sizeof(v1));
+  memcpy(v2, st->v2, sizeof(v2));
+  search_stop = &st->stop;
+  search_sink = st->sink;
+
+  if (perf_stages)
+    perf_open();
+
+  job->result = (job->block == 1) ? Block1() : Block2();
+  job->seed = X;
+
+  //Only the thread that claimed the result returns 0
+  if (job->result == 0) {
+    st->cv[0] = A0;  st->cv[1] = B0;  st->cv[2] = C0;  st->cv[3] = D0;
+    st->cv[4] = A1;  st->cv[5] = B1;  st->cv[6] = C1;  st->cv[7] = D1;
+    memcpy(st->v1, v1, sizeof(v1));
+    memcpy(st->v2, v2, sizeof(v2));
+  }
+
+  if (perf_stages) {
+    perf_switch(STAGES_NUMBER);
+    perf_close();
+  }
+
+  pthread_mutex_lock(&search_lock);
+  if (slot < MAX_THREADS)
+    running[slot] = NULL;
+  if (job->total != NULL)
+    merge_stats(job->total);
+  pthread_mutex_unlock(&search_lock);
+
+  return NULL;
+}
+
+
+//Searches block 1 or 2 from the IV and chaining values of the calling thread with threads threads, and merges their 
+//stats in total (if not NULL). Thread 0 continues the generator of the calling thread, so one thread finds the same 
+//collisions as a serial search; the others are seeded from it. Several threads can run their searches at the same 
+//time. Returns 0 if a (near-)collision was found, and gives its chaining values and blocks to the calling thread.
+//Returns -1 otherwise (deadline, or no thread could be started).
+int parallel_search(int block, int threads, search_stats * total) {
+
+  search_job jobs[MAX_THREADS];
+  search_state st = { { IV1, IV2, IV3, IV4 }, { A0, B0, C0, D0, A1, B1, C1, D1 }, { 0 }, { 0 }, 0, search_sink };
+  int started, found = 0;
+
+  memcpy(st.v1, v1, sizeof(v1));
+  memcpy(st.v2, v2, sizeof(v2));
+
+  //The search goes on with the threads that could be started
+  for (started = 0; started < threads; started++) {
+    jobs[started].block = block;
+    jobs[started].k = started;
+    jobs[started].seed = started ? mix(X + started) : X;
+    jobs[started].state = &st;
+    jobs[started].total = total;
+    if (pthread_create(&jobs[started].id, NULL, search_worker, &jobs[started]))
+      break;
+  }
+
+  for (int k=0; k<started; k++) {
+    pthread_join(jobs[k].id, NULL);
+    found |= (jobs[k].result == 0);
+  }
+
+  if (started > 0)
+    X = jobs[0].seed;
+
+  if (found) {
+    A0 = st.cv[0];  B0 = st.cv[1];  C0 = st.cv[2];  D0 = st.cv[3];
+    A1 = st.cv[4];  B1 = st.cv[5];  C1 = st.cv[6];  D1 = st.cv[7];
+    memcpy(v1, st.v1, sizeof(v1));
+    memcpy(v2, st.v2, sizeof(v2));
+  }
+
+  return found ? 0 : -1;
+}
+
+
+//Sets sum to the stats of the running search threads, plus total if it isn't NULL
+void running_stats(search_stats * sum, const search_stats * total) {
+
+  uint64_t * t = (uint64_t *) sum, * s;
+  const size_t n = sizeof(search_stats) / sizeof(uint64_t);
+
+  pthread_mutex_lock(&search_lock);
+
+  if (total != NULL)
+    memcpy(sum, total, sizeof(search_stats));
+  else
+    memset(sum, 0, sizeof(search_stats));
+
+  for (int k=0; k<MAX_THREADS; k++) {
+    if (running[k] == NULL)
+      continue;
+    s = (uint64_t *) running[k];
+    for (size_t i = 0; i < n; i++)
+      t[i] += RELAXED_READ(s[i]);
+  }
+
+  pthread_mutex_unlock(&search_lock);
+}
+
+
+///////////////////////////////////////////////////////////////
+///                      MONITORING                          //
+///////////////////////////////////////////////////////////////
+
+//Expected iterations of tunnel Q9 (candidates satisfying the conditions until Q[24]) for a near-collision in Block 1 
+//and for a collision in Block 2: the tails have 25 and 22 bit conditions, and about 1 in 7 Block 1 candidates that 
+//satisfy them also satisfy the differential path.
+const double expected_tail[2] = { 7.0 * (1 << 25), 1 << 22 };
+
+//Seconds between two rewrites of the --metrics file
+#define METRICS_INTERVAL 5
+
+//Upper bounds (seconds) of the buckets of the time to collision histogram
+#define TTC_BUCKETS 10
+const double ttc_bounds[TTC_BUCKETS] = { 1, 5, 10, 30, 60, 120, 300, 600, 1800, 3600 };
+
+//The monitor thread reports the progress (--progress, --progress-json) and exports the metrics (--metrics). 
+//The main thread sets monitor_block to the block being searched (0 = none) and monitor_total to the stats of the 
+//finished blocks. The monitor reads the stats of the search threads with running_stats().
+int monitor_block;
+search_stats * monitor_total;
+int monitor_stop;
+
+double progress_interval;
+int progress_text;
+FILE * progress_json;
+
+char * metrics_file;
+
+//Time to collision histogram: collisions with time up to each bound, their number and the sum of the times
+uint64_t ttc_bucket[TTC_BUCKETS], ttc_count;
+double ttc_sum;
+
+
+//Writes x with a SI suffix (k, M, G) in str
+void format_si(double x, char * str) {
+
+  if (x >= 1e9)
+    sprintf(str, "%.2fG", x / 1e9);
+  else if (x >= 1e6)
+    sprintf(str, "%.2fM", x / 1e6);
+  else if (x >= 1e3)
+    sprintf(str, "%.2fk", x / 1e3);
+  else
+    sprintf(str, "%.0f", x);
+}
+
+
+//Adds to the time to collision histogram a collision found in seconds
+void observe_collision(double seconds) {
+
+  double sum = ttc_sum + seconds;
+
+  for (int i=0; i<TTC_BUCKETS; i++)
+    if (seconds <= ttc_bounds[i])
+      __atomic_add_fetch(&ttc_bucket[i], 1, __ATOMIC_RELAXED);
+
+  __atomic_store(&ttc_sum, &sum, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&ttc_count, 1, __ATOMIC_RELAXED);
+}
+
+
+//Prints on stderr (and/or writes as a JSON line to progress_json) the block being searched, the iterations/sec of 
+//each of its levels since the last report, the candidates that satisfied the conditions until Q[24] and Q[48], and 
+//the expected time to the (near-)collision from the rate of Q[24] candidates.
+void report_progress(double start, double t) {
+
+  static uint64_t last[STAGES_NUMBER];
+  static search_stats current;
+  static double last_time, block_start;
+  static int last_block;
+  uint64_t count, q24, q48;
+  double eta, elapsed;
+  int block, first, last_stage;
+  char str[16];
+
+  if (last_time == 0)
+    last_time = block_start = start;
+  elapsed = t - last_time;
+
+  block = __atomic_load_n(&monitor_block, __ATOMIC_ACQUIRE);
+  running_stats(&current, NULL);
+  if (block != last_block) {
+    block_start = last_time;
+    last_block = block;
+  }
+
+  if (block != 0) {
+
+    first = (block == 1) ? ST_B1_OUTER : ST_B2_Q16;
+    last_stage = (block == 1) ? ST_B1_Q9 : ST_B2_Q9;
+    q24 = current.stage_itr[last_stage];
+    q48 = current.tail_q48[block - 1];
+
+    //The tail is a geometric process: the expected time left doesn't depend on the time already spent
+    eta = q24 ? expected_tail[block - 1] / (q24 / (t - block_start)) : -1;
+
+    if (progress_text) {
+      fprintf(stderr, "[%8.1f s] block %d |", t - start, block);
+      for (int s = first; s <= last_stage; s++) {
+        count = current.stage_itr[s];
+        format_si((count >= last[s] ? count - last[s] : count) / elapsed, str);
+        fprintf(stderr, " %s %s/s", stage_names[s] + 3, str);
+      }
+      format_si(q24, str);
+      fprintf(stderr, " | Q24 %s", str);
+      format_si(q48, str);
+      fprintf(stderr, " Q48 %s | ETA ", str);
+      if (eta < 0) 
+        fprintf(stderr, "unknown\n");
+      else
+        fprintf(stderr, "%.1f s\n", eta);
+    }
+
+    if (progress_json != NULL) {
+      fprintf(progress_json, "{\"time\": %.3f, \"block\": %d, \"rates\": {", t - start, block);
+      for (int s = first; s <= last_stage; s++) {
+        count = current.stage_itr[s];
+        fprintf(progress_json, "%s\"%s\": %.0f", (s == first) ? "" : ", ", stage_names[s], 
+                (count >= last[s] ? count - last[s] : count) / elapsed);
+      }
+      fprintf(progress_json, "}, \"q24\": %llu, \"q48\": %llu, \"eta\": %.3f}\n", (unsigned long long) q24, 
+              (unsigned long long) q48, eta);
+      fflush(progress_json);
+    }
+  }
+
+  for (int s = 0; s < STAGES_NUMBER; s++)
+    last[s] = current.stage_itr[s];
+  last_time = t;
+}
+
+
+//Rewrites metrics_file in the Prometheus text format, for the textfile collector of node_exporter. The file is 
+//written aside and renamed, so that it's replaced atomically. Returns 1 if it can't be written.
+int write_metrics() {
+
+  //Counters are exported as the largest value seen, so that they never decrease
+  static uint64_t itr[STAGES_NUMBER], pass[STAGES_NUMBER];
+  static search_stats current;
+  char tmp_file[4096], list[128];
+  uint64_t value;
+  double sum;
+  int n = 0;
+  FILE * f;
+
+  //Out of the blocks, the search threads (if any) are autotuning trials
+  if (__atomic_load_n(&monitor_block, __ATOMIC_ACQUIRE))
+    running_stats(&current, monitor_total);
+  else {
+    pthread_mutex_lock(&search_lock);
+    current = *monitor_total;
+    pthread_mutex_unlock(&search_lock);
+  }
+
+  for (int s = 0; s < STAGES_NUMBER; s++) {
+
+    value = current.stage_itr[s];
+    if (value > itr[s])
+      itr[s] = value;
+
+    value = current.stage_pass[s];
+    if (value > pass[s])
+      pass[s] = value;
+  }
+
+  for (int i=0; i<TUNNELS_NUMBER; i++)
+    if (tunnels & (1u << i))
+      n += sprintf(list + n, "%s%s", n ? "," : "", tunnel_names[i]);
+
+  snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", metrics_file);
+  f = fopen(tmp_file, "w");
+  if (f == NULL)
+    return 1;
+
+  fprintf(f, "# HELP md5_tunneling_collisions_total Collisions found.\n");
+  fprintf(f, "# TYPE md5_tunneling_collisions_total counter\n");
+  fprintf(f, "md5_tunneling_collisions_total %llu\n", (unsigned long long) pass[ST_B2_DIFF]);
+
+  //Block 2 near-collisions are the candidates that survived the Q25-Q64 tail, before the final difference check
+  fprintf(f, "# HELP md5_tunneling_near_collisions_total Near-collisions: block 1 candidates with the output "
+             "difference, block 2 candidates that passed the conditions on Q25-Q64.\n");
+  fprintf(f, "# TYPE md5_tunneling_near_collisions_total counter\n");
+  fprintf(f, "md5_tunneling_near_collisions_total{block=\"1\"} %llu\n", (unsigned long long) pass[ST_B1_DIFF]);
+  fprintf(f, "md5_tunneling_near_collisions_total{block=\"2\"} %llu\n", (unsigned long long) pass[ST_B2_Q9]);
+
+  fprintf(f, "# HELP md5_tunneling_level_iterations_total Iterations of every search level.\n");
+  fprintf(f, "# TYPE md5_tunneling_level_iterations_total counter\n");
+  for (int s = 0; s < STAGES_NUMBER; s++)
+    fprintf(f, "md5_tunneling_level_iterations_total{level=\"%s\"} %llu\n", stage_names[s], (unsigned long long) itr[s]);
+
+  fprintf(f, "# HELP md5_tunneling_time_to_collision_seconds Wall time from the start of Block 1 to the collision.\n");
+  fprintf(f, "# TYPE md5_tunneling_time_to_collision_seconds histogram\n");
+  for (int i=0; i<TTC_BUCKETS; i++)
+    fprintf(f, "md5_tunneling_time_to_collision_seconds_bucket{le=\"%g\"} %llu\n", ttc_bounds[i], 
+            (unsigned long long) RELAXED_READ(ttc_bucket[i]));
+  fprintf(f, "md5_tunneling_time_to_collision_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long) RELAXED_READ(ttc_count));
+  __atomic_load(&ttc_sum, &sum, __ATOMIC_RELAXED);
+  fprintf(f, "md5_tunneling_time_to_collision_seconds_sum %f\n", sum);
+  fprintf(f, "md5_tunneling_time_to_collision_seconds_count %llu\n", (unsigned long long) RELAXED_READ(ttc_count));
+
+  fprintf(f, "# HELP md5_tunneling_kernel_info Tunnels of the kernels in use.\n");
+  fprintf(f, "# TYPE md5_tunneling_kernel_info gauge\n");
+  fprintf(f, "md5_tunneling_kernel_info{tunnels=\"%s\"} 1\n", n ? list : "none");
+
+  fprintf(f, "# HELP md5_tunneling_threads Search threads.\n");
+  fprintf(f, "# TYPE md5_tunneling_threads gauge\n");
+  fprintf(f, "md5_tunneling_threads %d\n", search_threads);
+
+  if (fclose(f) || rename(tmp_file, metrics_file))
+    return 1;
+
+  return 0;
+}
+
+
+//Monitor thread: reports the progress every progress_interval seconds and rewrites the metrics every 
+//METRICS_INTERVAL seconds, until monitor_stop is set.
+void * monitor_thread(void * arg) {
+
+  double start = now(), next_progress = start + progress_interval, next_metrics = start, t;
+
+  (void) arg;
+
+  while (!__atomic_load_n(&monitor_stop, __ATOMIC_ACQUIRE)) {
+
+    t = now();
+
+    if ( (progress_text || progress_json) && (t >= next_progress) ) {
+      report_progress(start, t);
+      next_progress += progress_interval;
+    }
+
+    if ( metrics_file && (t >= next_metrics) ) {
+      write_metrics();
+      next_metrics += METRICS_INTERVAL;
+    }
+
+    //Short sleeps, to stop soon when the search ends
+    usleep(50000);
+  }
+
+  return NULL;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                      AUTOTUNING                          //
+///////////////////////////////////////////////////////////////
+
+//Runs Block 1 (block = 1) or Block 2 (block = 2) with the tunnels t on the search threads for trial_time seconds. 
+//Returns the tail candidates per second, i.e. the candidates that satisfy every condition until Q[24] and enter the 
+//Q9 level: each of them has the same probability to give a near-collision, so this rate is proportional to the 
+//collisions found per hour. The stats of the calling thread are left with the counts of the trial alone, and 
+//trial_elapsed with its length: the threads stop a little after the deadline.
+double trial_elapsed;
+
+double tunnel_trial(int block, uint32_t t, double trial_time) {
+
+  uint32_t saved_tunnels = tunnels, saved_cv[8] = { A0, B0, C0, D0, A1, B1, C1, D1 };
+  double start, elapsed;
+
+  memset(&stats, 0, sizeof(stats));
+
+  tunnels = t;
+  start = now();
+  search_deadline = start + trial_time;
+
+  //A trial that finds a (near-)collision before the deadline simply starts again from the same chaining value
+  while (!search_expired()) {
+    A0 = saved_cv[0]; B0 = saved_cv[1]; C0 = saved_cv[2]; D0 = saved_cv[3];
+    A1 = saved_cv[4]; B1 = saved_cv[5]; C1 = saved_cv[6]; D1 = saved_cv[7];
+    parallel_search(block, search_threads, &stats);
+  }
+
+  elapsed = trial_elapsed = now() - start;
+  search_deadline = 0;
+  tunnels = saved_tunnels;
+  A0 = saved_cv[0]; B0 = saved_cv[1]; C0 = saved_cv[2]; D0 = saved_cv[3];
+  A1 = saved_cv[4]; B1 = saved_cv[5]; C1 = saved_cv[6]; D1 = saved_cv[7];
+
+  return stats.stage_itr[(block == 1) ? ST_B1_Q9 : ST_B2_Q9] / elapsed;
+}
+
+
+//Prints the tunnels in t as a list for --tunnels
+void print_tunnel_list(uint32_t t) {
+
+  int first = 1;
+
+  for (int i=0; i<TUNNELS_NUMBER; i++)
+    if (t & (1u << i)) {
+      printf("%s%s", first ? "" : ",", tunnel_names[i]);
+      first = 0;
+    }
+  if (first)
+    printf("none");
+}
+
+
+//Chooses the tunnels of Block 1 (block = 1) or Block 2 (block = 2) that give the most tail candidates per second on 
+//this machine. Starting from the tunnels in use, every trial switches on or off one tunnel of the block and the search 
+//moves to the best combination found, until no switch improves it. Every trial lasts trial_time seconds. 
+//The chosen tunnels are set in use and the iteration and pass rates of each level are printed for them.
+void autotune(int block, double trial_time) {
+
+  uint32_t block_mask = (block == 1) ? TUNNELS_B1 : TUNNELS_B2;
+  uint32_t best = tunnels, candidate, improved;
+  uint64_t best_itr[STAGES_NUMBER], best_pass[STAGES_NUMBER];
+  double score[1 << TUNNELS_NUMBER], best_elapsed;
+  int i;
+
+  for (i=0; i < (1 << TUNNELS_NUMBER); i++)
+    score[i] = -1;
+
+  printf("\nAutotuning block %d tunnels (%.1f sec per trial) ...\n", block, trial_time);
+
+  score[best] = tunnel_trial(block, best, trial_time);
+  best_elapsed = trial_elapsed;
+  memcpy(best_itr, stats.stage_itr, sizeof(best_itr));
+  memcpy(best_pass, stats.stage_pass, sizeof(best_pass));
+  printf("  %-20s : %12.0f tail candidates/sec\n", "tunnels in use", score[best]);
+
+  do {
+    improved = 0;
+
+    for (i=0; i<TUNNELS_NUMBER; i++) {
+
+      if ( !(block_mask & (1u << i)) )
+        continue;
+
+      candidate = best ^ (1u << i);
+      if (score[candidate] >= 0)
+        continue;
+
+      score[candidate] = tunnel_trial(block, candidate, trial_time);
+      printf("  %c %-18s : %12.0f tail candidates/sec\n", (candidate & (1u << i)) ? '+' : '-', tunnel_names[i], 
+             score[candidate]);
+
+      if (score[candidate] > score[best]) {
+        best = candidate;
+        improved = 1;
+        best_elapsed = trial_elapsed;
+        memcpy(best_itr, stats.stage_itr, sizeof(best_itr));
+        memcpy(best_pass, stats.stage_pass, sizeof(best_pass));
+      }
+    }
+  } while (improved);
+
+  tunnels = best;
+
+  //Iteration rate and pass rate of every level for the chosen tunnels, over the time their trial really took
+  printf("\n  %-18s %14s %12s\n", "Level", "Iterations/sec", "Pass rate");
+  for (i = (block == 1) ? ST_B1_OUTER : ST_B2_Q16; i <= ((block == 1) ? ST_B1_DIFF : ST_B2_DIFF); i++)
+    printf("  %-18s %14.0f %11.4g%%\n", stage_names[i], best_itr[i] / best_elapsed, 
+           best_itr[i] ? 100.0 * best_pass[i] / best_itr[i] : 0);
+
+  printf("\nBest tunnels found : --tunnels ");
+  print_tunnel_list(best);
+  printf("\n");
+
+  memset(&stats, 0, sizeof(stats));
+}
+
+
+
+///////////////////////////////////////////////////////////////
+///                       BENCHMARK                          //
+///////////////////////////////////////////////////////////////
+
+//Corpus of --bench: run i uses the seed i+1 and the IV bench_ivs[i % BENCH_IVS]
+#define BENCH_IVS 4
+const uint32_t bench_ivs[BENCH_IVS][4] = { { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 },
+                                           { 0xF0E1D2C3, 0xB4A59687, 0x78695A4B, 0x3C2D1E0F },
+                                           { 0x01234567, 0x89ABCDEF, 0xFEDCBA98, 0x76543210 },
+                                           { 0xD131DD02, 0xC5E6EEC4, 0x693D9A06, 0x98AFF95C } };
+
+//Bootstrap resamples for the confidence interval of the collisions per core-hour
+#define BENCH_RESAMPLES 2000
+
+//Times of a benchmark run, in seconds
+typedef struct { double b1_wall, b1_cpu, b2_wall, b2_cpu; } bench_run;
+
+
+int compare_double(const void * a, const void * b) {
+  return (*(const double *) a > *(const double *) b) - (*(const double *) a < *(const double *) b);
+}
+
+
+//Mean, median, 90th and 99th percentile (nearest rank) of the n values x, that are sorted
+void bench_summary(double * x, int n, double * summary) {
+
+  summary[0] = 0;
+  for (int i=0; i<n; i++)
+    summary[0] += x[i] / n;
+
+  qsort(x, n, sizeof(double), compare_double);
+  summary[1] = (n & 1) ? x[n/2] : (x[n/2 - 1] + x[n/2]) / 2;
+  summary[2] = x[(90 * n + 99) / 100 - 1];
+  summary[3] = x[(99 * n + 99) / 100 - 1];
+}
+
+
+//Collisions per core-hour of the n runs with the CPU times cpu, and its 95% confidence interval from the bootstrap
+void bench_rate(const double * cpu, int n, double * rate, double * low, double * high) {
+
+  double * resampled = malloc(BENCH_RESAMPLES * sizeof(double)), sum = 0;
+  uint32_t state = 0x9e3779b9;
+
+  for (int i=0; i<n; i++)
+    sum += cpu[i];
+  *rate = 3600.0 * n / sum;
+
+  //The resampling has its own generator, so that it doesn't change the searches
+  for (int r=0; r<BENCH_RESAMPLES; r++) {
+    sum = 0;
+    for (int i=0; i<n; i++) {
+      state = 1103515245 * state + 12345;
+      sum += cpu[(state >> 8) % n];
+    }
+    resampled[r] = 3600.0 * n / sum;
+  }
+
+  qsort(resampled, BENCH_RESAMPLES, sizeof(double), compare_double);
+  *low = resampled[BENCH_RESAMPLES / 40];
+  *high = resampled[BENCH_RESAMPLES - 1 - BENCH_RESAMPLES / 40];
+
+  free(resampled);
+}
+
+
+//Returns the number that follows "key": in the JSON file f, or -1 if it isn't there
+double json_number(FILE * f, const char * key) {
+
+  char line[512], pattern[64], * p;
+
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  rewind(f);
+
+  while (fgets(line, sizeof(line), f) != NULL)
+    if ( (p = strstr(line, pattern)) != NULL )
+      return strtod(p + strlen(pattern), NULL);
+
+  return -1;
+}
+
+
+//Does the work of benchmark() in the arrays runs, x and cpu of n entries, that it allocates and frees
+int bench_measure(int n, const char * json_file, const char * baseline_file, bench_run * runs, double * x, double * cpu) {
+
+  const char * names[4] = { "b1_wall", "b2_wall", "wall", "cpu" };
+  double summary[4][4], rate, low, high, base_rate, base_low, base_high;
+  FILE * f;
+
+  printf("\nBenchmark of %d runs\n", n);
+
+  for (int i=0; i<n; i++) {
+
+    X = i + 1;
+    IV1 = bench_ivs[i % BENCH_IVS][0]; IV2 = bench_ivs[i % BENCH_IVS][1];
+    IV3 = bench_ivs[i % BENCH_IVS][2]; IV4 = bench_ivs[i % BENCH_IVS][3];
+
+    Timer();
+    if (parallel_search(1, search_threads, NULL) == -1)
+      return 1;
+    runs[i].b1_wall = Timer();
+    runs[i].b1_cpu = timer_cpu;
+
+    Timer();
+    if (parallel_search(2, search_threads, NULL) == -1)
+      return 1;
+    runs[i].b2_wall = Timer();
+    runs[i].b2_cpu = timer_cpu;
+
+    printf("  run %3d  seed 0x%08X  IV %08X...  block 1 %9.3f sec  block 2 %7.3f sec\n", i, i + 1, IV1, 
+           runs[i].b1_wall, runs[i].b2_wall);
+  }
+
+  //Summaries of wall times of block 1, block 2, both, and of CPU time of both
+  for (int k=0; k<4; k++) {
+    for (int i=0; i<n; i++)
+      x[i] = (k == 0) ? runs[i].b1_wall : (k == 1) ? runs[i].b2_wall : 
+             (k == 2) ? runs[i].b1_wall + runs[i].b2_wall : runs[i].b1_cpu + runs[i].b2_cpu;
+    bench_summary(x, n, summary[k]);
+  }
+
+  for (int i=0; i<n; i++)
+    cpu[i] = runs[i].b1_cpu + runs[i].b2_cpu;
+  bench_rate(cpu, n, &rate, &low, &high);
+
+  printf("\n%-8s %10s %10s %10s %10s\n", "sec", "mean", "median", "p90", "p99");
+  for (int k=0; k<4; k++)
+    printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", names[k], summary[k][0], summary[k][1], summary[k][2], summary[k][3]);
+  printf("\nCollisions per core-hour: %.1f (95%% CI %.1f - %.1f)\n", rate, low, high);
+
+  f = fopen(json_file, "w");
+  if (f == NULL)
+    return 1;
+
+  fprintf(f, "{\n  \"runs\": %d,\n  \"tunnels\": %u,\n", n, tunnels);
+  for (int k=0; k<4; k++)
+    fprintf(f, "  \"%s\": { \"mean\": %.6f, \"median\": %.6f, \"p90\": %.6f, \"p99\": %.6f },\n", names[k], 
+            summary[k][0], summary[k][1], summary[k][2], summary[k][3]);
+  fprintf(f, "  \"collisions_per_core_hour\": %.3f,\n  \"ci_low\": %.3f,\n  \"ci_high\": %.3f,\n", rate, low, high);
+  fprintf(f, "  \"times\": [\n");
+  for (int i=0; i<n; i++)
+    fprintf(f, "    { \"seed\": \"0x%08X\", \"iv\": \"%08X,%08X,%08X,%08X\", \"b1_wall\": %.6f, \"b1_cpu\": %.6f, "
+               "\"b2_wall\": %.6f, \"b2_cpu\": %.6f }%s\n", i + 1, bench_ivs[i % BENCH_IVS][0], bench_ivs[i % BENCH_IVS][1], 
+            bench_ivs[i % BENCH_IVS][2], bench_ivs[i % BENCH_IVS][3], runs[i].b1_wall, runs[i].b1_cpu, runs[i].b2_wall, 
+            runs[i].b2_cpu, (i == n - 1) ? "" : ",");
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+
+  printf("Benchmark written to %s\n", json_file);
+
+  if (baseline_file != NULL) {
+
+    f = fopen(baseline_file, "r");
+    if (f == NULL)
+      return 1;
+    base_rate = json_number(f, "collisions_per_core_hour");
+    base_low = json_number(f, "ci_low");
+    base_high = json_number(f, "ci_high");
+    fclose(f);
+
+    if (base_rate <= 0)
+      return 1;
+
+    printf("\nBaseline %s: %.1f collisions per core-hour (95%% CI %.1f - %.1f)\n", baseline_file, base_rate, 
+           base_low, base_high);
+    printf("Change: %+.1f%%, %s\n", 100.0 * (rate / base_rate - 1), 
+           (low > base_high) ? "faster (the intervals don't overlap)" : 
+           (high < base_low) ? "slower (the intervals don't overlap)" : "not significant (the intervals overlap)");
+  }
+
+  return 0;
+}
+
+
+//Runs the collision search on the first n entries of the corpus and writes times, their summary and the collisions 
+//per core-hour in json_file. If baseline_file is given (a json_file of a previous benchmark), compares the two.
+//Returns 1 if a search fails or a file can't be written or read.
+int benchmark(int n, const char * json_file, const char * baseline_file) {
+
+  bench_run * runs = malloc(n * sizeof(bench_run));
+  double * x = malloc(n * sizeof(double)), * cpu = malloc(n * sizeof(double));
+  int failed = bench_measure(n, json_file, baseline_file, runs, x, cpu);
+
+  free(runs);
+  free(x);
+  free(cpu);
+
+  return failed;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                   PREFIX AND SUFFIX                      //
+///////////////////////////////////////////////////////////////
+
+//Bytes read at a time from the files that can't be mapped in memory, and copied at a time to the messages
+#define STREAM_CHUNK (1 << 20)
+
+//MD5 of a stream of bytes: the chaining value, the number of bytes hashed and the bytes of the last incomplete block
+typedef struct {
+  uint32_t state[4];
+  uint64_t length;
+  uint8_t buffer[64];
+} md5_stream;
+
+
+//Starts a stream from the chaining value A,B,C,D
+void md5_init(md5_stream * m, uint32_t A, uint32_t B, uint32_t C, uint32_t D) {
+
+  m->state[0] = A;  m->state[1] = B;
+  m->state[2] = C;  m->state[3] = D;
+  m->length = 0;
+}
+
+
+//Compresses a 64 bytes block into the chaining value state. Its words are local: the sinks call it from the search
+//threads, whose a,b,c,d and Hx hold the block being searched.
+static inline void md5_compress(uint32_t * state, const uint8_t * block) {
+
+  uint32_t x[16], aa = state[0], bb = state[1], cc = state[2], dd = state[3];
+
+  memcpy(x, block, 64);
+
+  MD5_STEPS(aa, bb, cc, dd, x);
+
+  state[0] += aa;  state[1] += bb;
+  state[2] += cc;  state[3] += dd;
+}
+
+
+//Adds n bytes of data to the stream. Whole blocks are compressed where they are, without copies.
+void md5_update(md5_stream * m, const uint8_t * data, size_t n) {
+
+  size_t used = m->length % 64, k;
+
+  m->length += n;
+
+  if (used) {
+    k = (n < 64 - used) ? n : 64 - used;
+    memcpy(m->buffer + used, data, k);
+    data += k;
+    n -= k;
+    if (used + k < 64)
+      return;
+    md5_compress(m->state, m->buffer);
+  }
+
+  for ( ; n >= 64; n -= 64, data += 64)
+    md5_compress(m->state, data);
+
+  memcpy(m->buffer, data, n);
+}
+
+
+//Pads the stream with zeros to a multiple of 64 bytes, so that its chaining value can be used as IV
+void md5_pad_zero(md5_stream * m) {
+
+  static const uint8_t zero[64];
+
+  if (m->length % 64)
+    md5_update(m, zero, 64 - m->length % 64);
+}
+
+
+//Ends the stream with the MD5 padding (0x80, zeros and the length in bits): state is then the hash
+void md5_finish(md5_stream * m) {
+
+  uint8_t pad[72] = { 0x80 };
+  uint64_t bits = m->length * 8;
+  size_t n = (m->length % 64 < 56) ? 56 - m->length % 64 : 120 - m->length % 64;
+
+  for (int i=0; i<8; i++)
+    pad[n + i] = (uint8_t) (bits >> (8 * i));
+
+  md5_update(m, pad, n + 8);
+}
+
+
+//Adds the content of the file fname to the stream. Regular files are mapped in memory, the others (e.g. pipes) are 
+//read STREAM_CHUNK bytes at a time. Returns 1 if the file can't be read.
+int md5_file(md5_stream * m, const char * fname) {
+
+  uint8_t * buffer;
+  size_t n;
+  FILE * f;
+
+#ifdef __linux__
+  struct stat st;
+  uint8_t * map;
+  int fd = open(fname, O_RDONLY);
+
+  if (fd < 0)
+    return 1;
+
+  if ( (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) ) {
+
+    if (st.st_size == 0) {
+      close(fd);
+      return 0;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      md5_update(m, map, st.st_size);
+      munmap(map, st.st_size);
+      close(fd);
+      return 0;
+    }
+  }
+
+  close(fd);
+#endif
+
+  f = fopen(fname, "rb");
+  if (f == NULL)
+    return 1;
+
+  buffer = malloc(STREAM_CHUNK);
+  while ( (n = fread(buffer, 1, STREAM_CHUNK, f)) > 0 )
+    md5_update(m, buffer, n);
+
+  n = ferror(f);
+  free(buffer);
+  fclose(f);
+
+  return n ? 1 : 0;
+}
+
+
+//Copies the file fname to out, followed by zeros up to a multiple of 64 bytes if pad is set. Returns the number of 
+//bytes written, padding included, or -1 if it fails.
+int64_t copy_file(FILE * out, const char * fname, int pad) {
+
+  uint8_t * buffer = malloc(STREAM_CHUNK);
+  uint64_t length = 0;
+  size_t n;
+  FILE * f = fopen(fname, "rb");
+  int failed = 0;
+
+  if (f == NULL) {
+    free(buffer);
+    return -1;
+  }
+
+  while ( !failed && (n = fread(buffer, 1, STREAM_CHUNK, f)) > 0 ) {
+    failed = (fwrite(buffer, 1, n, out) != n);
+    length += n;
+  }
+  failed |= ferror(f);
+  fclose(f);
+
+  if (pad && (length % 64)) {
+    memset(buffer, 0, 64);
+    failed |= (fwrite(buffer, 1, 64 - length % 64, out) != 64 - length % 64);
+    length += 64 - length % 64;
+  }
+
+  free(buffer);
+  return failed ? -1 : (int64_t) length;
+}
+
+
+//Appends to the summary fname the messages m0, m1 as C arrays, the files around them, the times of both blocks and 
+//(if PRINT_FINAL_HASH_IN_SUMMARY) the colliding hash. Returns 1 if it can't be written.
+int write_summary(const char * fname, const uint8_t * m0, const uint8_t * m1, const char * prefix, const char * suffix,
+                  double b1_time, double b2_time, const uint32_t * hash) {
+
+  const uint8_t * p;
+  FILE * f = fopen(fname, "a");
+
+  if (f == NULL)
+    return 1;
+
+  //Print message 1 bytes in summary file
+  fprintf(f, "\nunsigned char m0[128] = {\n");
+  for ( int i=0; i<128; i++ ) {  
+    
+    if ( (i != 0) && ((i % 16) == 0) ) 
+      fprintf( f, "\n" );
+    
+    fprintf(f,"0x%02X", m0[i] );
+    
+    if ( i != 127 ) 
+      fprintf( f, "," );
+    else 
+      fprintf( f, "\n};\n" );
+  } 
+
+  //Print message 2 bytes in summary file
+  fprintf(f, "\nunsigned char m1[128] = {\n");
+  for ( int i=0; i<128; i++ ) {  
+    
+    if ( (i != 0) && ((i % 16) == 0) ) 
+      fprintf( f, "\n" );
+    
+    fprintf(f,"0x%02X", m1[i] );
+    
+    if ( i != 127 ) 
+      fprintf( f, "," );
+    else 
+      fprintf( f, "\n};\n\n" );
+  } 
+
+  //Print the files around the blocks in summary
+  if (prefix != NULL)
+    fprintf(f,"/* Prefix (padded with zeros to a multiple of 64 bytes) : %s */\n", prefix);
+  if (suffix != NULL)
+    fprintf(f,"/* Suffix : %s */\n", suffix);
+
+  //Print times in summary
+  fprintf(f,"/* First collision block took  : %f sec */\n", b1_time);
+  fprintf(f,"/* Second collision block took : %f sec */\n", b2_time);
+
+  if (PRINT_FINAL_HASH_IN_SUMMARY) {
+    
+    fprintf(f, "/* Colliding hash: ");
+    p = (const uint8_t *) hash;
+    for (int i=0; i<16; i++)
+      fprintf(f, "%02x", p[i]);
+    fprintf(f, " */\n");
+
+  }
+
+  return fclose(f) != 0;
+}
+
+
+//Writes to disk a message: the prefix file padded with zeros to a multiple of 64 bytes, the 128 bytes of block and the
+//suffix file. prefix and suffix can be NULL. length is the length of the message that was hashed: a file that changed
+//since is a write error. Returns 0 if ok, 1 if cannot open, 2 if write error
+int write_message(char * fname, const char * prefix, void * block, const char * suffix, uint64_t length) {
+
+  FILE * f;
+  int64_t n, written = 128;
+  int failed = 0;
+
+  f = fopen(fname, "wb");
+  if (f == NULL) 
+    return 1;
+
+  if (prefix != NULL) {
+    n = copy_file(f, prefix, 1);
+    failed |= (n < 0);
+    written += n;
+  }
+  failed |= (fwrite(block, 1, 128, f) != 128);
+  if (suffix != NULL) {
+    n = copy_file(f, suffix, 0);
+    failed |= (n < 0);
+    written += n;
+  }
+  failed |= fclose(f);
+
+  return ( failed || ((uint64_t) written != length) ) ? 2 : 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                    MULTICOLLISIONS                       //
+///////////////////////////////////////////////////////////////
+
+//Maximum number of chained collisions of --chain: the files are numbered with 64 bits
+#define MAX_CHAIN 64
+
+//Largest chain whose files --chain-files writes with "all": longer chains need a range FIRST-LAST
+#define CHAIN_FILES_ALL 20
+
+//Writes the bytes of the MD5 value A,B,C,D in hex to f
+void fprint_hash(FILE * f, uint32_t A, uint32_t B, uint32_t C, uint32_t D) {
+
+  const uint32_t h[4] = { A, B, C, D };
+  const uint8_t * p = (const uint8_t *) h;
+
+  for (int i=0; i<16; i++)
+    fprintf(f, "%02x", p[i]);
+}
+
+
+//Creates the description of a chain of k collisions (Joux multicollision): after this header, chain_add() appends the
+//pairs of blocks as they are found and chain_close() the common hash. Returns NULL if it can't be written.
+FILE * chain_open(const char * fname, int k, uint32_t seed, const char * prefix, const char * suffix) {
+
+  FILE * f = fopen(fname, "w");
+
+  if (f == NULL)
+    return NULL;
+
+  fprintf(f, "# md5-tunneling multicollision. File b is: prefix, zeros to a multiple of 64 bytes, for every pair i\n");
+  fprintf(f, "# the first (bit i of b = 0) or second (bit i of b = 1) 128 bytes block, suffix. All have the same MD5.\n");
+  fprintf(f, "chain %d\nseed %08X\n", k, seed);
+  fprintf(f, "iv %08X %08X %08X %08X\n", IV1, IV2, IV3, IV4);
+  fprintf(f, "prefix %s\nsuffix %s\n", prefix ? prefix : "-", suffix ? suffix : "-");
+  fflush(f);
+
+  return f;
+}
+
+
+//Appends the pair i of colliding blocks m0, m1 to the chain description f
+void chain_add(FILE * f, int i, const uint8_t * m0, const uint8_t * m1) {
+
+  fprintf(f, "pair %d ", i);
+  for (int j=0; j<128; j++)
+    fprintf(f, "%02x", m0[j]);
+  fprintf(f, " ");
+  for (int j=0; j<128; j++)
+    fprintf(f, "%02x", m1[j]);
+  fprintf(f, "\n");
+
+  //A description interrupted later still has the pairs found so far
+  fflush(f);
+}
+
+
+//Ends the chain description f with the common hash A,B,C,D of the files. Returns 1 if the file can't be written.
+int chain_close(FILE * f, uint32_t A, uint32_t B, uint32_t C, uint32_t D) {
+
+  fprintf(f, "hash ");
+  fprint_hash(f, A, B, C, D);
+  fprintf(f, "\n");
+
+  return fclose(f) != 0;
+}
+
+
+//Reads 128 bytes in hex from str into block. Returns 1 if they aren't there.
+int read_hex_block(const char * str, uint8_t * block) {
+
+  unsigned int byte;
+
+  for (int j=0; j<128; j++) {
+    if (sscanf(str + 2 * j, "%2x", &byte) != 1)
+      return 1;
+    block[j] = byte;
+  }
+
+  return 0;
+}
+
+
+//Reads which, a decimal number N or range FIRST-LAST, into first and last (both N for a number). Returns 1 if which
+//is anything else, e.g. empty, not decimal or followed by other characters.
+int parse_range(const char * which, uint64_t * first, uint64_t * last) {
+
+  char * end;
+
+  if (!isdigit((unsigned char) which[0]))
+    return 1;
+  *first = *last = strtoull(which, &end, 10);
+
+  if (*end == '-') {
+    if (!isdigit((unsigned char) end[1]))
+      return 1;
+    *last = strtoull(end + 1, &end, 10);
+  }
+
+  return *end != 0;
+}
+
+
+//Writes the files of the chain description fname: the file number which, the files FIRST-LAST, or all the 2^k files
+//if which is "all" (up to k = CHAIN_FILES_ALL). Every file is streamed from the prefix, the pairs and the suffix, so 
+//none is built in memory. Returns 1 if the description or a file can't be read or written.
+int chain_files(const char * fname, const char * which) {
+
+  char line[4096], prefix[4096] = "", suffix[4096] = "", out[64];
+  uint8_t (* pairs)[2][128] = malloc(MAX_CHAIN * sizeof(* pairs));
+  uint64_t first, last, written = 0;
+  uint32_t seed = 0;
+  int k = 0, n = 0, i, failed;
+  FILE * f, * g;
+
+  f = fopen(fname, "r");
+  if (f == NULL) {
+    free(pairs);
+    return 1;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+
+    line[strcspn(line, "\n")] = 0;
+
+    if (sscanf(line, "chain %d", &k) == 1)
+      continue;
+    if (sscanf(line, "seed %x", &seed) == 1)
+      continue;
+    if (strncmp(line, "prefix ", 7) == 0)
+      strcpy(prefix, strcmp(line + 7, "-") ? line + 7 : "");
+    else if (strncmp(line, "suffix ", 7) == 0)
+      strcpy(suffix, strcmp(line + 7, "-") ? line + 7 : "");
+    else if ( (sscanf(line, "pair %d", &i) == 1) && (i == n) && (n < MAX_CHAIN) ) {
+      char * p = strchr(line + 5, ' ');
+      if ( (p == NULL) || (strlen(p) != 514) || read_hex_block(p + 1, pairs[n][0]) || read_hex_block(p + 258, pairs[n][1]) )
+        break;
+      n++;
+    }
+  }
+  fclose(f);
+
+  if ( (k <= 0) || (k > MAX_CHAIN) || (n != k) ) {
+    printf("%s has %d of %d pairs\n", fname, n, k);
+    free(pairs);
+    return 1;
+  }
+
+  if (strcmp(which, "all") == 0) {
+    if (k > CHAIN_FILES_ALL) {
+      printf("%s has 2^%d files: give a range FIRST-LAST instead of all\n", fname, k);
+      free(pairs);
+      return 1;
+    }
+    first = 0;
+    last = (1ull << k) - 1;
+  }
+  else {
+    if (parse_range(which, &first, &last)) {
+      printf("Wrong file number %s: give N, FIRST-LAST or all\n", which);
+      free(pairs);
+      return 1;
+    }
+    if ( (last < first) || ((k < 64) && (last >> k)) ) {
+      printf("%s has only the files 0 to 2^%d - 1\n", fname, k);
+      free(pairs);
+      return 1;
+    }
+  }
+
+  for (uint64_t b = first; ; b++) {
+
+    snprintf(out, sizeof(out), "chain_md5_%08X_%llu.bin", seed, (unsigned long long) b);
+    g = fopen(out, "wb");
+    if (g == NULL) {
+      free(pairs);
+      return 1;
+    }
+
+    failed = prefix[0] && (copy_file(g, prefix, 1) < 0);
+    for (i=0; i<k; i++)
+      failed |= (fwrite(pairs[i][(b >> i) & 1], 1, 128, g) != 128);
+    failed |= suffix[0] && (copy_file(g, suffix, 0) < 0);
+    failed |= fclose(g);
+    if (failed) {
+      printf("Can't write %s\n", out);
+      free(pairs);
+      return 1;
+    }
+
+    written++;
+    if (b == last)
+      break;
+  }
+
+  printf("Written %llu file(s) chain_md5_%08X_*.bin\n", (unsigned long long) written, seed);
+  free(pairs);
+  return 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                        ARCHIVE                           //
+///////////////////////////////////////////////////////////////
+
+//Records waiting for the writer of the archive are written when they are ARCHIVE_BATCH, or ARCHIVE_DELAY seconds 
+//after the first of them
+#define ARCHIVE_BATCH 4096
+#define ARCHIVE_DELAY 1.0
+
+//Header of the archive and of its index, at the start of the files
+#define ARCHIVE_MAGIC "MD5TARC1"
+#define INDEX_MAGIC   "MD5TIDX1"
+
+//Record of a collision in the archive: the seed and IV of the search, the 64 bytes blocks of the padded prefix, the 
+//MD5 of the messages (prefix, padding and blocks, without the suffix), the times of both blocks and the two messages.
+//Record i is at 16 + 304 * i.
+typedef struct {
+  uint32_t seed, prefix_blocks;
+  uint32_t iv[4], hash[4];
+  float b1_time, b2_time;
+  uint8_t m0[128], m1[128];
+} archive_record;
+
+//Header of the archive: the magic and the size of the records
+typedef struct {
+  char magic[8];
+  uint32_t record_size, reserved;
+} archive_header;
+
+//Key of the index: the records are sorted by IV, then by hash
+typedef struct {
+  uint32_t iv[4], hash[4];
+  uint64_t record;
+} archive_key;
+
+//Header of the index: the magic and the number of keys, that follow
+typedef struct {
+  char magic[8];
+  uint64_t count;
+} index_header;
+
+//Archive open with --archive: the records waiting for the writer thread (and the ones it is writing), the bytes 
+//before the colliding blocks (the padded prefix), how many records were written and whether a write failed
+struct {
+  int fd;
+  archive_record * batch, * spare;
+  int n, batch_size, spare_size, stop, failed;
+  uint64_t prefix, written;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+} archive = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER };
+
+
+//Writer thread of the archive: writes the records in batches, so the threads that find collisions never wait for I/O
+void * archive_writer(void * arg) {
+
+  archive_record * batch;
+  struct timespec t;
+  int n, size;
+
+  (void) arg;
+
+  pthread_mutex_lock(&archive.lock);
+
+  for ( ; ; ) {
+
+    while ( (archive.n == 0) && !archive.stop )
+      pthread_cond_wait(&archive.ready, &archive.lock);
+
+    //The first record waits for others for at most ARCHIVE_DELAY seconds
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += (time_t) ARCHIVE_DELAY;
+    while ( (archive.n < ARCHIVE_BATCH) && !archive.stop )
+      if (pthread_cond_timedwait(&archive.ready, &archive.lock, &t))
+        break;
+
+    if (archive.n == 0)
+      break;
+
+    //Each buffer keeps its own size: the batch may have grown while the spare was written
+    batch = archive.batch;
+    n = archive.n;
+    archive.batch = archive.spare;
+    archive.spare = batch;
+    size = archive.batch_size;
+    archive.batch_size = archive.spare_size;
+    archive.spare_size = size;
+    archive.n = 0;
+    pthread_mutex_unlock(&archive.lock);
+
+    if (write(archive.fd, batch, n * sizeof(archive_record)) != (ssize_t) (n * sizeof(archive_record)))
+      archive.failed = 1;
+
+    pthread_mutex_lock(&archive.lock);
+    archive.written += n;
+  }
+
+  pthread_mutex_unlock(&archive.lock);
+  return NULL;
+}
+
+
+//Opens the archive fname to append records, and starts its writer. prefix is the number of bytes before the blocks.
+//Returns 1 if it can't be written or is not an archive.
+int archive_open(const char * fname, uint64_t prefix) {
+
+  archive_header h = { ARCHIVE_MAGIC, sizeof(archive_record), 0 };
+  archive_header old;
+  struct stat st;
+
+  archive.fd = open(fname, O_RDWR | O_APPEND | O_CREAT, 0644);
+  if ( (archive.fd < 0) || fstat(archive.fd, &st) )
+    return 1;
+
+  //A new archive gets the header, an old one must have it (and whole records: an interrupted write is cut)
+  if (st.st_size == 0) {
+    if (write(archive.fd, &h, sizeof(h)) != sizeof(h))
+      return 1;
+  }
+  else {
+    if ( (pread(archive.fd, &old, sizeof(old), 0) != sizeof(old)) || memcmp(&old, &h, sizeof(h)) )
+      return 1;
+    if ( (st.st_size - sizeof(h)) % sizeof(archive_record) )
+      if (ftruncate(archive.fd, st.st_size - (st.st_size - sizeof(h)) % sizeof(archive_record)))
+        return 1;
+  }
+
+  archive.batch_size = archive.spare_size = ARCHIVE_BATCH;
+  archive.batch = malloc(archive.batch_size * sizeof(archive_record));
+  archive.spare = malloc(archive.spare_size * sizeof(archive_record));
+  archive.n = archive.stop = archive.failed = 0;
+  archive.written = 0;
+  archive.prefix = prefix;
+
+  return pthread_create(&archive.writer, NULL, archive_writer, NULL) != 0;
+}
+
+
+//Adds to the archive the collision m0, m1 found with seed from the IV iv, that leaves the chaining value cv.
+//The record only is copied here: the writer thread writes it later.
+void archive_add(uint32_t seed, const uint32_t * iv, const uint32_t * cv, const uint8_t * m0, const uint8_t * m1,
+                 double b1_time, double b2_time) {
+
+  archive_record r;
+  md5_stream m;
+
+  memset(&r, 0, sizeof(r));
+  r.seed = seed;
+  r.prefix_blocks = archive.prefix / 64;
+  memcpy(r.iv, iv, sizeof(r.iv));
+  memcpy(r.m0, m0, 128);
+  memcpy(r.m1, m1, 128);
+  r.b1_time = b1_time;
+  r.b2_time = b2_time;
+
+  //The MD5 of the messages goes on from the chaining value after the blocks
+  md5_init(&m, cv[0], cv[1], cv[2], cv[3]);
+  m.length = archive.prefix + 128;
+  md5_finish(&m);
+  memcpy(r.hash, m.state, sizeof(r.hash));
+
+  pthread_mutex_lock(&archive.lock);
+  if (archive.n == archive.batch_size) {
+    archive.batch_size *= 2;
+    archive.batch = realloc(archive.batch, archive.batch_size * sizeof(archive_record));
+  }
+  archive.batch[archive.n++] = r;
+  pthread_cond_signal(&archive.ready);
+  pthread_mutex_unlock(&archive.lock);
+}
+
+
+//Writes the records left, and closes the archive. Returns 1 if a record couldn't be written.
+int archive_close() {
+
+  pthread_mutex_lock(&archive.lock);
+  archive.stop = 1;
+  pthread_cond_signal(&archive.ready);
+  pthread_mutex_unlock(&archive.lock);
+
+  pthread_join(archive.writer, NULL);
+
+  archive.failed |= (fsync(archive.fd) != 0);
+  archive.failed |= (close(archive.fd) != 0);
+  archive.fd = -1;
+  free(archive.batch);
+  free(archive.spare);
+
+  return archive.failed;
+}
+
+
+//Maps the archive fname in memory. Returns its records and their number in n, or NULL if it isn't an archive.
+archive_record * archive_map(const char * fname, uint64_t * n, void ** map, size_t * size) {
+
+  archive_header h = { ARCHIVE_MAGIC, sizeof(archive_record), 0 };
+  struct stat st;
+  int fd = open(fname, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+
+  if ( fstat(fd, &st) || ((size_t) st.st_size < sizeof(h)) ) {
+    close(fd);
+    return NULL;
+  }
+
+  *size = st.st_size;
+  *map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if ( (*map == MAP_FAILED) || memcmp(*map, &h, sizeof(h)) ) {
+    if (*map != MAP_FAILED)
+      munmap(*map, *size);
+    return NULL;
+  }
+
+  madvise(*map, *size, MADV_SEQUENTIAL);
+  *n = (*size - sizeof(h)) / sizeof(archive_record);
+  return (archive_record *) ((uint8_t *) *map + sizeof(h));
+}
+
+
+//Orders 32 bit words increasingly, for qsort()
+int compare_uint32(const void * a, const void * b) {
+  return (*(const uint32_t *) a > *(const uint32_t *) b) - (*(const uint32_t *) a < *(const uint32_t *) b);
+}
+
+
+//Orders the keys of the index by IV, then by hash
+int compare_key(const void * a, const void * b) {
+
+  const archive_key * x = a, * y = b;
+
+  for (int i=0; i<4; i++)
+    if (x->iv[i] != y->iv[i])
+      return (x->iv[i] < y->iv[i]) ? -1 : 1;
+
+  for (int i=0; i<4; i++)
+    if (x->hash[i] != y->hash[i])
+      return (x->hash[i] < y->hash[i]) ? -1 : 1;
+
+  return (x->record < y->record) ? -1 : (x->record > y->record);
+}
+
+
+//Writes the index of the archive fname to fname.idx: its header and the keys of all the records, sorted.
+//Returns 1 if the archive can't be read or the index written.
+int archive_index(const char * fname) {
+
+  index_header h = { INDEX_MAGIC, 0 };
+  archive_record * r;
+  archive_key * keys;
+  char idx[4096];
+  void * map;
+  size_t size;
+  FILE * f;
+  int failed;
+
+  r = archive_map(fname, &h.count, &map, &size);
+  if (r == NULL)
+    return 1;
+
+  keys = malloc((h.count ? h.count : 1) * sizeof(archive_key));
+  for (uint64_t i=0; i<h.count; i++) {
+    memcpy(keys[i].iv, r[i].iv, sizeof(keys[i].iv));
+    memcpy(keys[i].hash, r[i].hash, sizeof(keys[i].hash));
+    keys[i].record = i;
+  }
+  munmap(map, size);
+
+  qsort(keys, h.count, sizeof(archive_key), compare_key);
+
+  snprintf(idx, sizeof(idx), "%s.idx", fname);
+  f = fopen(idx, "wb");
+  if (f == NULL) {
+    free(keys);
+    return 1;
+  }
+
+  failed = (fwrite(&h, sizeof(h), 1, f) != 1);
+  failed |= (fwrite(keys, sizeof(archive_key), h.count, f) != h.count);
+  failed |= (fclose(f) != 0);
+  free(keys);
+
+  printf("Indexed %llu records of %s in %s\n", (unsigned long long) h.count, fname, idx);
+  return failed;
+}
+
+
+//Prints the records of the archive fname with the IV iv (and the hash, if not NULL), found in the index fname.idx
+//mapped in memory. Returns 1 if the archive or its index can't be read.
+int archive_find(const char * fname, const uint32_t * iv, const uint32_t * hash) {
+
+  archive_record * r;
+  archive_key * keys, key;
+  const index_header * h;
+  char idx[4096];
+  void * map, * idx_map;
+  size_t size, idx_size;
+  uint64_t n, lo, hi, found = 0;
+  struct stat st;
+  int fd;
+
+  snprintf(idx, sizeof(idx), "%s.idx", fname);
+  fd = open(idx, O_RDONLY);
+  if ( (fd < 0) || fstat(fd, &st) || ((size_t) st.st_size < sizeof(index_header)) ) {
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+
+  idx_size = st.st_size;
+  idx_map = mmap(NULL, idx_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (idx_map == MAP_FAILED)
+    return 1;
+
+  h = idx_map;
+  keys = (archive_key *) (h + 1);
+  r = archive_map(fname, &n, &map, &size);
+  if ( (r == NULL) || memcmp(h->magic, INDEX_MAGIC, 8) || (sizeof(index_header) + h->count * sizeof(archive_key) > idx_size) ) {
+    if (r != NULL)
+      munmap(map, size);
+    munmap(idx_map, idx_size);
+    return 1;
+  }
+
+  //Binary search of the first key not smaller than iv, hash (or iv and the smallest hash)
+  memcpy(key.iv, iv, sizeof(key.iv));
+  memset(key.hash, 0, sizeof(key.hash));
+  if (hash != NULL)
+    memcpy(key.hash, hash, sizeof(key.hash));
+  key.record = 0;
+
+  for (lo = 0, hi = h->count; lo < hi; ) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (compare_key(&keys[mid], &key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for ( ; (lo < h->count) && (memcmp(keys[lo].iv, iv, sizeof(key.iv)) == 0); lo++) {
+
+    if ( (hash != NULL) && memcmp(keys[lo].hash, hash, sizeof(key.hash)) )
+      break;
+    if (keys[lo].record >= n)
+      continue;
+
+    printf("record %llu seed %08X hash ", (unsigned long long) keys[lo].record, r[keys[lo].record].seed);
+    fprint_hash(stdout, r[keys[lo].record].hash[0], r[keys[lo].record].hash[1], r[keys[lo].record].hash[2], 
+                r[keys[lo].record].hash[3]);
+    printf("\n");
+    found++;
+  }
+
+  printf("%llu record(s) found\n", (unsigned long long) found);
+
+  munmap(map, size);
+  munmap(idx_map, idx_size);
+  return 0;
+}
+
+
+//Writes the records which ("all", N or FIRST-LAST) of the archive fname in the layout of the single collisions: the
+//summary collision_md5_SEED.txt and the messages collision1/2_md5_SEED.bin, between prefix and suffix. The blocks
+//only collide after the prefix they were found with, so a record is skipped unless prefix (from the IV in use) gives
+//its IV and length; without prefix only the records found without one are written. Records that share their seed 
+//with others get _RECORD after the seed. Returns 1 if the archive can't be read, a file written or a record skipped.
+int archive_export(const char * fname, const char * which, const char * prefix, const char * suffix) {
+
+  archive_record * r;
+  uint32_t * seeds, prefix_iv[4] = { IV1, IV2, IV3, IV4 };
+  uint64_t n, first = 0, last, i, prefix_blocks = 0, skipped = 0, length;
+  char name[3][64], tag[32];
+  md5_stream m;
+  void * map;
+  size_t size;
+  int failed = 0;
+
+  if (prefix != NULL) {
+    md5_init(&m, IV1, IV2, IV3, IV4);
+    if (md5_file(&m, prefix)) {
+      printf("Can't read the prefix %s\n", prefix);
+      return 1;
+    }
+    md5_pad_zero(&m);
+    prefix_blocks = m.length / 64;
+    memcpy(prefix_iv, m.state, sizeof(prefix_iv));
+  }
+
+  r = archive_map(fname, &n, &map, &size);
+  if (r == NULL)
+    return 1;
+
+  last = n ? n - 1 : 0;
+  if ( strcmp(which, "all") && parse_range(which, &first, &last) ) {
+    printf("Wrong record number %s: give N, FIRST-LAST or all\n", which);
+    munmap(map, size);
+    return 1;
+  }
+
+  if ( (n == 0) || (first > last) || (last >= n) ) {
+    printf("%s has %llu records\n", fname, (unsigned long long) n);
+    munmap(map, size);
+    return 1;
+  }
+
+  //The seeds are sorted to find the ones used by more than one record
+  seeds = malloc(n * sizeof(uint32_t));
+  for (i=0; i<n; i++)
+    seeds[i] = r[i].seed;
+  qsort(seeds, n, sizeof(uint32_t), compare_uint32);
+
+  for (i=first; (i <= last) && !failed; i++) {
+
+    if ( (r[i].prefix_blocks != prefix_blocks) || ((prefix != NULL) && memcmp(r[i].iv, prefix_iv, 16)) ) {
+      printf("Record %llu wasn't found after %s: skipped\n", (unsigned long long) i, prefix ? prefix : "an empty prefix");
+      skipped++;
+      continue;
+    }
+
+    uint32_t * s = bsearch(&r[i].seed, seeds, n, sizeof(uint32_t), compare_uint32);
+    int shared = ( (s > seeds) && (s[-1] == r[i].seed) ) || ( (s < seeds + n - 1) && (s[1] == r[i].seed) );
+
+    if (shared)
+      snprintf(tag, sizeof(tag), "%08X_%llu", r[i].seed, (unsigned long long) i);
+    else
+      snprintf(tag, sizeof(tag), "%08X", r[i].seed);
+
+    snprintf(name[0], sizeof(name[0]), "collision_md5_%s.txt", tag);
+    snprintf(name[1], sizeof(name[1]), "collision1_md5_%s.bin", tag);
+    snprintf(name[2], sizeof(name[2]), "collision2_md5_%s.bin", tag);
+
+    //The hash of the record stops before the suffix
+    md5_init(&m, r[i].iv[0], r[i].iv[1], r[i].iv[2], r[i].iv[3]);
+    m.length = 64 * prefix_blocks;
+    md5_update(&m, r[i].m0, 128);
+    failed = (suffix != NULL) && md5_file(&m, suffix);
+    length = m.length;
+    md5_finish(&m);
+
+    failed = failed || write_summary(name[0], r[i].m0, r[i].m1, prefix, suffix, r[i].b1_time, r[i].b2_time, m.state) ||
+             write_message(name[1], prefix, r[i].m0, suffix, length) || 
+             write_message(name[2], prefix, r[i].m1, suffix, length);
+  }
+
+  printf("Exported %llu record(s) of %s%s", (unsigned long long) (i - first - failed - skipped), fname, 
+         failed ? ": FAILED\n" : "\n");
+  if (skipped)
+    printf("%llu record(s) skipped: give the --prefix (and IV) they were found with\n", (unsigned long long) skipped);
+
+  free(seeds);
+  munmap(map, size);
+  return failed || skipped;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                        FAN-OUT                           //
+///////////////////////////////////////////////////////////////
+
+//Collisions of --fanout, that share block 1: their description, block 1 of both messages, block 2 of message 1 of
+//the collisions found so far (to drop duplicates), how many are wanted, the seed and IV, the time of block 1 and when
+//the search of block 2 started
+struct {
+  FILE * f;
+  uint8_t m0[64], m1[64];
+  uint8_t (* blocks)[64];
+  int n, limit;
+  uint32_t seed, iv[4];
+  double b1_time, start;
+  pthread_mutex_t lock;
+} fanout = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+//Creates the description of limit collisions that share the blocks 1 in v1, v2 (the IV is the one in use), found in
+//b1_time seconds. Returns 1 if it can't be written.
+int fanout_open(const char * fname, int limit, uint32_t seed, const char * prefix, const char * suffix, double b1_time) {
+
+  fanout.f = fopen(fname, "w");
+  if (fanout.f == NULL)
+    return 1;
+
+  memcpy(fanout.m0, v1, 64);
+  memcpy(fanout.m1, v2, 64);
+  fanout.blocks = malloc(limit * sizeof(* fanout.blocks));
+  fanout.n = 0;
+  fanout.limit = limit;
+  fanout.seed = seed;
+  fanout.b1_time = b1_time;
+  fanout.iv[0] = IV1;  fanout.iv[1] = IV2;
+  fanout.iv[2] = IV3;  fanout.iv[3] = IV4;
+  fanout.start = now();
+
+  fprintf(fanout.f, "# md5-tunneling fan-out. Pair i is a collision: prefix, zeros to a multiple of 64 bytes, the 128\n");
+  fprintf(fanout.f, "# bytes of message 1 (first) or 2 (second), suffix. All the pairs have the same block 1.\n");
+  fprintf(fanout.f, "fanout %d\nseed %08X\n", limit, seed);
+  fprintf(fanout.f, "iv %08X %08X %08X %08X\n", IV1, IV2, IV3, IV4);
+  fprintf(fanout.f, "prefix %s\nsuffix %s\n", prefix ? prefix : "-", suffix ? suffix : "-");
+  fflush(fanout.f);
+
+  return 0;
+}
+
+
+//Sink of Block2() for --fanout: adds the collision of the blocks 2 x (message 1) and Hx (message 2) to the 
+//description, unless it is already there. Returns 1 when the description has all the collisions wanted.
+int fanout_add(const uint32_t * x, const uint32_t * Hx, const uint32_t * ihv) {
+
+  uint8_t m0[128], m1[128];
+  int full, i;
+
+  pthread_mutex_lock(&fanout.lock);
+
+  for (i = 0; (i < fanout.n) && memcmp(fanout.blocks[i], x, 64); i++);
+
+  if ( (i < fanout.n) || (fanout.n == fanout.limit) ) {
+    pthread_mutex_unlock(&fanout.lock);
+    return 0;
+  }
+
+  memcpy(fanout.blocks[fanout.n], x, 64);
+
+  memcpy(m0, fanout.m0, 64);  memcpy(m0 + 64, x, 64);
+  memcpy(m1, fanout.m1, 64);  memcpy(m1 + 64, Hx, 64);
+  chain_add(fanout.f, fanout.n, m0, m1);
+  if (archive.fd >= 0)
+    archive_add(fanout.seed, fanout.iv, ihv, m0, m1, fanout.b1_time, now() - fanout.start);
+
+  fanout.n++;
+  printf("Collision %d of %d after %f sec\n", fanout.n, fanout.limit, now() - fanout.start);
+  fflush(stdout);
+
+  full = (fanout.n == fanout.limit);
+  pthread_mutex_unlock(&fanout.lock);
+
+  return full;
+}
+
+
+//Ends the description of the fan-out. Returns 1 if it can't be written.
+int fanout_close() {
+
+  free(fanout.blocks);
+  return fclose(fanout.f) != 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                        HARVEST                           //
+///////////////////////////////////////////////////////////////
+
+//Near-collisions of --harvest waiting for block 2: when the queue is full, the threads of block 1 wait
+#define HARVEST_QUEUE 1024
+
+//A near-collision of block 1: its number, when it was found, block 1 of both messages and the intermediate hash 
+//values A0..D0, A1..D1
+typedef struct {
+  int index;
+  double time;
+  uint8_t m0[64], m1[64];
+  uint32_t ihv[8];
+} near_collision;
+
+//Harvest of --harvest: the description written, the queue of near-collisions, how many were found (and how many of
+//them in tunnels that had already given one), how many are wanted, whether block 1 has ended, the seed and the IV
+struct {
+  FILE * f;
+  near_collision queue[HARVEST_QUEUE];
+  int head, size;
+  int found, same_draw, limit, done, collisions;
+  uint32_t seed, iv[4];
+  double start;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} harvest = { .lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER };
+
+
+//Sink of Block1() for --harvest: queues the near-collision of the blocks x (message 1) and Hx (message 2) for block 2.
+//Returns 1 when all the near-collisions wanted have been found.
+int harvest_add(const uint32_t * x, const uint32_t * Hx, const uint32_t * ihv) {
+
+  //Outer draw of the last near-collision found by the thread
+  static __thread uint64_t last_draw = 0;
+  near_collision * nc;
+  int full;
+
+  pthread_mutex_lock(&harvest.lock);
+
+  while ( (harvest.size == HARVEST_QUEUE) && (harvest.found < harvest.limit) )
+    pthread_cond_wait(&harvest.changed, &harvest.lock);
+
+  if (harvest.found == harvest.limit) {
+    pthread_mutex_unlock(&harvest.lock);
+    return 0;
+  }
+
+  nc = &harvest.queue[(harvest.head + harvest.size) % HARVEST_QUEUE];
+  nc->index = harvest.found;
+  nc->time = now() - harvest.start;
+  memcpy(nc->m0, x, 64);
+  memcpy(nc->m1, Hx, 64);
+  memcpy(nc->ihv, ihv, sizeof(nc->ihv));
+  harvest.size++;
+
+  harvest.same_draw += (last_draw == stats.stage_itr[ST_B1_OUTER]);
+  last_draw = stats.stage_itr[ST_B1_OUTER];
+
+  harvest.found++;
+  printf("Near-collision %d of %d after %f sec\n", harvest.found, harvest.limit, now() - harvest.start);
+  fflush(stdout);
+
+  full = (harvest.found == harvest.limit);
+  pthread_cond_broadcast(&harvest.changed);
+  pthread_mutex_unlock(&harvest.lock);
+
+  return full;
+}
+
+
+//Thread of --harvest-jobs: searches block 2 for the near-collisions of the queue, one at a time with one thread, and
+//adds the collisions to the description. Near-collision i is searched with seed mix(seed + i + 1).
+void * harvest_consumer(void * arg) {
+
+  near_collision nc;
+  double start;
+
+  (void) arg;
+
+  for ( ; ; ) {
+
+    pthread_mutex_lock(&harvest.lock);
+    while ( (harvest.size == 0) && !harvest.done )
+      pthread_cond_wait(&harvest.changed, &harvest.lock);
+
+    if (harvest.size == 0) {
+      pthread_mutex_unlock(&harvest.lock);
+      return NULL;
+    }
+
+    nc = harvest.queue[harvest.head];
+    harvest.head = (harvest.head + 1) % HARVEST_QUEUE;
+    harvest.size--;
+    pthread_cond_broadcast(&harvest.changed);
+    pthread_mutex_unlock(&harvest.lock);
+
+    X = mix(harvest.seed + nc.index + 1);
+    A0 = nc.ihv[0];  B0 = nc.ihv[1];  C0 = nc.ihv[2];  D0 = nc.ihv[3];
+    A1 = nc.ihv[4];  B1 = nc.ihv[5];  C1 = nc.ihv[6];  D1 = nc.ihv[7];
+    memcpy(v1, nc.m0, 64);
+    memcpy(v2, nc.m1, 64);
+
+    start = now();
+    if (parallel_search(2, 1, NULL))
+      continue;
+
+    pthread_mutex_lock(&harvest.lock);
+    chain_add(harvest.f, nc.index, v1, v2);
+    if (archive.fd >= 0)
+      archive_add(harvest.seed, harvest.iv, (uint32_t[4]) { A0, B0, C0, D0 }, v1, v2, nc.time, now() - start);
+    harvest.collisions++;
+    printf("Collision for near-collision %d after %f sec\n", nc.index + 1, now() - harvest.start);
+    fflush(stdout);
+    pthread_mutex_unlock(&harvest.lock);
+  }
+}
+
+
+//Searches n collisions with different blocks 1 from the IV in use: the threads of block 1 (search_threads) walk the 
+//whole tunnels of every draw and queue all the near-collisions, jobs threads search block 2 for them. The pairs are
+//written to the description fname (as with --fanout). Returns 1 if it can't be written.
+int harvest_run(int n, int jobs, uint32_t seed, const char * fname, const char * prefix, const char * suffix) {
+
+  pthread_t consumer[MAX_THREADS];
+  int started;
+
+  harvest.f = fopen(fname, "w");
+  if (harvest.f == NULL)
+    return 1;
+
+  fprintf(harvest.f, "# md5-tunneling harvest. Pair i is a collision: prefix, zeros to a multiple of 64 bytes, the 128\n");
+  fprintf(harvest.f, "# bytes of message 1 (first) or 2 (second), suffix. Every pair has its own block 1.\n");
+  fprintf(harvest.f, "harvest %d\nseed %08X\n", n, seed);
+  fprintf(harvest.f, "iv %08X %08X %08X %08X\n", IV1, IV2, IV3, IV4);
+  fprintf(harvest.f, "prefix %s\nsuffix %s\n", prefix ? prefix : "-", suffix ? suffix : "-");
+  fflush(harvest.f);
+
+  harvest.head = harvest.size = 0;
+  harvest.found = harvest.same_draw = harvest.done = harvest.collisions = 0;
+  harvest.limit = n;
+  harvest.seed = seed;
+  harvest.iv[0] = IV1;  harvest.iv[1] = IV2;
+  harvest.iv[2] = IV3;  harvest.iv[3] = IV4;
+  harvest.start = now();
+
+  for (started = 0; started < jobs; started++)
+    if (pthread_create(&consumer[started], NULL, harvest_consumer, NULL))
+      break;
+
+  if (started == 0) {
+    fclose(harvest.f);
+    return 1;
+  }
+
+  //Block 1 runs in this thread (with its threads) until the queue has had n near-collisions
+  X = seed;
+  search_sink = harvest_add;
+  parallel_search(1, search_threads, NULL);
+  search_sink = NULL;
+
+  pthread_mutex_lock(&harvest.lock);
+  harvest.done = 1;
+  pthread_cond_broadcast(&harvest.changed);
+  pthread_mutex_unlock(&harvest.lock);
+
+  for (int k=0; k<started; k++)
+    pthread_join(consumer[k], NULL);
+
+  printf("\n%d collisions in %f sec. %d of the %d near-collisions were found in the tunnels of a draw that had already "
+         "given one.\n", harvest.collisions, now() - harvest.start, harvest.same_draw, harvest.found);
+
+  return fclose(harvest.f) != 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                       IV SWEEP                           //
+///////////////////////////////////////////////////////////////
+
+//Prefixes hashed at the same time by md5_prefixes(), one per lane of md5_compress_lanes()
+#define MD5_LANES 8
+
+//Entry of the list of --sweep: an IV, or a prefix file hashed from the IV in use (iv is then its chaining value)
+typedef struct {
+  uint32_t iv[4];
+  char * prefix;
+  int failed;
+} sweep_entry;
+
+//Record of entry index in the output of --sweep. cv is the chaining value after the two blocks, the same for m0 and
+//m1; found is 0 if the prefix couldn't be read or the search was stopped. Records are written at index * 308 bytes.
+typedef struct {
+  uint32_t index, found, seed;
+  uint32_t iv[4], cv[4];
+  float b1_time, b2_time;
+  uint8_t m0[128], m1[128];
+} sweep_record;
+
+//Sweep shared by the threads of --sweep-jobs: the entries, the next one to search, the output and the counters
+typedef struct {
+  sweep_entry * entries;
+  int n, next, found;
+  int fd;
+  uint32_t seed;
+} sweep_run;
+
+
+//Compresses a 64 bytes block per lane into the chaining values of the lanes (state[i][lane] is word i). The lanes run
+//the steps in lockstep, so the compiler can compute them with vector instructions.
+static void md5_compress_lanes(uint32_t state[4][MD5_LANES], const uint8_t * const block[MD5_LANES]) {
+
+  uint32_t x[16][MD5_LANES], Q[68][MD5_LANES], f;
+  int i, l, k;
+
+  for (l=0; l<MD5_LANES; l++)
+    for (k=0; k<16; k++)
+      memcpy(&x[k][l], block[l] + 4 * k, 4);
+
+  //Q[i+3] is Q[i] of md5_steps()
+  for (l=0; l<MD5_LANES; l++) {
+    Q[0][l] = state[0][l];  Q[1][l] = state[3][l];
+    Q[2][l] = state[2][l];  Q[3][l] = state[1][l];
+  }
+
+  for (i=1; i<=16; i++)
+    for (l=0; l<MD5_LANES; l++) {
+      f = F(Q[i+2][l], Q[i+1][l], Q[i][l]) + Q[i-1][l] + x[i - 1][l] + md5_T[i-1];
+      Q[i+3][l] = Q[i+2][l] + RL(f, md5_S[0][(i - 1) % 4]);
+    }
+  for (i=17; i<=32; i++)
+    for (l=0; l<MD5_LANES; l++) {
+      f = G(Q[i+2][l], Q[i+1][l], Q[i][l]) + Q[i-1][l] + x[(5 * i - 4) % 16][l] + md5_T[i-1];
+      Q[i+3][l] = Q[i+2][l] + RL(f, md5_S[1][(i - 1) % 4]);
+    }
+  for (i=33; i<=48; i++)
+    for (l=0; l<MD5_LANES; l++) {
+      f = H(Q[i+2][l], Q[i+1][l], Q[i][l]) + Q[i-1][l] + x[(3 * i + 2) % 16][l] + md5_T[i-1];
+      Q[i+3][l] = Q[i+2][l] + RL(f, md5_S[2][(i - 1) % 4]);
+    }
+  for (i=49; i<=64; i++)
+    for (l=0; l<MD5_LANES; l++) {
+      f = I(Q[i+2][l], Q[i+1][l], Q[i][l]) + Q[i-1][l] + x[(7 * (i - 1)) % 16][l] + md5_T[i-1];
+      Q[i+3][l] = Q[i+2][l] + RL(f, md5_S[3][(i - 1) % 4]);
+    }
+
+  for (l=0; l<MD5_LANES; l++) {
+    state[0][l] += Q[64][l];  state[3][l] += Q[65][l];
+    state[2][l] += Q[66][l];  state[1][l] += Q[67][l];
+  }
+}
+
+
+//Computes the IVs of the prefix entries: the chaining value of each prefix, padded with zeros as with --prefix, from
+//the IV in use. Regular files are mapped in memory and hashed MD5_LANES at a time, each lane taking the next file
+//when its file ends; the other files are hashed with md5_file(). Sets failed in the entries that can't be read.
+//Returns the bytes hashed.
+uint64_t md5_prefixes(sweep_entry * entries, int n) {
+
+  struct {
+    int entry;
+    const uint8_t * map;
+    size_t size, blocks, next;
+    uint8_t tail[64];
+  } lane[MD5_LANES];
+
+  static const uint8_t zero[64];
+  uint32_t state[4][MD5_LANES];
+  const uint8_t * block[MD5_LANES];
+  md5_stream m;
+  uint64_t bytes = 0;
+  int next = 0, active, l, j;
+
+  for (l=0; l<MD5_LANES; l++)
+    lane[l].entry = -1;
+
+  do {
+
+    //Idle lanes take the next prefixes: the files that can't be mapped, and the empty ones, are done here
+    for (l=0; l<MD5_LANES; l++)
+      while ( (lane[l].entry < 0) && (next < n) ) {
+
+        sweep_entry * e = &entries[next++];
+
+        if (e->prefix == NULL)
+          continue;
+
+#ifdef __linux__
+        struct stat st;
+        int fd = open(e->prefix, O_RDONLY);
+        void * map = MAP_FAILED;
+
+        if ( (fd >= 0) && (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0) )
+          map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (fd >= 0)
+          close(fd);
+
+        if (map != MAP_FAILED) {
+          madvise(map, st.st_size, MADV_SEQUENTIAL);
+          lane[l].entry = e - entries;
+          lane[l].map = map;
+          lane[l].size = st.st_size;
+          lane[l].blocks = (st.st_size + 63) / 64;
+          lane[l].next = 0;
+          memset(lane[l].tail, 0, 64);
+          memcpy(lane[l].tail, lane[l].map + 64 * (lane[l].blocks - 1), st.st_size - 64 * (lane[l].blocks - 1));
+          for (j=0; j<4; j++)
+            state[j][l] = e->iv[j];
+          bytes += st.st_size;
+          continue;
+        }
+#endif
+
+        md5_init(&m, e->iv[0], e->iv[1], e->iv[2], e->iv[3]);
+        e->failed = md5_file(&m, e->prefix);
+        md5_pad_zero(&m);
+        memcpy(e->iv, m.state, sizeof(e->iv));
+        bytes += m.length;
+      }
+
+    active = 0;
+    for (l=0; l<MD5_LANES; l++) {
+      if (lane[l].entry < 0)
+        block[l] = zero;
+      else {
+        block[l] = (lane[l].next + 1 < lane[l].blocks) ? lane[l].map + 64 * lane[l].next : lane[l].tail;
+        active++;
+      }
+    }
+
+    if (active == 0)
+      break;
+
+    md5_compress_lanes(state, block);
+
+    for (l=0; l<MD5_LANES; l++)
+      if ( (lane[l].entry >= 0) && (++lane[l].next == lane[l].blocks) ) {
+        for (j=0; j<4; j++)
+          entries[lane[l].entry].iv[j] = state[j][l];
+#ifdef __linux__
+        munmap((void *) lane[l].map, lane[l].size);
+#endif
+        lane[l].entry = -1;
+      }
+
+  } while (1);
+
+  return bytes;
+}
+
+
+//Reads the list of --sweep: a line is 4 hex numbers (an IV) or the name of a prefix file, hashed from the IV in use.
+//Empty lines and lines starting with # are skipped. Returns the number of entries, or -1 if the list can't be read.
+int read_sweep_list(const char * fname, sweep_entry ** entries) {
+
+  char line[4096];
+  uint32_t iv[4];
+  int n = 0, size = 0;
+  FILE * f = fopen(fname, "r");
+
+  *entries = NULL;
+  if (f == NULL)
+    return -1;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+
+    line[strcspn(line, "\r\n")] = 0;
+    if ( (line[0] == 0) || (line[0] == '#') )
+      continue;
+
+    if (n == size) {
+      size = size ? 2 * size : 1024;
+      *entries = realloc(*entries, size * sizeof(sweep_entry));
+    }
+
+    if (sscanf(line, "%x %x %x %x", &iv[0], &iv[1], &iv[2], &iv[3]) == 4) {
+      memcpy((*entries)[n].iv, iv, sizeof(iv));
+      (*entries)[n].prefix = NULL;
+    }
+    else {
+      (*entries)[n].iv[0] = IV1;  (*entries)[n].iv[1] = IV2;
+      (*entries)[n].iv[2] = IV3;  (*entries)[n].iv[3] = IV4;
+      (*entries)[n].prefix = strdup(line);
+    }
+    (*entries)[n].failed = 0;
+    n++;
+  }
+
+  fclose(f);
+  return n;
+}
+
+
+//Thread of --sweep-jobs: searches the next entries of the sweep, each with search_threads threads, until none is 
+//left. Entry i is searched with seed mix(seed + i), so it gives the same collision in any order with 1 thread.
+void * sweep_driver(void * arg) {
+
+  sweep_run * run = arg;
+  sweep_record r;
+  double t;
+  int i;
+
+  while ( (i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->n ) {
+
+    memset(&r, 0, sizeof(r));
+    r.index = i;
+    r.seed = mix(run->seed + i);
+    memcpy(r.iv, run->entries[i].iv, sizeof(r.iv));
+
+    if (!run->entries[i].failed) {
+
+      X = r.seed;
+      IV1 = r.iv[0]; IV2 = r.iv[1];
+      IV3 = r.iv[2]; IV4 = r.iv[3];
+
+      t = now();
+      if (parallel_search(1, search_threads, NULL) == 0) {
+
+        r.b1_time = now() - t;
+        t = now();
+        if (parallel_search(2, search_threads, NULL) == 0) {
+
+          r.b2_time = now() - t;
+          r.found = 1;
+          r.cv[0] = A0;  r.cv[1] = B0;
+          r.cv[2] = C0;  r.cv[3] = D0;
+          memcpy(r.m0, v1, 128);
+          memcpy(r.m1, v2, 128);
+        }
+      }
+    }
+
+    if (pwrite(run->fd, &r, sizeof(r), (off_t) i * sizeof(r)) != sizeof(r))
+      r.found = 0;
+
+    __atomic_fetch_add(&run->found, r.found, __ATOMIC_RELAXED);
+    printf("Entry %6d of %d: IV 0x%08X,0x%08X,0x%08X,0x%08X %s (%.2f + %.2f sec)\n", i + 1, run->n, r.iv[0], r.iv[1], 
+           r.iv[2], r.iv[3], r.found ? "collision" : (run->entries[i].failed ? "PREFIX NOT READ" : "FAILED"), 
+           r.b1_time, r.b2_time);
+    fflush(stdout);
+  }
+
+  return NULL;
+}
+
+
+//Searches a collision for every entry of the list fname with jobs searches at a time, seeded from seed, and writes
+//their records to out. Returns 1 if the list or the output can't be read or written.
+int sweep(const char * fname, int jobs, const char * out, uint32_t seed) {
+
+  pthread_t driver[MAX_THREADS];
+  sweep_entry * entries;
+  sweep_run run;
+  uint64_t bytes;
+  double start;
+  int prefixes = 0, started;
+
+  run.n = read_sweep_list(fname, &entries);
+  if (run.n < 0) {
+    printf("Can't read the sweep list %s\n", fname);
+    return 1;
+  }
+
+  for (int i=0; i<run.n; i++)
+    prefixes += (entries[i].prefix != NULL);
+
+  if (prefixes) {
+    start = now();
+    bytes = md5_prefixes(entries, run.n);
+    printf("Hashed %d prefixes (%.1f MB) in %.3f sec\n", prefixes, bytes / 1e6, now() - start);
+  }
+
+  run.fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ( (run.fd < 0) || ftruncate(run.fd, (off_t) run.n * sizeof(sweep_record)) ) {
+    printf("Can't write the sweep results to %s\n", out);
+    return 1;
+  }
+
+  printf("Sweep of %d entries, %d at a time with %d thread(s) each, seed 0x%08X\n\n", run.n, jobs, search_threads, seed);
+  fflush(stdout);
+
+  run.entries = entries;
+  run.next = run.found = 0;
+  run.seed = seed;
+  start = now();
+
+  for (started = 0; started < jobs; started++)
+    if (pthread_create(&driver[started], NULL, sweep_driver, &run))
+      break;
+  for (int k=0; k<started; k++)
+    pthread_join(driver[k], NULL);
+
+  printf("\n%d collisions for %d entries in %.1f sec (%.1f collisions/hour), written to %s (%d bytes per entry)\n", 
+         run.found, run.n, now() - start, run.found * 3600 / (now() - start), out, (int) sizeof(sweep_record));
+
+  for (int i=0; i<run.n; i++)
+    free(entries[i].prefix);
+  free(entries);
+
+  return close(run.fd) || (started == 0);
+}
+
+
+///////////////////////////////////////////////////////////////
+///                         VERIFY                           //
+///////////////////////////////////////////////////////////////
+
+//Records of an archive, or pairs of files, a thread of --verify takes at a time
+#define VERIFY_CHUNK 256
+
+//Files smaller than this are read, the others mapped in memory
+#define VERIFY_READ 4096
+
+//Mismatches printed by --verify, the others are only counted
+#define VERIFY_REPORT 100
+
+//Message hashed by md5_lanes(): the whole blocks in data, then the last bytes and the padding in tail. state is the
+//chaining value the message is hashed from, and then its MD5.
+typedef struct {
+  const uint8_t * data;
+  size_t blocks, tail_blocks;
+  uint8_t tail[128];
+  uint32_t state[4];
+} md5_job;
+
+//Verification shared by the threads of --verify: the records of the archive or the names of the pairs in dir (the
+//part after collision1_) and the IV they are hashed from, the next chunk to verify and the counters
+typedef struct {
+  const archive_record * records;
+  char ** names;
+  const char * dir;
+  uint32_t iv[4];
+  uint64_t n, next, bad, failed, bytes;
+  pthread_mutex_t lock;
+} verify_run;
+
+
+//Sets the message of job: size bytes at data, the last of total bytes from the chaining value in the job, with the
+//padding and length of MD5
+void md5_job_set(md5_job * job, const uint8_t * data, size_t size, uint64_t total) {
+
+  size_t rest = size % 64;
+  uint64_t bits = total * 8;
+
+  job->data = data;
+  job->blocks = size / 64;
+  job->tail_blocks = (rest + 8) / 64 + 1;
+
+  memset(job->tail, 0, sizeof(job->tail));
+  memcpy(job->tail, data + size - rest, rest);
+  job->tail[rest] = 0x80;
+  memcpy(job->tail + 64 * job->tail_blocks - 8, &bits, 8);
+}
+
+
+//Hashes the messages of n jobs MD5_LANES at a time with md5_compress_lanes(), each lane taking the next job when its
+//message ends, and leaves their MD5 in the states of the jobs
+void md5_lanes(md5_job * jobs, int n) {
+
+  static const uint8_t zero[64];
+  uint32_t state[4][MD5_LANES];
+  const uint8_t * block[MD5_LANES];
+  size_t done[MD5_LANES];
+  int job[MD5_LANES], next = 0, active, l, j;
+
+  for (l=0; l<MD5_LANES; l++)
+    job[l] = -1;
+
+  do {
+
+    active = 0;
+    for (l=0; l<MD5_LANES; l++) {
+
+      if ( (job[l] < 0) && (next < n) ) {
+        job[l] = next++;
+        done[l] = 0;
+        for (j=0; j<4; j++)
+          state[j][l] = jobs[job[l]].state[j];
+      }
+
+      if (job[l] < 0)
+        block[l] = zero;
+      else {
+        md5_job * b = &jobs[job[l]];
+        block[l] = (done[l] < b->blocks) ? b->data + 64 * done[l] : b->tail + 64 * (done[l] - b->blocks);
+        active++;
+      }
+    }
+
+    if (active == 0)
+      break;
+
+    md5_compress_lanes(state, block);
+
+    for (l=0; l<MD5_LANES; l++)
+      if ( (job[l] >= 0) && (++done[l] == jobs[job[l]].blocks + jobs[job[l]].tail_blocks) ) {
+        for (j=0; j<4; j++)
+          jobs[job[l]].state[j] = state[j][l];
+        job[l] = -1;
+      }
+
+  } while (1);
+}
+
+
+//Counts a mismatch of --verify in counter, and prints the first VERIFY_REPORT of them
+void verify_report(verify_run * run, uint64_t * counter, const char * what, const char * problem) {
+
+  pthread_mutex_lock(&run->lock);
+  if (run->bad + run->failed < VERIFY_REPORT)
+    printf("%s: %s\n", what, problem);
+  (*counter)++;
+  pthread_mutex_unlock(&run->lock);
+}
+
+
+//Whether two jobs hold the same message: the tails end with the length
+int same_message(const md5_job * a, const md5_job * b) {
+
+  return (a->blocks == b->blocks) && (a->tail_blocks == b->tail_blocks) && !memcmp(a->data, b->data, 64 * a->blocks) &&
+         !memcmp(a->tail, b->tail, 64 * a->tail_blocks);
+}
+
+
+//Reads (or maps) a file of a pair of --verify into job, hashed from iv. Small files go into buf, of VERIFY_READ bytes.
+//Returns the size of the mapping to unmap (0 if the file was read), or -1 if it can't be read.
+ssize_t verify_file(const char * fname, const uint32_t * iv, md5_job * job, uint8_t * buf) {
+
+  struct stat st;
+  ssize_t size = -1, got;
+  void * map;
+  int fd = open(fname, O_RDONLY);
+
+  if (fd < 0)
+    return -1;
+
+  if ( (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) ) {
+
+    if (st.st_size < VERIFY_READ) {
+      for (size = 0; size < st.st_size; size += got)
+        if ( (got = read(fd, buf + size, st.st_size - size)) <= 0 )
+          break;
+      if (size == st.st_size) {
+        md5_job_set(job, buf, size, size);
+        size = 0;
+      }
+      else
+        size = -1;
+    }
+    else {
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        md5_job_set(job, map, st.st_size, st.st_size);
+        size = st.st_size;
+      }
+    }
+  }
+  close(fd);
+
+  memcpy(job->state, iv, sizeof(job->state));
+  return size;
+}
+
+
+//Thread of --verify: takes VERIFY_CHUNK records or pairs at a time and hashes both messages of each of them at once
+void * verify_worker(void * arg) {
+
+  verify_run * run = arg;
+  md5_job * jobs = malloc(2 * VERIFY_CHUNK * sizeof(md5_job));
+  uint8_t * buf = malloc(2 * VERIFY_CHUNK * VERIFY_READ);
+  ssize_t mapped[2 * VERIFY_CHUNK];
+  char name[2][4096], what[4096];
+  uint64_t first, last, i, bytes = 0;
+  int k, n;
+
+  while ( (first = __atomic_fetch_add(&run->next, VERIFY_CHUNK, __ATOMIC_RELAXED)) < run->n ) {
+
+    last = (first + VERIFY_CHUNK < run->n) ? first + VERIFY_CHUNK : run->n;
+    n = 2 * (last - first);
+
+    //The archive keeps the messages after the prefix, hashed from its chaining value
+    for (i=first, k=0; (run->records != NULL) && (i<last); i++, k+=2) {
+      const archive_record * r = &run->records[i];
+      for (int m=0; m<2; m++) {
+        md5_job_set(&jobs[k+m], m ? r->m1 : r->m0, 128, 64 * (uint64_t) r->prefix_blocks + 128);
+        memcpy(jobs[k+m].state, r->iv, sizeof(r->iv));
+        mapped[k+m] = 0;
+      }
+      bytes += 256;
+    }
+
+    //A pair that can't be read is hashed as two empty messages, and reported
+    for (i=first, k=0; (run->records == NULL) && (i<last); i++, k+=2)
+      for (int m=0; m<2; m++) {
+        snprintf(name[m], sizeof(name[m]), "%s/collision%d_%s", run->dir, m + 1, run->names[i]);
+        mapped[k+m] = verify_file(name[m], run->iv, &jobs[k+m], buf + (k + m) * VERIFY_READ);
+        if (mapped[k+m] < 0)
+          md5_job_set(&jobs[k+m], buf, 0, 0);
+        else
+          bytes += 64 * jobs[k+m].blocks + 64 * jobs[k+m].tail_blocks;
+      }
+
+    md5_lanes(jobs, n);
+
+    for (i=first, k=0; i<last; i++, k+=2) {
+
+      const archive_record * r = run->records ? &run->records[i] : NULL;
+
+      if (r != NULL)
+        snprintf(what, sizeof(what), "Record %llu (seed %08X)", (unsigned long long) i, r->seed);
+      else
+        snprintf(what, sizeof(what), "%s/collision1/2_%s", run->dir, run->names[i]);
+
+      if ( (mapped[k] < 0) || (mapped[k+1] < 0) )
+        verify_report(run, &run->failed, what, "can't be read");
+      else if (memcmp(jobs[k].state, jobs[k+1].state, 16))
+        verify_report(run, &run->bad, what, "the MD5s differ");
+      else if ( (r != NULL) && memcmp(jobs[k].state, r->hash, 16) )
+        verify_report(run, &run->bad, what, "the MD5 isn't the hash of the record");
+      else if (same_message(&jobs[k], &jobs[k+1]))
+        verify_report(run, &run->bad, what, "the messages are the same");
+    }
+
+    for (k=0; k<n; k++)
+      if (mapped[k] > 0)
+        munmap((void *) jobs[k].data, mapped[k]);
+  }
+
+  __atomic_fetch_add(&run->bytes, bytes, __ATOMIC_RELAXED);
+  free(jobs);
+  free(buf);
+  return NULL;
+}
+
+
+//Order of the names of the pairs
+int compare_names(const void * a, const void * b) {
+
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+//Lists the pairs of dir: the names collision1_NAME with a collision2_NAME, sorted. Returns their number, or -1 if
+//dir can't be read.
+int verify_list(const char * dir, char *** names) {
+
+  struct dirent * e;
+  char fname[4096];
+  int n = 0, size = 0;
+  DIR * d = opendir(dir);
+
+  *names = NULL;
+  if (d == NULL)
+    return -1;
+
+  while ( (e = readdir(d)) != NULL ) {
+
+    if (strncmp(e->d_name, "collision1_", 11) != 0)
+      continue;
+    snprintf(fname, sizeof(fname), "%s/collision2_%s", dir, e->d_name + 11);
+    if (access(fname, F_OK) != 0)
+      continue;
+
+    if (n == size) {
+      size = size ? 2 * size : 1024;
+      *names = realloc(*names, size * sizeof(char *));
+    }
+    (*names)[n++] = strdup(e->d_name + 11);
+  }
+  closedir(d);
+
+  if (n > 0)
+    qsort(*names, n, sizeof(char *), compare_names);
+  return n;
+}
+
+
+//Verifies with threads the collisions of an archive (both blocks give the MD5 of the record) or of the pairs
+//collision1/2_NAME of a directory (both files have the same MD5 from the IV in use, and differ). Prints the mismatches
+//and the pairs per second. Returns 1 if a pair doesn't verify or can't be read.
+int verify(const char * path, int threads) {
+
+  pthread_t worker[MAX_THREADS];
+  verify_run run;
+  struct stat st;
+  void * map = NULL;
+  size_t size = 0;
+  double start, elapsed;
+  int started;
+
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+
+  memset(&run, 0, sizeof(run));
+  pthread_mutex_init(&run.lock, NULL);
+  start = now();
+
+  if (stat(path, &st) != 0) {
+    printf("Can't read %s\n", path);
+    return 1;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    int n = verify_list(path, &run.names);
+    if (n < 0) {
+      printf("Can't read the directory %s\n", path);
+      return 1;
+    }
+    run.n = n;
+    run.dir = path;
+    run.iv[0] = IV1;  run.iv[1] = IV2;
+    run.iv[2] = IV3;  run.iv[3] = IV4;
+    printf("Verifying %llu pairs of %s from the IV 0x%08X,0x%08X,0x%08X,0x%08X with %d thread(s)\n\n", 
+           (unsigned long long) run.n, path, IV1, IV2, IV3, IV4, threads);
+  }
+  else {
+    run.records = archive_map(path, &run.n, &map, &size);
+    if (run.records == NULL) {
+      printf("Can't read the archive %s\n", path);
+      return 1;
+    }
+    printf("Verifying %llu records of %s with %d thread(s)\n\n", (unsigned long long) run.n, path, threads);
+  }
+  fflush(stdout);
+
+  for (started = 0; started < threads; started++)
+    if (pthread_create(&worker[started], NULL, verify_worker, &run))
+      break;
+  for (int k=0; k<started; k++)
+    pthread_join(worker[k], NULL);
+
+  elapsed = now() - start;
+
+  if (run.bad + run.failed > VERIFY_REPORT)
+    printf("... and %llu more\n", (unsigned long long) (run.bad + run.failed - VERIFY_REPORT));
+  printf("%s%llu pairs verified in %.3f sec (%.0f pairs/sec, %.1f MB/s): %llu mismatch(es), %llu unreadable\n", 
+         (run.bad + run.failed) ? "\n" : "", (unsigned long long) run.n, elapsed, run.n / elapsed, 
+         run.bytes / elapsed / 1e6, (unsigned long long) run.bad, (unsigned long long) run.failed);
+
+  if (map != NULL)
+    munmap(map, size);
+  for (uint64_t i=0; (run.names != NULL) && (i<run.n); i++)
+    free(run.names[i]);
+  free(run.names);
+
+  return (started == 0) || run.bad || run.failed;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                         CACHE                            //
+///////////////////////////////////////////////////////////////
+
+//Size of a new cache: the IVs it keeps collisions for, and the collisions
+#define CACHE_IVS   256
+#define CACHE_SLOTS 4096
+
+//Seconds the refill waits when every IV has its collisions
+#define CACHE_POLL 5
+
+#define CACHE_MAGIC "MD5TCCH1"
+
+//States of a slot: a collision is written (FILLING), then can be handed out (READY), then only with reuse (TAKEN)
+enum { CACHE_FREE, CACHE_FILLING, CACHE_READY, CACHE_TAKEN };
+
+//Header of the cache, then the IVs and the slots. searches counts the searches of all the refills: search n uses the
+//seed mix(seed + n), so a refill started again doesn't find the collisions it already gave.
+typedef struct {
+  char magic[8];
+  uint32_t ivs, slots;
+  uint64_t searches;
+} cache_header;
+
+//IV of the cache: the collisions ready for it, and the requests served from the cache or by a search
+typedef struct {
+  uint32_t iv[4];
+  uint32_t used, ready;
+  uint64_t hits, misses;
+} cache_iv;
+
+//Collision of the cache, for the IV number iv: the seed it was found with, how many times it was handed out and the
+//two messages
+typedef struct {
+  uint32_t state, iv, seed, taken;
+  uint8_t m0[128], m1[128];
+} cache_slot;
+
+//Cache mapped in memory, shared by the processes that use it: the states and counters change atomically, the IVs
+//are added under a lock of the file
+typedef struct {
+  int fd;
+  cache_header * header;
+  cache_iv * ivs;
+  cache_slot * slots;
+  size_t size;
+} cache_map;
+
+
+//Maps the cache in fname, created if it doesn't exist. Returns 1 if it can't be used.
+int cache_open(cache_map * c, const char * fname) {
+
+  cache_header h = { CACHE_MAGIC, CACHE_IVS, CACHE_SLOTS, 0 };
+  struct stat st;
+  void * map;
+
+  c->size = sizeof(h) + CACHE_IVS * sizeof(cache_iv) + CACHE_SLOTS * sizeof(cache_slot);
+  c->fd = open(fname, O_RDWR | O_CREAT, 0644);
+  if (c->fd < 0)
+    return 1;
+
+  //The first process writes the header, the others wait for it
+  flock(c->fd, LOCK_EX);
+  if ( (fstat(c->fd, &st) == 0) && (st.st_size == 0) )
+    if ( ftruncate(c->fd, c->size) || (pwrite(c->fd, &h, sizeof(h), 0) != sizeof(h)) ) {
+      flock(c->fd, LOCK_UN);
+      close(c->fd);
+      return 1;
+    }
+  flock(c->fd, LOCK_UN);
+
+  map = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+  if ( (map == MAP_FAILED) || fstat(c->fd, &st) || ((size_t) st.st_size != c->size) || memcmp(map, &h, offsetof(cache_header, searches)) ) {
+    if (map != MAP_FAILED)
+      munmap(map, c->size);
+    close(c->fd);
+    return 1;
+  }
+
+  c->header = map;
+  c->ivs = (cache_iv *) (c->header + 1);
+  c->slots = (cache_slot *) (c->ivs + CACHE_IVS);
+  return 0;
+}
+
+
+void cache_close(cache_map * c) {
+
+  munmap(c->header, c->size);
+  close(c->fd);
+}
+
+
+//Returns the number of iv in the cache, or -1 if it isn't there. With add, iv is added if there is room.
+int cache_iv_index(cache_map * c, const uint32_t * iv, int add) {
+
+  int i, empty = -1;
+
+  for (i=0; i<CACHE_IVS; i++)
+    if ( __atomic_load_n(&c->ivs[i].used, __ATOMIC_ACQUIRE) && !memcmp(c->ivs[i].iv, iv, 16) )
+      return i;
+
+  if (!add)
+    return -1;
+
+  //Another process may be adding the same IV
+  flock(c->fd, LOCK_EX);
+  for (i=0; i<CACHE_IVS; i++) {
+    if ( c->ivs[i].used && !memcmp(c->ivs[i].iv, iv, 16) )
+      break;
+    if ( !c->ivs[i].used && (empty < 0) )
+      empty = i;
+  }
+  if ( (i == CACHE_IVS) && (empty >= 0) ) {
+    memcpy(c->ivs[empty].iv, iv, 16);
+    __atomic_store_n(&c->ivs[empty].used, 1, __ATOMIC_RELEASE);
+    i = empty;
+  }
+  flock(c->fd, LOCK_UN);
+
+  return (i < CACHE_IVS) ? i : -1;
+}
+
+
+//Hands out a collision for iv: one that was never handed out, or with reuse one that was. Counts the request as a 
+//hit or a miss of iv. Returns the slot, or -1 on a miss.
+int cache_take(cache_map * c, const uint32_t * iv, int reuse, uint8_t * m0, uint8_t * m1, uint32_t * seed) {
+
+  uint32_t state;
+  int k = cache_iv_index(c, iv, 1), s;
+
+  if (k < 0)
+    return -1;
+
+  for (int pass = 0; pass < 1 + reuse; pass++)
+    for (s=0; s<CACHE_SLOTS; s++) {
+
+      state = pass ? CACHE_TAKEN : CACHE_READY;
+      if ( (__atomic_load_n(&c->slots[s].state, __ATOMIC_ACQUIRE) != state) || (c->slots[s].iv != (uint32_t) k) )
+        continue;
+
+      //The first pass claims the slot, so no other request gets it. The slot may have been refilled for another IV
+      //in the meantime, it is then given back.
+      if (!pass) {
+        if (!__atomic_compare_exchange_n(&c->slots[s].state, &state, CACHE_TAKEN, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+          continue;
+        if (c->slots[s].iv != (uint32_t) k) {
+          __atomic_store_n(&c->slots[s].state, CACHE_READY, __ATOMIC_RELEASE);
+          continue;
+        }
+        __atomic_fetch_sub(&c->ivs[k].ready, 1, __ATOMIC_RELAXED);
+      }
+
+      memcpy(m0, c->slots[s].m0, 128);
+      memcpy(m1, c->slots[s].m1, 128);
+      *seed = c->slots[s].seed;
+
+      //A slot handed out before may be refilled while it is copied
+      if ( pass && ((__atomic_load_n(&c->slots[s].state, __ATOMIC_ACQUIRE) != state) || (c->slots[s].iv != (uint32_t) k)) )
+        continue;
+      __atomic_fetch_add(&c->slots[s].taken, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&c->ivs[k].hits, 1, __ATOMIC_RELAXED);
+      return s;
+    }
+
+  __atomic_fetch_add(&c->ivs[k].misses, 1, __ATOMIC_RELAXED);
+  return -1;
+}
+
+
+//Adds a collision for iv, in a free slot or else in one already handed out. Returns 1 if the cache is full, 2 if the
+//same collision is already in the cache (handed out or not).
+int cache_put(cache_map * c, const uint32_t * iv, uint32_t seed, const uint8_t * m0, const uint8_t * m1) {
+
+  uint32_t state;
+  int k = cache_iv_index(c, iv, 1);
+
+  if (k < 0)
+    return 1;
+
+  for (int s=0; s<CACHE_SLOTS; s++)
+    if ( (__atomic_load_n(&c->slots[s].state, __ATOMIC_ACQUIRE) >= CACHE_READY) && (c->slots[s].iv == (uint32_t) k) && 
+         !memcmp(c->slots[s].m0, m0, 128) && !memcmp(c->slots[s].m1, m1, 128) )
+      return 2;
+
+  for (int pass = 0; pass < 2; pass++)
+    for (int s=0; s<CACHE_SLOTS; s++) {
+
+      state = pass ? CACHE_TAKEN : CACHE_FREE;
+      if ( !__atomic_compare_exchange_n(&c->slots[s].state, &state, CACHE_FILLING, 0, __ATOMIC_ACQ_REL, 
+                                        __ATOMIC_RELAXED) )
+        continue;
+
+      c->slots[s].iv = k;
+      c->slots[s].seed = seed;
+      c->slots[s].taken = 0;
+      memcpy(c->slots[s].m0, m0, 128);
+      memcpy(c->slots[s].m1, m1, 128);
+      __atomic_store_n(&c->slots[s].state, CACHE_READY, __ATOMIC_RELEASE);
+      __atomic_fetch_add(&c->ivs[k].ready, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+
+  return 1;
+}
+
+
+//Refills the cache in fname forever, at idle priority: searches a collision for the IV with the most requests among
+//the ones with less than target collisions ready. The IV in use is added to the cache first.
+int cache_refill(const char * fname, int target, uint32_t seed) {
+
+  struct sched_param param = { 0 };
+  cache_map c;
+  uint32_t iv[4] = { IV1, IV2, IV3, IV4 };
+  const char * results[] = { "", ", CACHE FULL", ", ALREADY IN THE CACHE" };
+  uint64_t requests, best, n;
+  uint32_t s;
+  double t;
+  int k, result, waiting = 0;
+
+  if (cache_open(&c, fname)) {
+    printf("Can't open the cache %s\n", fname);
+    return 1;
+  }
+  cache_iv_index(&c, iv, 1);
+
+  //The search threads inherit the policy: they only run when the CPUs have nothing else to do
+  if (sched_setscheduler(0, SCHED_IDLE, &param) && (nice(19) == -1))
+    printf("The priority of the refill can't be lowered\n");
+
+  printf("Refilling %s to %d collisions per IV, at idle priority with %d thread(s)\n\n", fname, target, 
+         search_threads);
+  fflush(stdout);
+
+  for ( ; ; ) {
+
+    k = -1;
+    best = 0;
+    for (int i=0; i<CACHE_IVS; i++) {
+      requests = c.ivs[i].hits + c.ivs[i].misses;
+      if ( c.ivs[i].used && (c.ivs[i].ready < (uint32_t) target) && ((k < 0) || (requests > best)) ) {
+        k = i;
+        best = requests;
+      }
+    }
+
+    if (k < 0) {
+      if (!waiting)
+        printf("Every IV has %d collisions, waiting for requests\n", target);
+      fflush(stdout);
+      waiting = 1;
+      sleep(CACHE_POLL);
+      continue;
+    }
+    waiting = 0;
+
+    //The position of the seeds is kept in the cache, across refills and for the ones running at the same time
+    n = __atomic_fetch_add(&c.header->searches, 1, __ATOMIC_RELAXED);
+    X = s = mix(seed + (uint32_t) n);
+    memcpy(iv, c.ivs[k].iv, sizeof(iv));
+    IV1 = iv[0]; IV2 = iv[1];
+    IV3 = iv[2]; IV4 = iv[3];
+
+    t = now();
+    if ( (parallel_search(1, search_threads, NULL) != 0) || (parallel_search(2, search_threads, NULL) != 0) )
+      continue;
+
+    t = now() - t;
+    result = cache_put(&c, iv, s, v1, v2);
+    printf("IV 0x%08X,0x%08X,0x%08X,0x%08X (%llu requests): %u of %d collisions ready, %.2f sec with seed %08X%s\n", 
+           iv[0], iv[1], iv[2], iv[3], (unsigned long long) best, c.ivs[k].ready, target, t, s, results[result]);
+    fflush(stdout);
+
+    //Requests free the slots they take
+    if (result == 1)
+      sleep(CACHE_POLL);
+  }
+
+  cache_close(&c);
+  return 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                         STAGES                           //
+///////////////////////////////////////////////////////////////
+
+//Near-collision of --stage: block 1 of message 1, the IV it was found from and the intermediate hash values A0..D0 of
+//message 1 and A1..D1 of message 2. The file holds these 28 words in little-endian, so other tools can write it.
+typedef struct {
+  uint32_t x[16], iv[4], ihv[8];
+} stage_state;
+
+
+//Writes the near-collision of block 1 found from the IV in use. Returns 1 if it can't be written.
+int stage_write(const char * fname) {
+
+  stage_state nc = { .iv = { IV1, IV2, IV3, IV4 }, .ihv = { A0, B0, C0, D0, A1, B1, C1, D1 } };
+  FILE * f = fopen(fname, "wb");
+
+  memcpy(nc.x, v1, 64);
+  if (f == NULL)
+    return 1;
+  return (fwrite(&nc, sizeof(nc), 1, f) != 1) | (fclose(f) != 0);
+}
+
+
+//Reads the near-collision of --stage block2 into the blocks 1 of both messages and A0..D0, A1..D1, and its IV into iv.
+//The values are computed again from x, since the file may come from another tool. Returns 1 if the file can't be 
+//read, 2 if x doesn't give the values of the file, 3 if they aren't a near-collision, 4 if A0..D0 don't meet the
+//conditions block 2 starts from (its search would never end).
+int stage_read(const char * fname, uint32_t * iv) {
+
+  stage_state nc;
+  md5_stream m;
+  uint32_t AA1, BB1, CC1, DD1;
+  FILE * f = fopen(fname, "rb");
+
+  if (f == NULL)
+    return 1;
+  if ( (fread(&nc, sizeof(nc), 1, f) != 1) | (fclose(f) != 0) )
+    return 1;
+
+  md5_init(&m, nc.iv[0], nc.iv[1], nc.iv[2], nc.iv[3]);
+  md5_update(&m, (uint8_t *) nc.x, 64);
+  message2_ihv(nc.x, 0x00008000, nc.iv[0], nc.iv[1], nc.iv[2], nc.iv[3], &AA1, &BB1, &CC1, &DD1);
+
+  if ( memcmp(m.state, nc.ihv, 16) || (AA1 != nc.ihv[4]) || (BB1 != nc.ihv[5]) || (CC1 != nc.ihv[6]) || 
+       (DD1 != nc.ihv[7]) )
+    return 2;
+
+  if ( ((AA1 - nc.ihv[0]) != 0x80000000) || ((BB1 - nc.ihv[1]) != 0x82000000) || 
+       ((CC1 - nc.ihv[2]) != 0x82000000) || ((DD1 - nc.ihv[3]) != 0x82000000) )
+    return 3;
+
+  if (!block1_ihv_ok(nc.ihv[1], nc.ihv[2], nc.ihv[3]))
+    return 4;
+
+  A0 = nc.ihv[0];  B0 = nc.ihv[1];  C0 = nc.ihv[2];  D0 = nc.ihv[3];
+  A1 = nc.ihv[4];  B1 = nc.ihv[5];  C1 = nc.ihv[6];  D1 = nc.ihv[7];
+  memcpy(v1, nc.x, 64);
+  memcpy(v2, Hx, 64);
+  memcpy(iv, nc.iv, 16);
+  return 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+///                    MICROBENCHMARK                        //
+///////////////////////////////////////////////////////////////
+
+//Inputs of --microbench: the blocks of the collision found with seed 0x00000001 and the standard IV
+const uint32_t mb_block1[16] = { 0xc88dbeaa, 0xf0a8ac6d, 0x9bc1b740, 0x72e60ff2, 0x89b88fd6, 0x91e1df7b, 0xc22eb374, 0xfe56eb3c,
+                                 0x06346d55, 0x02740c05, 0x7f72a8ef, 0x5b11b4e2, 0xae0994de, 0xaa2adcd6, 0x034c7e2f, 0x8765ed67 };
+const uint32_t mb_block2[16] = { 0x964d8503, 0xff0a3978, 0xc9e0bc2f, 0x9408e4e5, 0xc5e69589, 0x0d48687b, 0x5719fcea, 0xed1e1acc,
+                                 0x5ab7c7cd, 0x85cfb6a3, 0x2a61ee16, 0x7d318492, 0xa30970b3, 0x5a33d874, 0xfc969f84, 0x4fd3d655 };
+
+//Every building block is timed on MB_INPUTS variants of the inputs, in turn. A measurement runs the block at least
+//MB_MIN_TIME seconds, and the median of MB_REPEATS measurements is reported.
+#define MB_INPUTS   256
+#define MB_MIN_TIME 0.05
+#define MB_REPEATS  7
+
+//Results of the blocks are accumulated here, so the compiler can't remove them
+volatile uint32_t mb_sink;
+
+//Computes the states Q[-3..64] of MD5 for the block x and the chaining value A,B,C,D
+void md5_steps(uint32_t * Q, const uint32_t * x, uint32_t A, uint32_t B, uint32_t C, uint32_t D) {
+
+  uint32_t f;
+  int i, k;
+
+  Q[-3] = A;  Q[0] = B;
+  Q[-1] = C;  Q[-2] = D;
+
+  for (i=1; i<=64; i++) {
+    switch ((i - 1) / 16) {
+      case 0:  f = F(Q[i-1], Q[i-2], Q[i-3]); k = i - 1;                 break;
+      case 1:  f = G(Q[i-1], Q[i-2], Q[i-3]); k = (5 * i - 4) % 16;      break;
+      case 2:  f = H(Q[i-1], Q[i-2], Q[i-3]); k = (3 * i + 2) % 16;      break;
+      default: f = I(Q[i-1], Q[i-2], Q[i-3]); k = (7 * (i - 1)) % 16;    break;
+    }
+    f += Q[i-4] + x[k] + md5_T[i-1];
+    Q[i] = Q[i-1] + RL(f, md5_S[(i - 1) / 16][(i - 1) % 4]);
+  }
+}
+
+
+//Times the statement op, which uses the input v, and prints the median ns per run and runs per second.
+//The number of runs of a measurement is doubled until it lasts MB_MIN_TIME.
+#define MICROBENCH(name, op) {                                                              \
+  double t, ns[MB_REPEATS];                                                                 \
+  uint64_t runs = MB_INPUTS, r;                                                             \
+  for (int m = -1; m < MB_REPEATS; m++) {                                                   \
+    do {                                                                                    \
+      t = now();                                                                            \
+      for (r = 0; r < runs; r++) {                                                          \
+        uint32_t v = r & (MB_INPUTS - 1);                                                   \
+        op;                                                                                 \
+      }                                                                                     \
+      t = now() - t;                                                                        \
+    } while ( (m == -1) && (t < MB_MIN_TIME) && (runs *= 2) );                              \
+    if (m >= 0)                                                                             \
+      ns[m] = 1e9 * t / runs;                                                               \
+  }                                                                                         \
+  qsort(ns, MB_REPEATS, sizeof(double), compare_double);                                    \
+  printf("  %-24s %10.2f %10.2f %14.0f\n", name, ns[MB_REPEATS / 2], ns[0], 1e9 / ns[MB_REPEATS / 2]); }
+
+
+//Times the building blocks of the search on fixed inputs. Returns 1 if the inputs don't satisfy the conditions.
+int microbench() {
+
+  uint32_t q1[68], q2[68], * Q1 = q1 + 3, * Q2 = q2 + 3, Q[65], x[MB_INPUTS][16], x2[MB_INPUTS][16];
+  uint32_t cv[4], unmasked[MB_INPUTS], mask[1 << 12], adm[512], seed = X;
+  uint32_t AA1, BB1, CC1, DD1;
+  static const int32_t Q13_mask_bits[] = {2,3,5,7,10,11,12,21,22,23,28,29};
+  static const int32_t Q14_mask_bits[] = {1, 2, 3, 5, 6, 7, 27, 28, 29};
+  static uint32_t mask_Q14[1 << 9];
+
+  generate_mask(mask_Q14, 9, Q14_mask_bits);
+
+  //The collision was found for the standard IV
+  IV1 = bench_ivs[0][0]; IV2 = bench_ivs[0][1];
+  IV3 = bench_ivs[0][2]; IV4 = bench_ivs[0][3];
+
+  //States of the two blocks of the collision, that satisfy all the conditions of the path
+  md5_steps(Q1, mb_block1, IV1, IV2, IV3, IV4);
+  cv[0] = IV1 + Q1[61];  cv[1] = IV2 + Q1[64];
+  cv[2] = IV3 + Q1[63];  cv[3] = IV4 + Q1[62];
+  md5_steps(Q2, mb_block2, cv[0], cv[1], cv[2], cv[3]);
+
+  memcpy(Q, Q1, sizeof(Q));
+  if (!Block1_Q21_Q24(Q, mb_block1, ST_B1_OUTER) || !Block1_tail(Q, mb_block1)) 
+    return 1;
+  memcpy(Q, Q2, sizeof(Q));
+  if (!Block2_tail(Q, mb_block2)) 
+    return 1;
+
+  //Input 0 is the block itself. The others change x[9], that is first used by step 25, so most of them are rejected 
+  //by the first conditions of the tail, as in the search. x[5] is changed in the same way for the Q[21..24] filter
+  //(step 21), that reads its own copy.
+  for (int v=0; v<MB_INPUTS; v++) {
+    memcpy(x[v], mb_block1, sizeof(mb_block1));
+    memcpy(x2[v], mb_block2, sizeof(mb_block2));
+    x[v][9]  += v * 0x9e3779b9;
+    x2[v][9] += v * 0x9e3779b9;
+  }
+
+  //The values of const_unmasked with bits 8..26 all 0 or all 1, the only ones whose admissible values are searched
+  for (int v=0; v<MB_INPUTS; v++)
+    unmasked[v] = (mix(v) & 0xfc00007f) | ((v & 1) ? 0x03ffff80 : 0);
+
+  printf("\nMicrobenchmark on fixed inputs (%d variants of the collision of seed 0x00000001)\n", MB_INPUTS);
+  printf("Compiled for: "
+#if defined(__AVX512F__)
+         "x86 AVX-512"
+#elif defined(__AVX2__)
+         "x86 AVX2"
+#elif defined(__SSE4_2__)
+         "x86 SSE4.2"
+#elif defined(__x86_64__) || defined(__i386__)
+         "x86 baseline"
+#elif defined(__ARM_NEON)
+         "ARM NEON"
+#else
+         "generic"
+#endif
+         "\n\n");
+
+  printf("  %-24s %10s %10s %14s\n", "block", "ns/op", "min ns/op", "ops/sec");
+
+  MICROBENCH("HMD5Tr", {
+    memcpy(Hx, x[v], sizeof(Hx));
+    a = IV1; b = IV2; c = IV3; d = IV4;
+    HMD5Tr();
+    mb_sink += a;
+  });
+
+  MICROBENCH("rng", mb_sink += rng() + v);
+
+  MICROBENCH("generate_mask (Q13)", {
+    generate_mask(mask, 12, Q13_mask_bits);
+    mb_sink += mask[v];
+  });
 
+  MICROBENCH("Q14_admissible", mb_sink += Q14_admissible(unmasked[v], mask_Q14, adm));
 
-  //We extract the 32th bit of B0 and its
-  I     =    QM0  & 0x80000000; 
-  not_I =  (~QM0) & 0x80000000;
+  {
+    uint32_t x5[MB_INPUTS][16];
+    for (int v=0; v<MB_INPUTS; v++) {
+      memcpy(x5[v], mb_block1, sizeof(mb_block1));
+      x5[v][5] += v * 0x9e3779b9;
+    }
+    memcpy(Q, Q1, sizeof(Q));
+    MICROBENCH("Q21-Q24 filter", mb_sink += Block1_Q21_Q24(Q, x5[v], ST_B1_OUTER));
+  }
 
-  //Start block 2 generation. 
-  //TO-DO: add a time limit for collision search.
-  for ( ; ; ) {   
-  
-    // Q[ 1] = ~Ivvv  010v  vv1v  vvv1  .vvv  0vvv  vv0.  ...v 
-    // RNG   =  .***  ...*  **.*  ***.  ****  .***  **.*  ****  0x71def7df
-    // 0     =  ....  *.*.  ....  ....  ....  *...  ..*.  ....  0x0a000820
-    // 1     =  ....  .*..  ..*.  ...*  ....  ....  ....  ....  0x04210000
-    Q[1] = (rng() & 0x71def7df) + 0x04210000 + not_I;
+  memcpy(Q, Q1, sizeof(Q));
+  MICROBENCH("Block1 tail (Q25-Q64)", mb_sink += Block1_tail(Q, x[v]));
 
-    // Multi message modif. meth. (MMMM) Q1Q2, Klima
-    // Q[ 2] = ~I^^^  110^  ^^0^  ^^^1  0^^^  1^^^  ^^0v  v00^ 
-    // RNG   =  ....  ....  ....  ....  ....  ....  ...*  *...  0x00000018
-    // 0     =  ....  ..*.  ..*.  ....  *...  ....  ..*.  .**.  0x02208026
-    // 1     =  ....  **..  ....  ...*  ....  *...  ....  ....  0x0c010800
-    // Q[ 1] =  .***  ...*  **.*  ***.  .***  .***  **..  ...*  0x71de77c1
-    Q[2] = (rng() & 0x00000018) + 0x0c010800 + (Q[1] & 0x71de77c1) + not_I;
+  memcpy(Q, Q2, sizeof(Q));
+  MICROBENCH("Block2 tail (Q25-Q64)", mb_sink += Block2_tail(Q, x2[v]));
 
-    // Q[ 3] = ~I011  111.  ..01  1111  1..0  1vv1  011^  ^111 
-    // RNG   =  ....  ...*  **..  ....  .**.  .**.  ....  ....  0x01c06600
-    // 0     =  .*..  ....  ..*.  ....  ...*  ....  *...  ....  0x40201080
-    // 1     =  ..**  ***.  ...*  ****  *...  *..*  .**.  .***  0x3e1f8967
-    // Q[ 2] =  ....  ....  ....  ....  ....  ....  ...*  *...  0x00000018
-    Q[3] = (rng() & 0x01c06600) + 0x3e1f8967 + (Q[2] & 0x00000018) + not_I;
+  MICROBENCH("differential check", {
+    message2_ihv(x[v], 0x00008000, IV1, IV2, IV3, IV4, &AA1, &BB1, &CC1, &DD1);
+    mb_sink += ((AA1 - cv[0]) == 0x80000000) && ((BB1 - cv[1]) == 0x82000000) && 
+               ((CC1 - cv[2]) == 0x82000000) && ((DD1 - cv[3]) == 0x82000000);
+  });
 
-    // Q[ 4] = ~I011  101.  ..00  0100  ...0  0^^0  0001  0001 
-    // RNG   =  ....  ...*  **..  ....  ***.  ....  ....  ....  0x01c0e000
-    // 0     =  .*..  .*..  ..**  *.**  ...*  *..*  ***.  ***.  0x443b19ee
-    // 1     =  ..**  *.*.  ....  .*..  ....  ....  ...*  ...*  0x3a040011
-    // Q[ 3] =  ....  ....  ....  ....  ....  .**.  ....  ....  0x00000600
-    Q[4] = (rng() & 0x01c0e000) + 0x3a040011 + (Q[3] & 0x00000600) + not_I;
+  //The tails count their conditions in the statistics and rng() moved the seed
+  memset(&stats, 0, sizeof(stats));
+  X = seed;
 
-    // Q4 tunnel, Klima, bits 25-23,16-14
-    // Q[ 5] =  I100  10.0  0010  1111  0000  1110  0101  0000 
-    // RNG   =  ....  ..*.  ....  ....  ....  ....  ....  ....  0x02000000
-    // 0     =  ..**  .*.*  **.*  ....  ****  ...*  *.*.  ****  0x35d0f1af
-    // 1     =  .*..  *...  ..*.  ****  ....  ***.  .*.*  ....  0x482f0e50
-    Q[5] = (rng() & 0x02000000) + 0x482f0e50 + I;
+  return 0;
+}
 
-    // Q4 tunnel, Klima, bits 25-23,16-14
-    // Q[ 6] =  I..0  0101  1110  ..10  1110  1100  0101  0110 
-    // RNG   =  .**.  ....  ....  **..  ....  ....  ....  ....  0x600c0000
-    // 0     =  ...*  *.*.  ...*  ...*  ...*  ..**  *.*.  *..*  0x1a1113a9
-    // 1     =  ....  .*.*  ***.  ..*.  ***.  **..  .*.*  .**.  0x05e2ec56
-    Q[6] = (rng() & 0x600c0000) + 0x05e2ec56 + I;
 
-    // Q[ 7] = ~I..1  0111  1.00  ..01  10.1  1110  00..  ..v1 
-    // RNG   =  .**.  ....  .*..  **..  ..*.  ....  ..**  ***.  0x604c203e
-    // 0     =  ....  *...  ..**  ..*.  .*..  ...*  **..  ....  0x083241c0
-    // 1     =  ...*  .***  *...  ...*  *..*  ***.  ....  ...*  0x17819e01
-    Q[7] = (rng() & 0x604c203e) + 0x17819e01 + not_I;
-     
-    // Q[ 8] = ~I..0  0100  0.11  ..10  1..v  ..11  111.  ..^0 
-    // RNG   =  .**.  ....  .*..  **..  .***  **..  ...*  **..  0x604c7c1c
-    // 0     =  ...*  *.**  *...  ...*  ....  ....  ....  ...*  0x1b810001
-    // 1     =  ....  .*..  ..**  ..*.  *...  ..**  ***.  ....  0x043283e0
-    // Q[ 7] =  ....  ....  ....  ....  ....  ....  ....  ..*.  0x00000002
-    Q[8] = (rng() & 0x604c7c1c) + 0x043283e0 + (Q[7] & 0x00000002) + not_I;
+///////////////////////////////////////////////////////////////
+///                   SCALING BENCHMARK                      //
+///////////////////////////////////////////////////////////////
 
-    // Q9 tunnel plus MMMM-Q12Q11, Klima, prepared, not programmed
-    // Q[ 9] = ~Ivv1  1100  0xxx  .x01  0..^  .x01  110x  xx01 
-    // RNG   =  .**.  ....  .***  **..  .**.  **..  ...*  **..  0x607c6c1c
-    // 0     =  ....  ..**  *...  ..*.  *...  ..*.  ..*.  ..*.  0x03828222
-    // 1     =  ...*  **..  ....  ...*  ....  ...*  **..  ...*  0x1c0101c1
-    // Q[ 8] =  ....  ....  ....  ....  ...*  ....  ....  ....  0x00001000
-    Q[9] = (rng() & 0x607c6c1c) + 0x1c0101c1 + (Q[8] & 0x00001000) + not_I;
+//Runs both blocks on 1 to max_threads search threads, for trial_time seconds each, and reports for every level the 
+//iterations per second, the speedup over 1 thread and the parallel efficiency (speedup / threads). Block 1 starts from
+//the standard IV and Block 2 from the chaining value of the --microbench collision. The results are also written to
+//json_file. Returns 1 if it can't be written.
+int scaling(int max_threads, double trial_time, const char * json_file) {
 
-    // Q9 tunnel plus MMMM-Q12Q11, Klima
-    // Q[10] = ~I^^1  1111  1000  v011  1vv0  1011  1100  0000 
-    // RNG   =  ....  ....  ....  *...  .**.  ....  ....  ....  0x00086000
-    // 0     =  ....  ....  .***  .*..  ...*  .*..  ..**  ****  0x0074143f
-    // 1     =  ...*  ****  *...  ..**  *...  *.**  **..  ....  0x1f838bc0
-    // Q[ 9] =  .**.  ....  ....  ....  ....  ....  ....  ....  0x60000000
-    Q[10] = (rng() & 0x00086000) + 0x1f838bc0 + (Q[ 9] & 0x60000000) + not_I;
+  uint32_t Q[68];
+  double (* rate)[STAGES_NUMBER] = malloc((max_threads + 1) * sizeof(* rate)), speedup;
+  int first, last;
+  FILE * f;
 
-    // Q9 tunnel plus MMMM-Q12Q11, Klima
-    // Q[11] = ~Ivvv  vvvv  .111  ^101  1^^0  0111  11v1  1111 
-    // RNG   =  .***  ****  *...  ....  ....  ....  ..*.  ....  0x7f800020
-    // 0     =  ....  ....  ....  ..*.  ...*  *...  ....  ....  0x00021800
-    // 1     =  ....  ....  .***  .*.*  *...  .***  **.*  ****  0x007587df
-    // Q[10] =  ....  ....  ....  *...  .**.  ....  ....  ....  0x00086000
-    Q[11] = (rng() & 0x7f800020) + 0x007587df + (Q[10] & 0x00086000) + not_I;
+  X = 1;
+  IV1 = bench_ivs[0][0]; IV2 = bench_ivs[0][1];
+  IV3 = bench_ivs[0][2]; IV4 = bench_ivs[0][3];
 
-    // MMMM-Q12Q11, Klima
-    // Q[12] = ~I^^^  ^^^^  ....  1000  0001  ....  1.^.  .... 
-    // RNG   =  ....  ....  ****  ....  ....  ****  .*.*  ****  0x00f00f5f
-    // 0     =  ....  ....  ....  .***  ***.  ....  ....  ....  0x0007e000
-    // 1     =  ....  ....  ....  *...  ...*  ....  *...  ....  0x00081080
-    // Q[11] =  .***  ****  ....  ....  ....  ....  ..*.  ....  0x7f000020
-    Q[12] = (rng() & 0x00f00f5f) + 0x00081080 + (Q[11] & 0x7f000020) + not_I;
+  md5_steps(Q + 3, mb_block1, IV1, IV2, IV3, IV4);
+  A0 = IV1 + Q[64]; B0 = IV2 + Q[67];
+  C0 = IV3 + Q[66]; D0 = IV4 + Q[65];
+  message2_ihv(mb_block1, 0x00008000, IV1, IV2, IV3, IV4, &A1, &B1, &C1, &D1);
 
-    // Q[13] =  I011  1111  0...  1111  111.  ....  0...  1... 
-    // RNG   =  ....  ....  .***  ....  ...*  ****  .***  .***  0x00701f77
-    // 0     =  .*..  ....  *...  ....  ....  ....  *...  ....  0x40800080
-    // 1     =  ..**  ****  ....  ****  ***.  ....  ....  *...  0x3f0fe008
-    Q[13] = (rng() & 0x00701f77) + 0x3f0fe008 + I;
+  printf("\nScaling from 1 to %d threads (pinning: %s, %.1f sec per trial)\n", max_threads, pin_names[pin_mode], 
+         trial_time);
 
-    // Q[14] =  I100  0000  1...  1011  111.  ....  1...  1... 
-    // RNG   =  ....  ....  .***  ....  ...*  ****  .***  .***  0x00701f77
-    // 0     =  ..**  ****  ....  .*..  ....  ....  ....  ....  0x3f040000
-    // 1     =  .*..  ....  *...  *.**  ***.  ....  *...  *...  0x408be088
-    Q[14] = (rng() & 0x00701f77) + 0x408be088 + I;
+  for (int t=1; t<=max_threads; t++) {
 
-    // Next sufficient conditions until Q[24]:
-    // Q[15] =  0111  1101  ....  ..10  00..  ....  ....  0... 
-    // Q[16] =  ^.10  ....  ....  ..01  1...  ....  ....  1... 
-    // Q[17] =  ^.v.  ....  ....  ..0.  1...  ....  ....  1... 
-    // Q[18] =  ^.^.  ....  ....  ..1.  ....  ....  ....  .... 
-    // Q[19] =  ^...  ....  ....  ..0.  ....  ....  ....  .... 
-    // Q[20] =  ^...  ....  ....  ..v.  ....  ....  ....  .... 
-    // Q[21] =  ^...  ....  ....  ..^.  ....  ....  ....  .... 
-    // Q[22] =  ^...  ....  ....  ....  ....  ....  ....  ....   
-    // Q[23] =  0...  ....  ....  ....  ....  ....  ....  ....   
-    // Q[24] =  1...  ....  ....  ....  ....  ....  ....  ....   
+    search_threads = t;
 
-    //In MMMM-Q[1]/Q[2] we want to change the value of x[0] without updating the value of x[1], as updating x[1] will cause
-    //conditions on Q[17] not hold. According to F, if QM0[i] = QM1[i] randomly choose the value where
-    //Q[1][i] = Q[2][i] will not change the value of F(Q[1],QM0,QM1). We select these bits
-    // Q[ 1] = ~Ivvv  010v  vv1v  vvv1  .vvv  0vvv  vv0.  ...v 
-    // Q[ 2] = ~I^^^  110^  ^^0^  ^^^1  0^^^  1^^^  ^^0v  v00^ 
-    //          0111  0001  1101  1110  0111  0111  1100  0001 = 0x71de77c1
-    //
-    //Note that (~(QM0 ^ QM1)) are all the bits where QM0[i] = QM1[i] and so mask_Q1Q2 are all the bits 
-    //where QM0[i] = QM1[i] and where Q[1][i] = Q[2][i]. These bits will be changed.
-    mask_Q1Q2 = (~(QM0 ^ QM1)) & 0x71de77c1 ;
-    Q1Q2_strength = 0;
-    for ( i=1; i<33; i++ ) 
-      Q1Q2_strength += bit(mask_Q1Q2,i);
+    tunnel_trial(1, tunnels, trial_time);
+    for (int s = ST_B1_OUTER; s <= ST_B1_DIFF; s++)
+      rate[t][s] = stats.stage_itr[s] / trial_elapsed;
 
-    Q1_fix = Q[1] & ~mask_Q1Q2;
-    Q2_fix = Q[2] & ~mask_Q1Q2;
+    tunnel_trial(2, tunnels, trial_time);
+    for (int s = ST_B2_Q16; s <= ST_B2_DIFF; s++)
+      rate[t][s] = stats.stage_itr[s] / trial_elapsed;
 
-    tmp_q1 = Q[1]; 
-    tmp_q2 = Q[2]; 
-    tmp_q4 = Q[4]; 
-    tmp_q9 = Q[9]; 
+    printf("  %3d threads: %14.0f block 1 and %14.0f block 2 tail candidates/sec\n", t, rate[t][ST_B1_Q9], 
+           rate[t][ST_B2_Q9]);
+    fflush(stdout);
+  }
 
-    ///////////////////////////////////////////////////////////////
-    ///                        MMMM Q16                          //
-    ///////////////////////////////////////////////////////////////
-    //MMMM Q16 - 25 bits           
-    for(itr_q16= 0; itr_q16 < pow(2,25); itr_q16++) {
+  memset(&stats, 0, sizeof(stats));
 
-      Q[1] = tmp_q1;
-      Q[2] = tmp_q2;
-      Q[4] = tmp_q4;
-      Q[9] = tmp_q9;
+  for (int block = 1; block <= 2; block++) {
 
-      // Conditions by Liang-Lai says: Q[15] = (rng() & 0x80fc3ff7) + 0x7d020000, 
-      // Q[15] =  0111  1101  ....  ..10  00..  ....  ....  0... 
-      // RNG   =  ....  ....  ****  **..  ..**  ****  ****  .***  0x80fc3ff7
-      // 0     =  *...  ..*.  ....  ...*  **..  ....  ....  *...  0x0201c008
-      // 1     =  .***  **.*  ....  ..*.  ....  ....  ....  ....  0x7d020000
-      Q[15] = (rng() & 0x00fc3ff7) + 0x7d020000;
+    first = (block == 1) ? ST_B1_OUTER : ST_B2_Q16;
+    last = (block == 1) ? ST_B1_DIFF : ST_B2_DIFF;
 
-      // Q[16] =  ^.10  ....  ....  ..01  1...  ....  ....  1... 
-      // RNG   =  .*..  ****  ****  **..  .***  ****  ****  .***  0x4ffc7ff7
-      // 0     =  ...*  ....  ....  ..*.  ....  ....  ....  ....  0x10020000
-      // 1     =  ..*.  ....  ....  ...*  *...  ....  ....  *...  0x20018008
-      // Q[15] =  *.... ..... ..... .... ..... ..... ...... ....  0x80000000
-      Q[16] = (rng() & 0x4ffc7ff7) + 0x20018008 + (Q[15] & 0x80000000);
+    printf("\nBlock %d\n  %7s  %-18s %14s %8s %10s\n", block, "Threads", "Level", "Iterations/sec", "Speedup", 
+           "Efficiency");
+    for (int t=1; t<=max_threads; t++)
+      for (int s = first; s <= last; s++) {
+        speedup = rate[1][s] ? rate[t][s] / rate[1][s] : 0;
+        printf("  %7d  %-18s %14.0f %8.2f %9.1f%%\n", t, stage_names[s], rate[t][s], speedup, 100 * speedup / t);
+      }
+  }
 
-      x[ 1] = RR(Q[ 2] - Q[ 1], 12) - F(Q[ 1],   QM0,   QM1) -   QM2 - 0xe8c7b756;
-      x[ 6] = RR(Q[ 7] - Q[ 6], 17) - F(Q[ 6], Q[ 5], Q[ 4]) - Q[ 3] - 0xa8304613;
-      x[11] = RR(Q[12] - Q[11], 22) - F(Q[11], Q[10], Q[ 9]) - Q[ 8] - 0x895cd7be;
+  f = fopen(json_file, "w");
+  if (f == NULL) {
+    free(rate);
+    return 1;
+  }
 
-      // Q[17] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-      // Extra conditions: Σ17,25 ~ Σ17,27 not all 1  
-      // 0x07000000 =  0000 0111 0000 0000 0000 0000 0000 0000 
-      sigma_Q17 = G(Q[16], Q[15], Q[14]) + Q[13] + x[1] + 0xf61e2562;
-      if ( (sigma_Q17 & 0x07000000) == 0x07000000 ) 
-        continue;
+  fprintf(f, "{\n  \"pin\": \"%s\",\n  \"trial_time\": %.3f,\n  \"tunnels\": %u,\n  \"threads\": [\n", 
+          pin_names[pin_mode], trial_time, tunnels);
+  for (int t=1; t<=max_threads; t++) {
+    fprintf(f, "    { \"threads\": %d, \"levels\": {\n", t);
+    for (int s = 0; s < STAGES_NUMBER; s++) {
+      speedup = rate[1][s] ? rate[t][s] / rate[1][s] : 0;
+      fprintf(f, "        \"%s\": { \"rate\": %.1f, \"speedup\": %.4f, \"efficiency\": %.4f }%s\n", stage_names[s], 
+              rate[t][s], speedup, speedup / t, (s == STAGES_NUMBER - 1) ? "" : ",");
+    }
+    fprintf(f, "      } }%s\n", (t == max_threads) ? "" : ",");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
 
-      // Q[16] =  ^.10  ....  ....  ..01  1...  ....  ....  1... 
-      // Q[17] =  ^.v.  ....  ....  ..0.  1...  ....  ....  1... 
-      //          1000  0000  0000  0010  1000  0000  0000  1000 0x80028008  
-      Q[17] = Q[16] + RL(sigma_Q17, 5);
-      
-      if ( (Q[17] & 0x80028008) != (Q[16] & 0x80028008) ) 
-        continue;
+  printf("\nScaling written to %s\n", json_file);
 
-      // Q[18] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-      Q[18] = Q[17] + RL(G(Q[17], Q[16], Q[15]) + Q[14] + x[6] + 0xc040b340, 9);
-      
-      // Q[18] =  ^.^.  ....  ....  ..1.  ....  ....  ....  .... 
-      if (bit(Q[18],18) != 1) 
-        continue;
+  free(rate);
+  return 0;
+}
 
-      if ( (Q[18] & 0xa0000000) != (Q[17] & 0xa0000000) ) 
-        continue;
 
-      // Q[19] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-      // Extra conditions: Σ19,4 ~ Σ19,18 not all 1  
-      // 0x0003fff8 =  0000 0000 0000 0011 1111 1111 1111 1000 
-      sigma_Q19 = G(Q[18], Q[17], Q[16]) + Q[15] + x[11] + 0x265e5a51;
-      if ( (sigma_Q19 & 0x0003fff8) == 0x0003fff8 ) 
-        continue;
+int main ( int argc, char *argv[] ) {
 
-      Q[19] = Q[18] + RL(sigma_Q19, 14);
+  //Filenames of summary, and collisions m1, m2
+  char summary[64], m1_file[64], m2_file[64];
 
-      // Q[19] =  ^...  ....  ....  ..0.  ....  ....  ....  .... 
-      if ( bit(Q[19],18) != 0 ) 
-        continue;
+  //Statistics of the search
+  search_stats total_stats;
 
-      if ( bit(Q[19],32) != bit(Q[18],32) ) 
-        continue;
-     
-      x[10] = RR(Q[11] - Q[10], 17) - F(Q[10], Q[ 9], Q[ 8]) - Q[ 7] - 0xffff5bb1;
-      x[15] = RR(Q[16] - Q[15], 22) - F(Q[15], Q[14], Q[13]) - Q[12] - 0x49b40821;
+  //Wall time of the start of the search
+  double search_start;
+  double B1_time=0, B2_time=0, link_time;
+  uint8_t * p;
 
-      ///////////////////////////////////////////////////////////////
-      ///                      MMMM Q1/Q2                          //
-      ///////////////////////////////////////////////////////////////
-      //MMMM Q1/Q2 - variable bits
-      for(itr_q1q2 = 0; itr_q1q2 < pow(2,Q1Q2_strength); itr_q1q2++) {
+  //Arguments that are not options: args[1..nargs-1] are the HEXnums
+  char * args[6];
+  int nargs = 1;
 
-        Q[4] = tmp_q4;
-        Q[9] = tmp_q9;
+  //Seconds of every autotuning trial (0 = no autotuning)
+  double autotune_time = 0;
 
-        //We randomly change the mask bits where QM0[i] = QM1[i] and where Q[1][i] = Q[2][i]
-        Q[1] = (rng() & mask_Q1Q2) + Q1_fix;
-        Q[2] = ( Q[1] & mask_Q1Q2) + Q2_fix;
-        
-        x[0] = RR(Q[1] - QM0, 7) - F(QM0, QM1, QM2) - QM3 - 0xd76aa478;  
-        
-        // Q[20] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        // Extra conditions: Σ20,30 ~ Σ20,32 not all 0  
-        // 0xe0000000 =  1110 0000 0000 0000 0000 0000 0000 0000 
-        sigma_Q20 = G(Q[19], Q[18], Q[17]) + Q[16] + x[0] + 0xe9b6c7aa;
-        if ( (sigma_Q20  & 0xe0000000) == 0 )
-          continue;
-        
-        Q[20] = Q[19] + RL(sigma_Q20, 20);
-        
-        // Q[20] =  ^...  ....  ....  ..v.  ....  ....  ....  ....   
-        if ( bit(Q[20],32) != bit(Q[19],32))
-          continue;
-        
-        // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        x[ 5] = RR(Q[6] - Q[5], 12) - F(Q[5], Q[4], Q[3]) - Q[2] - 0x4787c62a;
-        
-        Q[21] = Q[20] + RL(G(Q[20], Q[19], Q[18]) + Q[17] + x[5] + 0xd62f105d, 5);   
-        
-        // Q[21] =  ^...  ....  ....  ..^.  ....  ....  ....  .... 
-        //          1000  0000  0000  0010  0000  0000  0000  0000 = 0x80020000
-        if ( (Q[21] & 0x80020000) != (Q[20] & 0x80020000) )
-          continue;
-        
-        // Q[21] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        Q[22] = Q[21] + RL(G(Q[21], Q[20], Q[19]) + Q[18] + x[10] + 0x2441453, 9);
-        
-        // Q[22] =  ^...  ....  ....  ....  ....  ....  ....  ....   
-        if ( bit(Q[22],32) != bit(Q[21],32) )
-          continue;
+  //Progress and metrics monitor thread
+  pthread_t monitor;
 
-        // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        // Extra conditions: Σ23,18 = 0  
-        sigma_Q23 = G(Q[22], Q[21], Q[20]) + Q[19] + x[15] + 0xd8a1e681;
-        if ( bit(sigma_Q23,18) != 0 )
-          continue;
-        
-        Q[23] = Q[22] + RL(sigma_Q23, 14);
-        
-        // Q[23] =  0...  ....  ....  ....  ....  ....  ....  ....   
-        if ( bit(Q[23],32) != 0) 
-          continue;
-        
-        // Q[23] ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-        x[ 4] = RR(Q[5] - Q[4], 7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
+  //Runs of --bench, its results and baseline
+  int bench_runs = 0;
+  char * bench_json = "bench_md5.json", * bench_baseline = NULL;
 
-        Q[24] = Q[23] + RL(G(Q[23], Q[22], Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
-        
-        // Q[24] =  1...  ....  ....  ....  ....  ....  ....  ....   
-        if (bit(Q[24],32) != 1)
-          continue;
+  //Building blocks are timed with --microbench
+  int micro = 0;
+
+  //Files before and after the colliding blocks (--prefix, --suffix), and the MD5 and length of the messages
+  char * prefix_file = NULL, * suffix_file = NULL;
+  md5_stream message;
+  uint64_t message_length = 0;
+
+  //Collisions chained with --chain, their description, and the description and files written with --chain-files
+  int chain = 1;
+  FILE * chain_file = NULL;
+  char chain_name[64], * chain_desc = NULL, * chain_which = NULL;
+
+  //Collisions searched with --fanout for the same block 1, and their description
+  int fanout_limit = 1;
+  char fanout_name[64];
+
+  //Collisions searched with --harvest, each with its own block 1, and the searches of block 2 at a time
+  int harvest_limit = 0, harvest_jobs = 1;
+
+  //Archive of the collisions (--archive), archives indexed, searched by IV (and hash) or exported to single files
+  char * archive_file = NULL, * archive_to_index = NULL, * archive_to_find = NULL, * archive_to_export = NULL;
+  char * archive_which = NULL, * find_iv[4], * find_hash = NULL;
+
+  //Archive or directory of pairs verified with --verify
+  char * verify_path = NULL;
+
+  //Cache of collisions tried before searching (--cache, --cache-reuse), or refilled to refill_target per IV
+  char * cache_file = NULL, * refill_file = NULL;
+  int cache_reuse = 0, refill_target = 0, cached = 0, slot;
+  uint32_t cache_seed;
+  double take_time;
+  cache_map cache;
+
+  //Block searched alone with --stage (1 or 2), and the near-collision read by block 2
+  int stage = 0;
+  char * stage_input = NULL;
+  uint32_t stage_iv[4];
+  int failed;
+
+  //Seconds of every trial of --scaling, its results and the maximum number of threads (--threads, or the CPUs)
+  double scaling_time = 0;
+  char * scaling_json = "scaling_md5.json";
+  int max_threads = 0, cpus;
+
+  //List of IVs and prefixes searched with --sweep, the searches at a time and their results
+  char * sweep_list = NULL, * sweep_out = "sweep_md5.bin";
+  int sweep_jobs = 1;
 
-        x[ 2] = RR(Q[ 3] - Q[ 2], 17) - F(Q[ 2], Q[ 1],   QM0) -   QM1 - 0x242070db;
-        x[13] = RR(Q[14] - Q[13], 12) - F(Q[13], Q[12], Q[11]) - Q[10] - 0xfd987193; 
-        x[14] = RR(Q[15] - Q[14], 17) - F(Q[14], Q[13], Q[12]) - Q[11] - 0xa679438e; 
+  for (int i=1; i<argc; i++) {
+
+    if ( (strcmp(argv[i], "--tunnels") == 0) && (i+1 < argc) ) {
+      if (parse_tunnels(argv[++i], &tunnels)) {
+        printf("Unknown tunnel in %s. Tunnels are: B1Q4,B1Q9,B1Q10,B1Q13,B1Q14,B1Q20,B2Q9,B2Q12Q11 (or all, none).\n", argv[i]);
+        return 1;
+      }
+    }
+
+    else if ( (strcmp(argv[i], "--bytes") == 0) && (i+1 < argc) ) {
+      if (parse_bytes(argv[++i])) {
+        printf("Wrong byte rule %s. A rule is [FIRST[-LAST]:][^]SET, e.g. ^00,0a or 64-127:20-7e\n", argv[i]);
+        return 1;
+      }
+    }
+
+    else if ( (strcmp(argv[i], "--autotune") == 0) && (i+1 < argc) ) {
+      autotune_time = atof(argv[++i]);
+      if (autotune_time <= 0) {
+        printf("--autotune needs the seconds of every trial\n");
+        return 1;
+      }
+    }
+
+    else if (strcmp(argv[i], "--perf-stages") == 0)
+      perf_stages = 1;
+
+    else if ( (strcmp(argv[i], "--progress") == 0) && (i+1 < argc) ) {
+      progress_interval = atof(argv[++i]);
+      progress_text = 1;
+    }
+
+    else if ( (strcmp(argv[i], "--bench") == 0) && (i+1 < argc) ) {
+      bench_runs = atoi(argv[++i]);
+      if (bench_runs <= 0) {
+        printf("--bench needs the number of runs\n");
+        return 1;
+      }
+    }
+
+    else if ( (strcmp(argv[i], "--bench-json") == 0) && (i+1 < argc) )
+      bench_json = argv[++i];
+
+    else if ( (strcmp(argv[i], "--bench-baseline") == 0) && (i+1 < argc) )
+      bench_baseline = argv[++i];
+
+    else if (strcmp(argv[i], "--microbench") == 0)
+      micro = 1;
+
+    else if ( (strcmp(argv[i], "--threads") == 0) && (i+1 < argc) ) {
+      max_threads = atoi(argv[++i]);
+      if ( (max_threads <= 0) || (max_threads > MAX_THREADS) ) {
+        printf("--threads needs a number of threads from 1 to %d\n", MAX_THREADS);
+        return 1;
+      }
+    }
 
-        ///////////////////////////////////////////////////////////////
-        ///                         MMMM Q4                          //
-        ///////////////////////////////////////////////////////////////
-        //MMMM Q4 - 6 bits
-        for(itr_q4 = 0; itr_q4 < pow(2,6); itr_q4++) {
+    else if ( (strcmp(argv[i], "--pin") == 0) && (i+1 < argc) ) {
+      i++;
+      for (pin_mode = PIN_NODE; pin_mode > PIN_NONE; pin_mode--)
+        if (strcasecmp(argv[i], pin_names[pin_mode]) == 0)
+          break;
+      if (strcasecmp(argv[i], pin_names[pin_mode])) {
+        printf("--pin needs one of none, core, smt, node\n");
+        return 1;
+      }
+    }
 
-          Q[4] = tmp_q4 ^ mask_Q4[itr_q4];
+    else if ( (strcmp(argv[i], "--scaling") == 0) && (i+1 < argc) ) {
+      scaling_time = atof(argv[++i]);
+      if (scaling_time <= 0) {
+        printf("--scaling needs the seconds of every trial\n");
+        return 1;
+      }
+    }
 
-          x[4] = RR(Q[5] - Q[4], 7) - F(Q[4], Q[3], Q[2]) - Q[1] - 0xf57c0faf;
-          
-          Q[24] = Q[23] + RL(G(Q[23], Q[22], Q[21]) + Q[20] + x[4] + 0xe7d3fbc8, 20);
-          
-          // Q[24] =  1...  ....  ....  ....  ....  ....  ....  ....   
-          if( bit(Q[24], 32) != 1) 
-            continue;
+    else if ( (strcmp(argv[i], "--scaling-json") == 0) && (i+1 < argc) )
+      scaling_json = argv[++i];
 
-          x[3] = RR(Q[4] - Q[3], 22) - F(Q[3], Q[2], Q[1]) -  QM0 - 0xc1bdceee;
-          x[7] = RR(Q[8] - Q[7], 22) - F(Q[7], Q[6], Q[5]) - Q[4] - 0xfd469501;   
+    else if ( (strcmp(argv[i], "--prefix") == 0) && (i+1 < argc) )
+      prefix_file = argv[++i];
 
+    else if ( (strcmp(argv[i], "--suffix") == 0) && (i+1 < argc) )
+      suffix_file = argv[++i];
 
-          ///////////////////////////////////////////////////////////////
-          ///                       Tunnel Q9                          //
-          ///////////////////////////////////////////////////////////////
-          //Tunnel Q9 - 8 bits 
-          for(itr_q9 = 0; itr_q9 < (USE_B2_Q9 ? pow(2,Q9_strength) : 1); itr_q9++ ) {
-            
-            Q[9]= tmp_q9 ^ mask_Q9[USE_B2_Q9 ? itr_q9 : 0];
-            
-            x[ 8] = RR(Q[ 9] - Q[ 8],  7) - F(Q[ 8], Q[ 7], Q[ 6]) - Q[5] - 0x698098d8;   
-            x[ 9] = RR(Q[10] - Q[ 9], 12) - F(Q[ 9], Q[ 8], Q[ 7]) - Q[6] - 0x8b44f7af;   
-            x[12] = RR(Q[13] - Q[12],  7) - F(Q[12], Q[11], Q[10]) - Q[9] - 0x6b901122;
+    else if ( (strcmp(argv[i], "--chain") == 0) && (i+1 < argc) ) {
+      chain = atoi(argv[++i]);
+      if ( (chain <= 0) || (chain > MAX_CHAIN) ) {
+        printf("--chain needs a number of collisions from 1 to %d\n", MAX_CHAIN);
+        return 1;
+      }
+    }
 
-            Q[25] = Q[24] + RL(G(Q[24], Q[23], Q[22]) + Q[21] + x[ 9] + 0x21e1cde6,  5);
-            Q[26] = Q[25] + RL(G(Q[25], Q[24], Q[23]) + Q[22] + x[14] + 0xc33707d6,  9);
-            Q[27] = Q[26] + RL(G(Q[26], Q[25], Q[24]) + Q[23] + x[ 3] + 0xf4d50d87, 14);
-            Q[28] = Q[27] + RL(G(Q[27], Q[26], Q[25]) + Q[24] + x[ 8] + 0x455a14ed, 20);
-            Q[29] = Q[28] + RL(G(Q[28], Q[27], Q[26]) + Q[25] + x[13] + 0xa9e3e905,  5);
-            Q[30] = Q[29] + RL(G(Q[29], Q[28], Q[27]) + Q[26] + x[ 2] + 0xfcefa3f8,  9);
-            Q[31] = Q[30] + RL(G(Q[30], Q[29], Q[28]) + Q[27] + x[ 7] + 0x676f02d9, 14);
-            Q[32] = Q[31] + RL(G(Q[31], Q[30], Q[29]) + Q[28] + x[12] + 0x8d2a4c8a, 20);
-            Q[33] = Q[32] + RL(H(Q[32], Q[31], Q[30]) + Q[29] + x[ 5] + 0xfffa3942,  4);
-            Q[34] = Q[33] + RL(H(Q[33], Q[32], Q[31]) + Q[30] + x[ 8] + 0x8771f681, 11);
-            
-            // Extra conditions: Σ35,16 = 1                
-            sigma_Q35 = H(Q[34],Q[33],Q[32]) + Q[31] + x[11] + 0x6d9d6122;
-            if ( bit(sigma_Q35,16) != 1)
-              continue;
+    else if ( (strcmp(argv[i], "--fanout") == 0) && (i+1 < argc) ) {
+      fanout_limit = atoi(argv[++i]);
+      if (fanout_limit <= 0) {
+        printf("--fanout needs the number of collisions\n");
+        return 1;
+      }
+    }
 
-            Q[35] = Q[34] + RL(sigma_Q35 ,16);
-
-            Q[36] = Q[35] + RL(H(Q[35], Q[34], Q[33]) + Q[32] + x[14] + 0xfde5380c, 23);
-            Q[37] = Q[36] + RL(H(Q[36], Q[35], Q[34]) + Q[33] + x[ 1] + 0xa4beea44,  4);
-            Q[38] = Q[37] + RL(H(Q[37], Q[36], Q[35]) + Q[34] + x[ 4] + 0x4bdecfa9, 11);
-            Q[39] = Q[38] + RL(H(Q[38], Q[37], Q[36]) + Q[35] + x[ 7] + 0xf6bb4b60, 16);
-            Q[40] = Q[39] + RL(H(Q[39], Q[38], Q[37]) + Q[36] + x[10] + 0xbebfbc70, 23);
-            Q[41] = Q[40] + RL(H(Q[40], Q[39], Q[38]) + Q[37] + x[13] + 0x289b7ec6,  4);
-            Q[42] = Q[41] + RL(H(Q[41], Q[40], Q[39]) + Q[38] + x[ 0] + 0xeaa127fa, 11);
-            Q[43] = Q[42] + RL(H(Q[42], Q[41], Q[40]) + Q[39] + x[ 3] + 0xd4ef3085, 16);
-            Q[44] = Q[43] + RL(H(Q[43], Q[42], Q[41]) + Q[40] + x[ 6] + 0x04881d05, 23);
-            Q[45] = Q[44] + RL(H(Q[44], Q[43], Q[42]) + Q[41] + x[ 9] + 0xd9d4d039,  4);
-            Q[46] = Q[45] + RL(H(Q[45], Q[44], Q[43]) + Q[42] + x[12] + 0xe6db99e5, 11);
-            Q[47] = Q[46] + RL(H(Q[46], Q[45], Q[44]) + Q[43] + x[15] + 0x1fa27cf8, 16);
-            Q[48] = Q[47] + RL(H(Q[47], Q[46], Q[45]) + Q[44] + x[ 2] + 0xc4ac5665, 23);  
-            
-            //Last sufficient conditions
-            if ( bit(Q[48],32) != bit(Q[46],32) ) 
-              continue;
+    else if ( (strcmp(argv[i], "--harvest") == 0) && (i+1 < argc) ) {
+      harvest_limit = atoi(argv[++i]);
+      if (harvest_limit <= 0) {
+        printf("--harvest needs the number of collisions\n");
+        return 1;
+      }
+    }
 
-            Q[49] = Q[48] + RL(I(Q[48], Q[47], Q[46]) + Q[45] + x[0] + 0xf4292244, 6);
-            
-            if ( bit(Q[49], 32) != bit(Q[47],32) )
-              continue;
+    else if ( (strcmp(argv[i], "--harvest-jobs") == 0) && (i+1 < argc) ) {
+      harvest_jobs = atoi(argv[++i]);
+      if ( (harvest_jobs <= 0) || (harvest_jobs > MAX_THREADS) ) {
+        printf("--harvest-jobs needs a number of searches from 1 to %d\n", MAX_THREADS);
+        return 1;
+      }
+    }
 
-            Q[50] = Q[49] + RL( I(Q[49],Q[48],Q[47]) + Q[46]  + x[7] + 0x432aff97, 10); 
-            
-            if ( bit(Q[50], 32) != (bit(Q[48],32) ^ 1) ) 
-              continue;
+    else if ( (strcmp(argv[i], "--archive") == 0) && (i+1 < argc) )
+      archive_file = argv[++i];
+
+    else if ( (strcmp(argv[i], "--stage") == 0) && (i+1 < argc) ) {
+      i++;
+      if (strcmp(argv[i], "block1") == 0)
+        stage = 1;
+      else if (strcmp(argv[i], "block2") == 0)
+        stage = 2;
+      else {
+        printf("--stage is block1 or block2\n");
+        return 1;
+      }
+    }
 
-            Q[51] = Q[50] + RL( I(Q[50],Q[49],Q[48]) + Q[47] + x[14] + 0xab9423a7, 15); 
-            
-            if ( bit(Q[51], 32) != bit(Q[49],32) ) 
-              continue;
+    else if ( (strcmp(argv[i], "--input") == 0) && (i+1 < argc) )
+      stage_input = argv[++i];
 
-            Q[52] = Q[51] + RL( I(Q[51],Q[50],Q[49]) + Q[48] + x[5] + 0xfc93a039, 21);  
-             
-            if( bit(Q[52], 32) != bit(Q[50],32) ) 
-              continue;
-            
-            Q[53] = Q[52] + RL( I(Q[52],Q[51],Q[50]) + Q[49]  + x[12] + 0x655b59c3, 6); 
-            
-            if ( bit(Q[53], 32) != bit(Q[51],32) ) 
-              continue;
-            
-            Q[54] = Q[53] + RL( I(Q[53],Q[52],Q[51]) + Q[50] + x[3] + 0x8f0ccc92, 10);    
-            
-            if ( bit(Q[54], 32) != bit(Q[52],32) ) 
-              continue;
-            
-            Q[55] = Q[54] + RL( I(Q[54],Q[53],Q[52]) + Q[51] + x[10] + 0xffeff47d, 15);   
-            
-            if ( bit(Q[55], 32) != bit(Q[53],32) ) 
-              continue;
-            
-            Q[56] = Q[55] + RL( I(Q[55],Q[54],Q[53]) + Q[52] + x[1] + 0x85845dd1, 21);    
-            
-            if ( bit(Q[56], 32) != bit(Q[54],32) ) 
-              continue;
-            
-            Q[57] = Q[56] + RL( I(Q[56],Q[55],Q[54]) + Q[53] + x[8] + 0x6fa87e4f, 6);   
-            
-            if ( bit(Q[57], 32) != bit(Q[55],32) ) 
-              continue;
-            
-            Q[58] = Q[57] + RL( I(Q[57],Q[56],Q[55]) + Q[54] + x[15] + 0xfe2ce6e0, 10);   
-            
-            if ( bit(Q[58], 32) != bit(Q[56],32) ) 
-              continue;
-            
-            Q[59] = Q[58] + RL( I(Q[58],Q[57],Q[56]) + Q[55] + x[6] + 0xa3014314, 15);    
-            
-            if ( bit(Q[59], 32) != bit(Q[57],32) ) 
-              continue;
-            
-            Q[60] = Q[59] + RL( I(Q[59],Q[58],Q[57]) + Q[56] + x[13] + 0x4e0811a1, 21);   
-            
-            if ( bit(Q[60], 26) != 0 ) 
-              continue;
-            
-            if ( bit(Q[60], 32) != (bit(Q[58],32) ^ 1) ) 
-              continue;
-            
-            Q[61] = Q[60] + RL( I(Q[60],Q[59],Q[58]) + Q[57] + x[4] + 0xf7537e82, 6);   
-            
-            if ( bit(Q[61], 26) != 1 ) 
-              continue;
+    else if ( (strcmp(argv[i], "--cache") == 0) && (i+1 < argc) )
+      cache_file = argv[++i];
 
-            if ( bit(Q[61], 32) != bit(Q[59],32) ) 
-              continue;
-            
-            // Extra conditions: Σ62,16 ~ Σ62,22 not all 0  
-            // 0x003f8000 =  0000 0000 0011 1111 1000 0000 0000 0000 
-            sigma_Q62 = I(Q[61],Q[60],Q[59]) + Q[58] + x[11] + 0xbd3af235;
-            if ( (sigma_Q62 & 0x003f8000) == 0) 
-              continue;
+    else if (strcmp(argv[i], "--cache-reuse") == 0)
+      cache_reuse = 1;
 
-            Q[62] = Q[61] + RL(sigma_Q62 , 10);   
-            
-            if ( bit(Q[62], 26) != 1 ) 
-              continue; 
+    else if ( (strcmp(argv[i], "--cache-refill") == 0) && (i+2 < argc) ) {
+      refill_file = argv[++i];
+      refill_target = atoi(argv[++i]);
+    }
 
-            if ( bit(Q[62], 32) != bit(Q[60],32) ) 
-              continue;
+    else if ( (strcmp(argv[i], "--verify") == 0) && (i+1 < argc) )
+      verify_path = argv[++i];
 
-            Q[63] = Q[62] + RL( I(Q[62],Q[61],Q[60]) + Q[59] + x[2] + 0x2ad7d2bb, 15);    
+    else if ( (strcmp(argv[i], "--archive-index") == 0) && (i+1 < argc) )
+      archive_to_index = argv[++i];
 
-            if ( bit(Q[63], 26) != 1 ) 
-              continue;
-                     
-            if ( bit(Q[63], 32) != bit(Q[61],32) ) 
-              continue;
-   
-            Q[64] = Q[63] + RL( I(Q[63],Q[62],Q[61]) + Q[60] + x[9] + 0xeb86d391, 21);    
-            
-            //Condition not necessary (Sasaki), try to remove
-            if ( bit(Q[64], 26) != 1 ) 
-              continue; 
-             
-            //Block 2 is now completed. We verify if the differential path is reached.
+    else if ( (strcmp(argv[i], "--archive-find") == 0) && (i+5 < argc) ) {
+      archive_to_find = argv[++i];
+      for (int j=0; j<4; j++)
+        find_iv[j] = argv[++i];
+    }
 
-            //Message 1 intermediate hash     
-            AA0 = A0 + Q[61]; BB0 = B0 + Q[64];
-            CC0 = C0 + Q[63]; DD0 = D0 + Q[62];
+    else if ( (strcmp(argv[i], "--archive-hash") == 0) && (i+1 < argc) )
+      find_hash = argv[++i];
 
-            //Message 2 intermediate hash computation
-            for ( i=0; i<16; i++ ) 
-              Hx[i] = x[i];
-            
-            Hx[ 4] = x[ 4] - 0x80000000;
-            Hx[11] = x[11] - 0x00008000; 
-            Hx[14] = x[14] - 0x80000000;
+    else if ( (strcmp(argv[i], "--archive-export") == 0) && (i+2 < argc) ) {
+      archive_to_export = argv[++i];
+      archive_which = argv[++i];
+    }
 
-            a = A1; b = B1; c = C1; d = D1;
+    else if ( (strcmp(argv[i], "--chain-files") == 0) && (i+2 < argc) ) {
+      chain_desc = argv[++i];
+      chain_which = argv[++i];
+    }
 
-            HMD5Tr();
-            
-            AA1 = A1 + a; BB1 = B1 + b;
-            CC1 = C1 + c; DD1 = D1 + d;
-            
-            if ( ((AA1-AA0) != 0) || ((BB1-BB0) != 0) || ((CC1-CC0) != 0) || ((DD1-DD0) != 0) )
-              continue;
-            
-            //We have now found a collision!!
+    else if ( (strcmp(argv[i], "--sweep") == 0) && (i+1 < argc) )
+      sweep_list = argv[++i];
 
-            //I save the last intermediate hash for final hash computation
-            A0 = AA0; B0 = BB0; C0 = CC0; D0 = DD0;
+    else if ( (strcmp(argv[i], "--sweep-jobs") == 0) && (i+1 < argc) ) {
+      sweep_jobs = atoi(argv[++i]);
+      if ( (sweep_jobs <= 0) || (sweep_jobs > MAX_THREADS) ) {
+        printf("--sweep-jobs needs a number of searches from 1 to %d\n", MAX_THREADS);
+        return 1;
+      }
+    }
 
-            //I save both second blocks
-            for( i = 0; i < 16; i++ ) {
-              memcpy( &v1[64 + (i * 4)], &x[i],  4);
-              memcpy( &v2[64 + (i * 4)], &Hx[i], 4);
-            }
-          
-            return(0);
+    else if ( (strcmp(argv[i], "--sweep-out") == 0) && (i+1 < argc) )
+      sweep_out = argv[++i];
 
-          } //End of Tunnel Q9
-        } //End of MMMM Q4
-      } //End of MMMM Q1/12
-    } //End of MMMM Q16
-  } //End of general for
-  return(-1); //Collision not found
-}
+    else if ( (strcmp(argv[i], "--metrics") == 0) && (i+1 < argc) )
+      metrics_file = argv[++i];
 
+    else if ( (strcmp(argv[i], "--progress-json") == 0) && (i+1 < argc) ) {
+      progress_json = fopen(argv[++i], "w");
+      if (progress_json == NULL) {
+        printf("Can't write progress to %s\n", argv[i]);
+        return 1;
+      }
+    }
 
-int main ( int argc, char *argv[] ) {
+    else if ( (strncmp(argv[i], "--", 2) == 0) || (nargs == 6) ) {
+      printf("Unknown or incomplete argument %s\n", argv[i]);
+      return 1;
+    }
 
-  //Filenames of summary, and collisions m1, m2
-  char summary[64], m1_file[64], m2_file[64];
-  double B1_time=0, B2_time=0;
-  FILE *f;
-  uint8_t * p;
+    else
+      args[nargs++] = argv[i];
+  }
 
   printf("\nThis program creates a MD5 collision using the Tunneling method by V. Klima.\n");
   if (WRITE_BLOCKS_SUMMARY)
@@ -1576,13 +6089,149 @@ int main ( int argc, char *argv[] ) {
   printf("The program uses pseudorandom numbers and its behaviour is probabilistic.\n"); 
   printf("You can give as input 1 HEXnum to specify the seed to use.\n"); 
   printf("You can give as input 4 HEXnums to specify the custom IV for MD5.\n");
-  printf("You can give as input 5 HEXnums to specify the seed and custom IV.\n\n");
+  printf("You can give as input 5 HEXnums to specify the seed and custom IV.\n");
+  printf("You can give --tunnels followed by a list (B1Q4,B1Q9,B1Q10,B1Q13,B1Q14,B1Q20,B2Q9,B2Q12Q11) to choose the tunnels.\n");
+  printf("You can give --bytes [FIRST[-LAST]:][^]SET (more than once) to restrict the bytes of the colliding blocks.\n");
+  printf("You can give --autotune followed by seconds per trial to choose the fastest tunnels on this machine.\n");
+  printf("You can give --perf-stages to count cycles, instructions, branch and L1D misses in every search level.\n");
+  printf("You can give --progress and/or --progress-json FILE to report the progress every few seconds.\n");
+  printf("You can give --metrics FILE.prom to export metrics for the node_exporter textfile collector.\n");
+  printf("You can give --bench N (--bench-json FILE, --bench-baseline FILE) to benchmark N runs of a fixed corpus.\n");
+  printf("You can give --microbench to time the building blocks of the search on fixed inputs.\n");
+  printf("You can give --threads N to search with N threads, and --pin core|smt|node to pin them.\n");
+  printf("You can give --scaling S (--scaling-json FILE) to measure the speedup from 1 to N threads, S sec per trial.\n");
+  printf("You can give --prefix FILE and/or --suffix FILE to put the colliding blocks between them.\n");
+  printf("You can give --chain K to chain K collisions, and --chain-files DESCRIPTION N|FIRST-LAST|all to write their 2^K files.\n");
+  printf("You can give --fanout N to search N collisions with the same block 1.\n");
+  printf("You can give --harvest N (--harvest-jobs J) to search N collisions from all the near-collisions of block 1.\n");
+  printf("You can give --archive FILE to append the collisions to an archive, --archive-index FILE to index it,\n");
+  printf("  --archive-find FILE IV1 IV2 IV3 IV4 (--archive-hash HASH) to look them up, and --archive-export FILE N|all.\n");
+  printf("You can give --stage block1 to write the near-collision of block 1 (nc_md5_seed.bin), and --stage block2\n");
+  printf("  --input FILE to search block 2 for a near-collision written before.\n");
+  printf("You can give --cache FILE (--cache-reuse) to take the collision from a cache before searching it,\n");
+  printf("  and --cache-refill FILE N to keep N collisions for every IV requested, at idle priority.\n");
+  printf("You can give --verify ARCHIVE|DIR to verify the collisions of an archive or the pairs of a directory.\n");
+  printf("You can give --sweep LIST (--sweep-jobs J, --sweep-out FILE) to search a collision for every IV or prefix.\n\n");
+
+  cpus = pin_plan(pin_mode);
+  search_threads = max_threads ? max_threads : 1;
+
+  if (bench_runs > 0) {
+    if (benchmark(bench_runs, bench_json, bench_baseline)) {
+      printf("\nBenchmark failed!\n");
+      return 1;
+    }
+    return 0;
+  }
+
+  if (chain_desc != NULL)
+    return chain_files(chain_desc, chain_which);
+
+  if (archive_to_index != NULL) {
+    if (archive_index(archive_to_index)) {
+      printf("Can't index the archive %s\n", archive_to_index);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (archive_to_find != NULL) {
+    uint32_t iv[4], hash[4];
+    uint8_t * h = (uint8_t *) hash;
+    unsigned int byte;
+
+    for (int j=0; j<4; j++)
+      iv[j] = charhex_to_uint32(find_iv[j]);
+    for (int j=0; (find_hash != NULL) && (j<16); j++) {
+      if ( (strlen(find_hash) != 32) || (sscanf(find_hash + 2 * j, "%2x", &byte) != 1) ) {
+        printf("--archive-hash needs the 32 hex digits of a hash\n");
+        return 1;
+      }
+      h[j] = byte;
+    }
+
+    if (archive_find(archive_to_find, iv, find_hash ? hash : NULL)) {
+      printf("Can't read the archive %s or its index (--archive-index)\n", archive_to_find);
+      return 1;
+    }
+    return 0;
+  }
+
+
+  if ( ((fanout_limit > 1) + (chain > 1) + (harvest_limit > 0)) > 1 ) {
+    printf("Only one of --fanout, --chain and --harvest can be used\n");
+    return 1;
+  }
+
+  //The entries of the sweep are its prefixes, and each gives a single collision
+  if ( (sweep_list != NULL) && ((prefix_file != NULL) || (suffix_file != NULL) || (chain > 1) || (fanout_limit > 1) || 
+                                (harvest_limit > 0)) ) {
+    printf("--sweep can't be used with --prefix, --suffix, --chain, --fanout or --harvest\n");
+    return 1;
+  }
+
+  if ( (cache_file != NULL) && ((chain > 1) || (fanout_limit > 1) || (harvest_limit > 0) || (sweep_list != NULL)) ) {
+    printf("--cache can't be used with --chain, --fanout, --harvest or --sweep\n");
+    return 1;
+  }
+
+  if ( stage && ((chain > 1) || (fanout_limit > 1) || (harvest_limit > 0) || (sweep_list != NULL) || 
+                 (cache_file != NULL)) ) {
+    printf("--stage can't be used with --chain, --fanout, --harvest, --sweep or --cache\n");
+    return 1;
+  }
+
+  if ( (stage == 2) != (stage_input != NULL) ) {
+    printf("--input FILE goes with --stage block2, that needs it\n");
+    return 1;
+  }
+
+  if ( (stage == 1) && (archive_file != NULL) ) {
+    printf("--stage block1 can't be used with --archive\n");
+    return 1;
+  }
+
+  if ( (refill_file != NULL) && (refill_target < 1) ) {
+    printf("--cache-refill needs at least 1 collision per IV\n");
+    return 1;
+  }
+
+  if ( (archive_file != NULL) && ((chain > 1) || (sweep_list != NULL)) ) {
+    printf("--archive can't be used with --chain or --sweep\n");
+    return 1;
+  }
+
+  //The prefix and the suffix are read twice, to hash them and to write the messages: a pipe would be empty the second time
+  const char * around[2] = { prefix_file, suffix_file };
+  for (int i=0; i<2; i++) {
+    struct stat st;
+    if ( (around[i] != NULL) && (stat(around[i], &st) || !S_ISREG(st.st_mode)) ) {
+      printf("The %s %s must be a regular file\n", i ? "suffix" : "prefix", around[i]);
+      return 1;
+    }
+  }
+
+  if (scaling_time > 0) {
+    if (scaling(max_threads ? max_threads : (cpus < MAX_THREADS ? cpus : MAX_THREADS), scaling_time, scaling_json)) {
+      printf("\nScaling can't be written to %s!\n", scaling_json);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (micro) {
+    if (microbench()) {
+      printf("\nThe inputs of the microbenchmark don't satisfy the conditions!\n");
+      return 1;
+    }
+    return 0;
+  }
   
   //Seed is passed or generated
   uint32_t seed;
 
-  if ( (argc == 2) || (argc == 6) )
-    seed = charhex_to_uint32( argv[1] );
+  if ( (nargs == 2) || (nargs == 6) )
+    seed = charhex_to_uint32( args[1] );
   else {
     seed = (uint32_t) mix( clock() ^ time(NULL) ^ getpid() );
   }
@@ -1595,15 +6244,49 @@ int main ( int argc, char *argv[] ) {
   IV3=0x98badcfe; IV4=0x10325476;
 
   //Init vectors are passed
-  if(argc==5) { 
-    IV1=charhex_to_uint32(argv[1]); IV2=charhex_to_uint32(argv[2]);
-    IV3=charhex_to_uint32(argv[3]); IV4=charhex_to_uint32(argv[4]);
+  if(nargs==5) { 
+    IV1=charhex_to_uint32(args[1]); IV2=charhex_to_uint32(args[2]);
+    IV3=charhex_to_uint32(args[3]); IV4=charhex_to_uint32(args[4]);
   }
 
   //Init vectors and seed are passed
-  if(argc==6) { 
-    IV1=charhex_to_uint32(argv[2]); IV2=charhex_to_uint32(argv[3]);
-    IV3=charhex_to_uint32(argv[4]); IV4=charhex_to_uint32(argv[5]);
+  if(nargs==6) { 
+    IV1=charhex_to_uint32(args[2]); IV2=charhex_to_uint32(args[3]);
+    IV3=charhex_to_uint32(args[4]); IV4=charhex_to_uint32(args[5]);
+  }
+
+  //The prefixes of the sweep are hashed from the IV in use
+  if (sweep_list != NULL)
+    return sweep(sweep_list, sweep_jobs, sweep_out, seed);
+
+  //The exported messages go between the prefix and the suffix, that must be the ones of the records
+  if (archive_to_export != NULL)
+    return archive_export(archive_to_export, archive_which, prefix_file, suffix_file);
+
+  //The pairs of a directory are hashed from the IV given, all the CPUs verify unless --threads is given
+  if (verify_path != NULL)
+    return verify(verify_path, max_threads ? max_threads : cpus);
+
+  //The prefix, padded with zeros to a whole block, is hashed from the IV: its chaining value is the IV of block 1
+  md5_init(&message, IV1, IV2, IV3, IV4);
+  if (prefix_file != NULL) {
+
+    if (md5_file(&message, prefix_file)) {
+      printf("Can't read the prefix %s\n", prefix_file);
+      return 1;
+    }
+
+    printf("Prefix      : %s, %llu bytes + %llu bytes of padding\n", prefix_file, (unsigned long long) message.length,
+           (unsigned long long) ((64 - message.length % 64) % 64));
+    md5_pad_zero(&message);
+
+    IV1 = message.state[0]; IV2 = message.state[1];
+    IV3 = message.state[2]; IV4 = message.state[3];
+  }
+
+  if ( (suffix_file != NULL) && access(suffix_file, R_OK) ) {
+    printf("Can't read the suffix %s\n", suffix_file);
+    return 1;
   }
 
   //We print the IV in use
@@ -1612,143 +6295,358 @@ int main ( int argc, char *argv[] ) {
   //Seed printing
   printf( "\nSeed set to 0x%08X\n", seed);
 
-  
-  ///////////////////////////////////////////////////////////////
-  ///                        Block 1                           //
-  ///////////////////////////////////////////////////////////////
-  //Timer starts
-  Timer();
+  if (search_threads > 1)
+    printf("Search threads : %d (pinning: %s)\n", search_threads, pin_names[pin_mode]);
+
+  //Tunnels printing
+  printf( "Tunnels in use :");
+  for (int i=0; i<TUNNELS_NUMBER; i++)
+    if (tunnels & (1u << i))
+      printf(" %s", tunnel_names[i]);
+  printf("\n");
+
+  //Byte rules printing, with the share of the random blocks of message 1 that satisfy them
+  if (byte_rules) {
+    double share = 1;
+    int block1 = 0;
+    for (int i=0; i<128; i++) {
+      int n = 0;
+      for (int j=0; j<4; j++)
+        n += __builtin_popcountll(byte_allowed[i][j]);
+      if (n == 0) {
+        printf("No value is allowed for byte %d\n", i);
+        return 1;
+      }
+      share *= n / 256.0;
+      block1 |= (i < 64) && (n < 256);
+    }
+    printf("Byte rules : %d (satisfied by a share %.3g of the random blocks)\n", byte_rules, share);
 
-  //Block 1 generation
-  printf("\nGenerating block 1 ...\n");
-  
-  if (Block1() == -1) {
-    printf("\nCollision not found!\n");
+    //Block 1 is only rejected in its inner levels: its rules are measured slower than filtering the collisions found
+    if (block1)
+      printf("Warning    : the rules restrict block 1 (bytes 0-63), which can then take much longer than searching\n"
+             "             without them and filtering the collisions. Rules on bytes 64-127 only don't have this cost.\n");
+  }
+
+  //The collisions go to the archive instead of the summary and messages, through its writer thread
+  if (archive_file != NULL) {
+    if (archive_open(archive_file, message.length)) {
+      printf("Can't append to the archive %s\n", archive_file);
+      return 1;
+    }
+    printf("Archive : %s\n", archive_file);
+  }
+
+  //The near-collision gives the IV of block 2: the one of the prefix, or the IV in use if there is no prefix
+  if (stage == 2) {
+    const char * errors[] = { "", "can't be read", "doesn't hold the values of its block", "isn't a near-collision",
+                              "doesn't meet the IHV conditions of block 2" };
+    int error = stage_read(stage_input, stage_iv);
+
+    if (error) {
+      printf("The near-collision %s %s\n", stage_input, errors[error]);
+      return 1;
+    }
+    if ( (prefix_file != NULL) && memcmp(stage_iv, message.state, 16) ) {
+      printf("The near-collision %s wasn't found after the prefix %s\n", stage_input, prefix_file);
+      return 1;
+    }
+    IV1 = stage_iv[0]; IV2 = stage_iv[1];
+    IV3 = stage_iv[2]; IV4 = stage_iv[3];
+    memcpy(message.state, stage_iv, 16);
+
+    printf("\nNear-collision read from %s, init vector 0x%08X,0x%08X,0x%08X,0x%08X\n", stage_input, IV1, IV2, IV3, 
+           IV4);
+  }
+
+  //The refill searches collisions for the IVs of the cache, this one included, until it is stopped
+  if (refill_file != NULL)
+    return cache_refill(refill_file, refill_target, seed);
+
+  //A collision of the cache is handed out at once, a miss is searched as usual (and the refill will search its IV)
+  if (cache_file != NULL) {
+    if (cache_open(&cache, cache_file)) {
+      printf("Can't open the cache %s\n", cache_file);
+      return 1;
+    }
+    take_time = now();
+    slot = cache_take(&cache, (uint32_t[4]) { IV1, IV2, IV3, IV4 }, cache_reuse, v1, v2, &cache_seed);
+    take_time = now() - take_time;
+    cache_close(&cache);
+
+    //The outputs and the archive record are named after the seed that reproduces the collision
+    if (slot >= 0) {
+      printf("\nCollision taken from the cache %s in %.1f usec (slot %d, found with seed 0x%08X, used from now on)\n", 
+             cache_file, take_time * 1e6, slot, cache_seed);
+      seed = cache_seed;
+      md5_update(&message, v1, 128);
+      A0 = message.state[0]; B0 = message.state[1];
+      C0 = message.state[2]; D0 = message.state[3];
+      cached = 1;
+    }
+    else
+      printf("\nNo collision for this IV in the cache %s, searching it\n", cache_file);
+  }
+
+  //With --harvest the searches of both blocks run at the same time, and write their own description
+  if (harvest_limit > 0) {
+    sprintf(summary, "harvest_md5_%08X.txt", seed);
+    printf("\nHarvesting %d collisions to %s, with %d search(es) of block 2 at a time\n\n", harvest_limit, summary, 
+           harvest_jobs);
+    fflush(stdout);
+    if (harvest_run(harvest_limit, harvest_jobs, seed, summary, prefix_file, suffix_file)) {
+      printf("\nCan't write the harvest description %s\n", summary);
+      return 1;
+    }
+    if (archive_file != NULL) {
+      failed = archive_close();
+      printf("Writing %llu records to the archive %s: %s", (unsigned long long) archive.written, archive_file, 
+             failed ? "FAILED\n" : "OK\n");
+    }
     return 0;
   }
 
-  //We get time elapsed for first block generation
-  B1_time = Timer();   
+  //Autotuning of Block 1 tunnels
+  if ( (autotune_time > 0) && !cached && (stage != 2) )
+    autotune(1, autotune_time);
 
-  printf("First block collision took  : %f sec\n", B1_time);
+  memset(&total_stats, 0, sizeof(total_stats));
 
+  if ( perf_stages && perf_open() ) {
+    printf("\nHardware events can't be counted on this machine (perf_event_open failed).\n");
+    perf_stages = 0;
+  }
 
-  ///////////////////////////////////////////////////////////////
-  ///                        Block 2                           //
-  ///////////////////////////////////////////////////////////////
-  //Timer starts
-  Timer();
-  
-  //Block 2 generation
-  printf("\nGenerating block 2 ...\n");
-  
-  if (Block2() == -1) {
-    printf("\nCollision not found!\n");
+  //The monitor runs until the end of Block 2
+  if ( (progress_text || progress_json || metrics_file) && !cached ) {
+    if (progress_interval <= 0)
+      progress_interval = 5;
+    monitor_total = &total_stats;
+    fflush(stdout);
+    if (pthread_create(&monitor, NULL, monitor_thread, NULL)) {
+      printf("\nProgress monitor can't be started.\n");
+      progress_text = 0;
+      progress_json = NULL;
+      metrics_file = NULL;
+    }
+  }
+
+  //The chain description gets each pair of blocks as soon as it is found
+  if (chain > 1) {
+    sprintf(chain_name, "chain_md5_%08X.txt", seed);
+    chain_file = chain_open(chain_name, chain, seed, prefix_file, suffix_file);
+    if (chain_file == NULL) {
+      printf("\nCan't write the chain description %s\n", chain_name);
+      return 1;
+    }
+  }
+
+  //With --chain the collisions are searched one after the other, each from the chaining value of the previous one
+  for (int link = 0; (link < chain) && !cached; link++) {
+
+    if (chain > 1)
+      printf("\nCollision %d of %d, init vector 0x%08X,0x%08X,0x%08X,0x%08X\n", link + 1, chain, IV1, IV2, IV3, IV4);
+
+    search_start = now();
+
+
+    ///////////////////////////////////////////////////////////////
+    ///                        Block 1                           //
+    ///////////////////////////////////////////////////////////////
+    //With --stage block2 the near-collision of block 1 was read from the input
+    if (stage != 2) {
+
+      //Timer starts
+      Timer();
+
+      //Block 1 generation
+      printf("\nGenerating block 1 ...\n");
+    
+      PROBE(block1_start, seed, IV1, IV2, IV3, IV4);
+
+      fflush(stdout);
+      __atomic_store_n(&monitor_block, 1, __ATOMIC_RELEASE);
+
+      if (parallel_search(1, search_threads, &total_stats) == -1) {
+        printf("\nCollision not found!\n");
+        return 0;
+      }
+
+      //We get time elapsed for first block generation
+      link_time = Timer();   
+      B1_time += link_time;
+
+      __atomic_store_n(&monitor_block, 0, __ATOMIC_RELEASE);
+
+      printf("First block collision took  : %f sec\n", link_time);
+    }
+
+    //With --stage block1 the near-collision is written instead of searching block 2
+    if (stage == 1)
+      break;
+
+
+    ///////////////////////////////////////////////////////////////
+    ///                        Block 2                           //
+    ///////////////////////////////////////////////////////////////
+    //Autotuning of Block 2 tunnels, on the chaining value of the first block 1
+    if ( (autotune_time > 0) && (link == 0) )
+      autotune(2, autotune_time);
+
+    //Timer starts
+    Timer();
+    
+    //Block 2 generation
+    printf("\nGenerating block 2 ...\n");
+    
+    PROBE(block2_start, seed, A0, B0, C0, D0);
+
+    //With --fanout every collision goes to the fan-out description, until there are fanout_limit of them
+    if (fanout_limit > 1) {
+      sprintf(fanout_name, "fanout_md5_%08X.txt", seed);
+      if (fanout_open(fanout_name, fanout_limit, seed, prefix_file, suffix_file, B1_time)) {
+        printf("\nCan't write the fan-out description %s\n", fanout_name);
+        return 1;
+      }
+      search_sink = fanout_add;
+    }
+
+    fflush(stdout);
+    __atomic_store_n(&monitor_block, 2, __ATOMIC_RELEASE);
+
+    if (parallel_search(2, search_threads, &total_stats) == -1) {
+      printf("\nCollision not found!\n");
+      return 0;
+    }
+
+    //We get time elapsed for second block generation
+    link_time = Timer(); 
+    B2_time += link_time;
+
+    __atomic_store_n(&monitor_block, 0, __ATOMIC_RELEASE);
+
+    observe_collision(now() - search_start);
+
+    printf("Second block collision took : %f sec\n", link_time);
+
+    //The messages go on from the chaining value of block 2, that is the IV of the next collision
+    message.state[0] = A0; message.state[1] = B0;
+    message.state[2] = C0; message.state[3] = D0;
+    message.length += 128;
+
+    if (chain > 1) {
+      chain_add(chain_file, link, v1, v2);
+      IV1 = A0; IV2 = B0;
+      IV3 = C0; IV4 = D0;
+    }
+  }
+
+  //With --fanout the sink already archived every collision
+  if ( (archive_file != NULL) && (fanout_limit == 1) )
+    archive_add(seed, (uint32_t[4]) { IV1, IV2, IV3, IV4 }, (uint32_t[4]) { A0, B0, C0, D0 }, (void *) v1, (void *) v2,
+                B1_time, B2_time);
+
+  if ( (progress_text || progress_json || metrics_file) && !cached ) {
+    __atomic_store_n(&monitor_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(monitor, NULL);
+    if (progress_json)
+      fclose(progress_json);
+    if (metrics_file && write_metrics())
+      printf("Metrics can't be written to %s\n", metrics_file);
+  }
+
+  //Prints how many candidates each Block 2 level produced, unless it didn't run (--stage block1)
+  if (PRINT_B2_STATS && (stage != 1)) {
+    printf("MMMM Q12/Q11 iterations     : %llu, passed Q22-Q23: %llu (%.2f%%)\n", 
+           (unsigned long long) total_stats.stage_itr[ST_B2_Q12Q11], (unsigned long long) total_stats.stage_pass[ST_B2_Q12Q11],
+           total_stats.stage_itr[ST_B2_Q12Q11] ? 100.0 * total_stats.stage_pass[ST_B2_Q12Q11] / total_stats.stage_itr[ST_B2_Q12Q11] : 0);
+    printf("Tunnel Q9 iterations        : %llu, passed Q25-Q64: %llu (%.4f%%)\n", 
+           (unsigned long long) total_stats.stage_itr[ST_B2_Q9], (unsigned long long) total_stats.stage_pass[ST_B2_Q9],
+           total_stats.stage_itr[ST_B2_Q9] ? 100.0 * total_stats.stage_pass[ST_B2_Q9] / total_stats.stage_itr[ST_B2_Q9] : 0);
+  }
+
+  if (perf_stages)
+    print_perf_stages(&total_stats);
+
+  //With --stage block1 the search ends with the near-collision
+  if (stage == 1) {
+    sprintf(summary, "nc_md5_%08X.bin", seed);
+    printf("\nWriting the near-collision to %s: %s", summary, stage_write(summary) ? "FAILED\n" : "OK\n");
+    printf("Block 2 can be searched with --stage block2 --input %s\n", summary);
     return 0;
   }
 
-  //We get time elapsed for second block generation
-  B2_time = Timer(); 
-       
-  //Prints the total times
-  printf("Second block collision took : %f sec\n", B2_time);
+#if COUNT_CONDITIONS
+  //Prints and stores where the candidates of both blocks were rejected
+  print_stats(&total_stats);
+
+  sprintf(summary, "stats_md5_%08X.json", seed);
+  printf("\nWriting statistics to %s: %s", summary, write_stats_json(summary, &total_stats, seed) ? "FAILED\n" : "OK\n");
+#endif
   printf("\nFirst and second block took together : %f sec\n", B1_time + B2_time);
      
   ///////////////////////////////////////////////////////////////
   ///                    COLLISION DATA                        //
   ///////////////////////////////////////////////////////////////
   
-  //If requested, final hash is computed
-  if (PRINT_FINAL_HASH || PRINT_FINAL_HASH_IN_SUMMARY) {
-    
-    //Last message block computation (Padding)
-    for (int i=0; i<16; i++ ) 
-            Hx[i] = 0;
+  //If requested, final hash is computed: the messages end with the suffix after the last block 2. The messages written
+  //must have the length hashed.
+  if (PRINT_FINAL_HASH || PRINT_FINAL_HASH_IN_SUMMARY || WRITE_BLOCKS_TO_DISK || (chain > 1)) {
 
-    Hx[ 0] = 0x00000080;
-    Hx[14] = 0x00000400;
+    if ( (suffix_file != NULL) && md5_file(&message, suffix_file) )
+      printf("\nCan't read the suffix %s\n", suffix_file);
+    message_length = message.length;
 
-    //Hash computation
-    a = A0; b = B0; c = C0; d = D0; 
-    HMD5Tr();
-    A0 += a; B0 += b; C0 += c; D0 += d;
-  
+    //Padding and length
+    md5_finish(&message);
+
+    A0 = message.state[0]; B0 = message.state[1];
+    C0 = message.state[2]; D0 = message.state[3];
   }
 
   // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-  if (WRITE_BLOCKS_SUMMARY) {
-
-    //We store the filenames of our collision blocks
-    sprintf(summary, "collision_md5_%08X.txt", seed);
-
-    f = fopen(summary, "a");
+  if (chain > 1) {
+    printf("\nWriting the description of the %d collisions to %s: %s", chain, chain_name, 
+           chain_close(chain_file, A0, B0, C0, D0) ? "FAILED\n" : "OK\n");
+    printf("Its 2^%d files can be written with --chain-files %s N|FIRST-LAST%s\n", chain, chain_name, 
+           (chain <= CHAIN_FILES_ALL) ? "|all" : "");
+  }
 
-    //Print message 1 bytes in summary file
-    fprintf(f, "\nunsigned char m0[128] = {\n");
-    for ( int i=0; i<128; i++ ) {  
-      
-      if ( (i != 0) && ((i % 16) == 0) ) 
-        fprintf( f, "\n" );
-      
-      fprintf(f,"0x%02X", v1[i] );
-      
-      if ( i != 127 ) 
-        fprintf( f, "," );
-      else 
-        fprintf( f, "\n};\n" );
-    } 
-
-    //Print message 2 bytes in summary file
-    fprintf(f, "\nunsigned char m1[128] = {\n");
-    for ( int i=0; i<128; i++ ) {  
-      
-      if ( (i != 0) && ((i % 16) == 0) ) 
-        fprintf( f, "\n" );
-      
-      fprintf(f,"0x%02X", v2[i] );
-      
-      if ( i != 127 ) 
-        fprintf( f, "," );
-      else 
-        fprintf( f, "\n};\n\n" );
-    } 
+  // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-    //Print times in summary
-    fprintf(f,"/* First collision block took  : %f sec */\n", B1_time);
-    fprintf(f,"/* Second collision block took : %f sec */\n", B2_time);
+  if (fanout_limit > 1) {
+    search_sink = NULL;
+    printf("\nWriting the %d collisions with the same block 1 to %s: %s", fanout_limit, fanout_name,
+           fanout_close() ? "FAILED\n" : "OK\n");
+    if (archive_file == NULL)
+      printf("The last one is also written as the summary and messages below.\n");
+  }
 
-    if (PRINT_FINAL_HASH_IN_SUMMARY) {
-      
-      fprintf(f, "/* Colliding hash: ");
-      p = (uint8_t *) &A0;
-      fprintf(f, "%02x%02x%02x%02x", p[0], p[1], p[2], p[3]);
-      p = (uint8_t *) &B0;
-      fprintf(f, "%02x%02x%02x%02x", p[0], p[1], p[2], p[3]);
-      p = (uint8_t *) &C0;
-      fprintf(f, "%02x%02x%02x%02x", p[0], p[1], p[2], p[3]);
-      p = (uint8_t *) &D0;
-      fprintf(f, "%02x%02x%02x%02x", p[0], p[1], p[2], p[3]);    
-      fprintf(f, " */\n");
+  // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-    }
+  //The blocks of a single collision are written as the two messages
+  if (WRITE_BLOCKS_SUMMARY && (chain == 1) && (archive_file == NULL)) {
 
-    fclose(f);
+    //We store the filenames of our collision blocks
+    sprintf(summary, "collision_md5_%08X.txt", seed);
 
+    if (write_summary(summary, v1, v2, prefix_file, suffix_file, B1_time, B2_time, (uint32_t[4]) { A0, B0, C0, D0 }))
+      printf("\nCan't write the summary %s\n", summary);
   }
 
   // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-  if (WRITE_BLOCKS_TO_DISK) {
+  if (WRITE_BLOCKS_TO_DISK && (chain == 1) && (archive_file == NULL)) {
 
     //Writing block to disk
     sprintf(m1_file, "collision1_md5_%08X.bin",seed);
     sprintf(m2_file, "collision2_md5_%08X.bin",seed);
 
     printf("\nWriting Message 1 to disk: ");
-    printf((write_block(m1_file, (void *)v1) ? "FAILED\n" : "OK\n"));
+    printf((write_message(m1_file, prefix_file, (void *)v1, suffix_file, message_length) ? "FAILED\n" : "OK\n"));
     printf("Writing Message 2 to disk: ");
-    printf((write_block(m2_file, (void *)v2) ? "FAILED\n" : "OK\n"));
+    printf((write_message(m2_file, prefix_file, (void *)v2, suffix_file, message_length) ? "FAILED\n" : "OK\n"));
   
   }   
 
@@ -1770,6 +6668,13 @@ int main ( int argc, char *argv[] ) {
 
   }
 
+  //The writer is joined before the records it wrote are counted
+  if (archive_file != NULL) {
+    failed = archive_close();
+    printf("\nWriting %llu records to the archive %s: %s", (unsigned long long) archive.written, archive_file, 
+           failed ? "FAILED\n" : "OK\n");
+  }
+
   printf("\nGeneration completed.\n");
 
   return 0;  